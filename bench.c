@@ -0,0 +1,948 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#define _POSIX_C_SOURCE 200809L
+#include <unistd.h>
+#include "load_balancer.h"
+#include "latency.h"
+#include "profile.h"
+#include "wal.h"
+#include "migration.h"
+#include "hashtable.h"
+#include "replication.h"
+#include "bulk_load.h"
+#include "zones.h"
+#include "ring_analysis.h"
+#include "planner.h"
+#include "utils.h"
+
+/*
+ * Micro-benchmarks of the load balancer; every section can be run on its
+ * own: `./bench [section...]` (all sections when none is given).
+ */
+
+#define BENCH_KEYS 200000
+#define BENCH_SERVERS 50
+#define BENCH_KEY_LENGTH 32
+#define BENCH_KEY_CHARS 20  /* "key_" and 16 hex digits */
+#define BENCH_VALUE_LENGTH 64
+#define BENCH_WAL_PATH "bench_wal.log"
+#define BENCH_LARGE_SERVERS 20000
+#define BENCH_ZONES 100
+#define BENCH_CHURN 2000
+#define BENCH_RING_SIZES {1000, 10000, 100000}
+#define BENCH_RING_REPORTS 10
+#define BENCH_PLAN_SERVERS 20
+
+typedef struct bench_data bench_data;
+struct bench_data {
+	int no_keys;
+	char (*keys)[BENCH_KEY_LENGTH];
+	char (*values)[BENCH_VALUE_LENGTH];
+};
+
+/* xorshift, so every run uses the same keys */
+static unsigned long long bench_rand(unsigned long long *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static void bench_data_init(bench_data *data, int no_keys)
+{
+	unsigned long long state = 0x9E3779B97F4A7C15ull;
+
+	data->no_keys = no_keys;
+	data->keys = calloc(no_keys, sizeof(*data->keys));
+	DIE(!data->keys, "calloc() for data->keys failed\n");
+	data->values = calloc(no_keys, sizeof(*data->values));
+	DIE(!data->values, "calloc() for data->values failed\n");
+
+	for (int i = 0; i < no_keys; i++) {
+		snprintf(data->keys[i], BENCH_KEY_LENGTH, "key_%016llx",
+				 bench_rand(&state));
+		snprintf(data->values[i], BENCH_VALUE_LENGTH,
+				 "{\"id\":%d,\"state\":\"%08llx\"}", i,
+				 bench_rand(&state) & 0xFFFFFFFF);
+	}
+}
+
+static void bench_data_free(bench_data *data)
+{
+	free(data->keys);
+	free(data->values);
+}
+
+static load_balancer *bench_cluster(int no_servers)
+{
+	load_balancer *main = init_load_balancer();
+
+	for (int i = 0; i < no_servers; i++)
+		loader_add_server(main, i);
+
+	return main;
+}
+
+static void bench_report(const char *name, int ops, unsigned long long ns)
+{
+	printf("%-28s %10d ops %10.3f ms %12.0f ops/s\n", name, ops, ns / 1e6,
+		   ops / (ns / 1e9));
+}
+
+static void bench_store(bench_data *data)
+{
+	load_balancer *main = bench_cluster(BENCH_SERVERS);
+	int server_id;
+
+	unsigned long long start = lat_now_ns();
+	for (int i = 0; i < data->no_keys; i++)
+		loader_store(main, data->keys[i], data->values[i], &server_id);
+	bench_report("store", data->no_keys, lat_now_ns() - start);
+
+	start = lat_now_ns();
+	for (int i = 0; i < data->no_keys; i++)
+		DIE(!loader_retrieve(main, data->keys[i], &server_id),
+			"stored key not found");
+	bench_report("retrieve", data->no_keys, lat_now_ns() - start);
+
+	// the same reads, with the lengths of the keys known
+	start = lat_now_ns();
+	for (int i = 0; i < data->no_keys; i++)
+		DIE(!loader_retrieve_len(main, data->keys[i], BENCH_KEY_CHARS, NULL,
+								 &server_id), "stored key not found");
+	bench_report("retrieve (_len)", data->no_keys, lat_now_ns() - start);
+
+	// keys of the same length that were never stored
+	char key[BENCH_KEY_LENGTH];
+	start = lat_now_ns();
+	for (int i = 0; i < data->no_keys; i++) {
+		memcpy(key, data->keys[i], BENCH_KEY_LENGTH);
+		key[0] = 'K';
+		DIE(loader_retrieve(main, key, &server_id), "missing key found");
+	}
+	bench_report("retrieve (missing)", data->no_keys, lat_now_ns() - start);
+
+	start = lat_now_ns();
+	for (int i = 0; i < data->no_keys; i++)
+		loader_store(main, data->keys[i], data->values[i], &server_id);
+	bench_report("store (update)", data->no_keys, lat_now_ns() - start);
+
+	free_load_balancer(main);
+}
+
+/*
+ * The generic functions of the hashtable vs their typed variants (the
+ * length-explicit functions, for the string keys)
+ */
+static void bench_typed(bench_data *data)
+{
+	for (int typed = 0; typed <= 1; typed++) {
+		hashtable_t *ht = ht_create(HMAX, hash_function_string,
+									compare_function_strings,
+									key_val_free_function);
+
+		unsigned long long start = lat_now_ns();
+		for (int i = 0; i < data->no_keys; i++) {
+			if (typed)
+				ht_put_encoded_len(ht, data->keys[i], BENCH_KEY_CHARS,
+								   data->values[i], BENCH_VALUE_LENGTH, 0, 0);
+			else
+				ht_put(ht, data->keys[i], BENCH_KEY_CHARS + 1,
+					   data->values[i], BENCH_VALUE_LENGTH);
+		}
+		bench_report(typed ? "string put (_len)" : "string put",
+					 data->no_keys, lat_now_ns() - start);
+
+		start = lat_now_ns();
+		for (int i = 0; i < data->no_keys; i++)
+			DIE(!(typed ?
+				  ht_get_entry_len(ht, data->keys[i], BENCH_KEY_CHARS) :
+				  ht_get_entry(ht, data->keys[i])), "stored key not found");
+		bench_report(typed ? "string get (_len)" : "string get",
+					 data->no_keys, lat_now_ns() - start);
+
+		ht_free(ht);
+	}
+
+	for (int typed = 0; typed <= 1; typed++) {
+		hashtable_t *ht = ht_create(HMAX, hash_function_int,
+									compare_function_ints,
+									key_val_free_function);
+
+		unsigned long long start = lat_now_ns();
+		for (int i = 0; i < data->no_keys; i++) {
+			if (typed)
+				ht_int_put_encoded(ht, &i, sizeof(i), &i, sizeof(i), 0, 0);
+			else
+				ht_put(ht, &i, sizeof(i), &i, sizeof(i));
+		}
+		bench_report(typed ? "int put (typed)" : "int put", data->no_keys,
+					 lat_now_ns() - start);
+
+		start = lat_now_ns();
+		for (int i = 0; i < data->no_keys; i++)
+			DIE(!(typed ? ht_int_get_entry(ht, &i) : ht_get_entry(ht, &i)),
+				"stored key not found");
+		bench_report(typed ? "int get (typed)" : "int get", data->no_keys,
+					 lat_now_ns() - start);
+
+		ht_free(ht);
+	}
+}
+
+/* topology changes on a large cluster: flat hashring vs zoned hashring */
+static void bench_zones(bench_data *data)
+{
+	for (int zoned = 0; zoned <= 1; zoned++) {
+		load_balancer *main = init_load_balancer();
+		int server_id;
+
+		if (zoned)
+			DIE(loader_enable_zones(main, BENCH_ZONES),
+				"loader_enable_zones() failed");
+
+		unsigned long long start = lat_now_ns();
+		for (int i = 0; i < BENCH_LARGE_SERVERS; i++)
+			loader_add_server(main, i);
+		bench_report(zoned ? "add_server (zoned)" : "add_server (flat)",
+					 BENCH_LARGE_SERVERS, lat_now_ns() - start);
+
+		for (int i = 0; i < data->no_keys; i++)
+			loader_store(main, data->keys[i], data->values[i], &server_id);
+
+		start = lat_now_ns();
+		for (int i = 0; i < data->no_keys; i++)
+			DIE(!loader_retrieve(main, data->keys[i], &server_id),
+				"stored key not found");
+		bench_report(zoned ? "retrieve (zoned)" : "retrieve (flat)",
+					 data->no_keys, lat_now_ns() - start);
+
+		// a server leaves and comes back, with its keys
+		start = lat_now_ns();
+		for (int i = 0; i < BENCH_CHURN; i++) {
+			int churned = (i * 7919) % BENCH_LARGE_SERVERS;
+
+			loader_remove_server(main, churned);
+			loader_add_server(main, churned);
+		}
+		bench_report(zoned ? "remove + add (zoned)" : "remove + add (flat)",
+					 BENCH_CHURN, lat_now_ns() - start);
+
+		free_load_balancer(main);
+	}
+}
+
+/* ring mutation alone: churn on empty clusters of growing sizes */
+static void bench_churn(bench_data *data)
+{
+	int sizes[] = BENCH_RING_SIZES;
+	char name[64];
+
+	(void)data;
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		load_balancer *main = init_load_balancer();
+
+		for (int i = 0; i < sizes[s]; i++)
+			loader_add_server(main, i);
+
+		unsigned long long start = lat_now_ns();
+		for (int i = 0; i < BENCH_CHURN; i++) {
+			int churned = (i * 7919) % sizes[s];
+
+			loader_remove_server(main, churned);
+			loader_add_server(main, churned);
+		}
+		snprintf(name, sizeof(name), "remove + add, %d servers", sizes[s]);
+		bench_report(name, BENCH_CHURN, lat_now_ns() - start);
+
+		free_load_balancer(main);
+	}
+}
+
+/*
+ * Ring analysis of loaded clusters of growing sizes: the report (refreshed
+ * in place), then the predictions for servers added and removed.
+ */
+static void bench_ring(bench_data *data)
+{
+	int sizes[] = BENCH_RING_SIZES;
+	char name[64];
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		load_balancer *main = bench_cluster(sizes[s]);
+		ring_report report = {0};
+		unsigned long long keys_moved, total_moved = 0;
+		int server_id;
+
+		for (int i = 0; i < data->no_keys; i++)
+			loader_store(main, data->keys[i], data->values[i], &server_id);
+
+		unsigned long long start = lat_now_ns();
+		for (int i = 0; i < BENCH_RING_REPORTS; i++)
+			ring_analyze(main, &report);
+		snprintf(name, sizeof(name), "ring_analyze, %d servers", sizes[s]);
+		bench_report(name, BENCH_RING_REPORTS, lat_now_ns() - start);
+		printf("       share: max %.4f%% stddev %.4f%% gini %.4f, "
+			   "key skew %.4f%%\n", 100 * report.max_share,
+			   100 * report.stddev_share, report.gini,
+			   100 * report.max_key_skew);
+
+		double moved_share = 0;
+		start = lat_now_ns();
+		for (int i = 0; i < BENCH_CHURN; i++) {
+			moved_share += ring_predict_add(main, sizes[s] + i, &keys_moved);
+			total_moved += keys_moved;
+		}
+		snprintf(name, sizeof(name), "predict add, %d servers", sizes[s]);
+		bench_report(name, BENCH_CHURN, lat_now_ns() - start);
+		printf("       mean share moved %.4f%%, keys moved %.1f\n",
+			   100 * moved_share / BENCH_CHURN,
+			   (double)total_moved / BENCH_CHURN);
+
+		start = lat_now_ns();
+		for (int i = 0; i < BENCH_CHURN; i++)
+			ring_predict_remove(main, (i * 7919) % sizes[s], NULL);
+		snprintf(name, sizeof(name), "predict remove, %d servers",
+				 sizes[s]);
+		bench_report(name, BENCH_CHURN, lat_now_ns() - start);
+
+		ring_report_free(&report);
+		free_load_balancer(main);
+	}
+}
+
+/*
+ * Dry runs of the migration planner on a loaded cluster, against the naive
+ * way to learn the same: make the change, count the keys moved, undo it.
+ * The two have to agree.
+ */
+static void bench_planner(bench_data *data)
+{
+	load_balancer *main = bench_cluster(BENCH_SERVERS);
+	migration_plan plan;
+	unsigned long long planned = 0, scanned = 0, measured = 0;
+	int server_id;
+
+	for (int i = 0; i < data->no_keys; i++)
+		loader_store(main, data->keys[i], data->values[i], &server_id);
+
+	// one new server at a time
+	unsigned long long start = lat_now_ns();
+	for (int i = 0; i < BENCH_PLAN_SERVERS; i++) {
+		server_id = BENCH_SERVERS + i;
+		DIE(loader_plan_add_servers(main, &server_id, 1, &plan),
+			"the planner refused the layout");
+		planned += plan.total_keys;
+		scanned += plan.scanned_keys;
+		migration_plan_free(&plan);
+	}
+	bench_report("plan add", BENCH_PLAN_SERVERS, lat_now_ns() - start);
+
+	start = lat_now_ns();
+	for (int i = 0; i < BENCH_PLAN_SERVERS; i++) {
+		server_id = BENCH_SERVERS + i;
+		loader_add_server(main, server_id);
+		measured += ht_get_size(main->servers[server_id]->memory);
+		loader_remove_server(main, server_id);
+	}
+	bench_report("add + count + remove", BENCH_PLAN_SERVERS,
+				 lat_now_ns() - start);
+	printf("       %llu keys would move (%llu scanned), %llu moved\n",
+		   planned, scanned, measured);
+	DIE(planned != measured, "the plan differs from the keys moved");
+
+	// one existing server at a time
+	planned = scanned = measured = 0;
+	start = lat_now_ns();
+	for (int i = 0; i < BENCH_PLAN_SERVERS; i++) {
+		server_id = i;
+		DIE(loader_plan_remove_servers(main, &server_id, 1, &plan),
+			"the planner refused the layout");
+		planned += plan.total_keys;
+		scanned += plan.scanned_keys;
+		migration_plan_free(&plan);
+	}
+	bench_report("plan remove", BENCH_PLAN_SERVERS, lat_now_ns() - start);
+
+	start = lat_now_ns();
+	for (int i = 0; i < BENCH_PLAN_SERVERS; i++) {
+		measured += ht_get_size(main->servers[i]->memory);
+		loader_remove_server(main, i);
+		loader_add_server(main, i);
+	}
+	bench_report("remove + count + add", BENCH_PLAN_SERVERS,
+				 lat_now_ns() - start);
+	printf("       %llu keys would move (%llu scanned), %llu moved\n",
+		   planned, scanned, measured);
+	DIE(planned != measured, "the plan differs from the keys moved");
+
+	free_load_balancer(main);
+}
+
+/* iterator of loader_bulk_load() over the generated pairs */
+typedef struct bench_bulk_state bench_bulk_state;
+struct bench_bulk_state {
+	bench_data *data;
+	int next;
+};
+
+static int bench_bulk_next(const void **key, size_t *key_len,
+						   const void **value, unsigned int *value_len,
+						   void *ctx)
+{
+	bench_bulk_state *state = (bench_bulk_state *)ctx;
+
+	if (state->next == state->data->no_keys)
+		return 0;
+
+	*key = state->data->keys[state->next];
+	*key_len = strlen(state->data->keys[state->next]);
+	*value = state->data->values[state->next];
+	*value_len = strlen(state->data->values[state->next]) + 1;
+	state->next++;
+	return 1;
+}
+
+/* initial load of a cluster: one loader_store() per pair vs one bulk load */
+static void bench_bulk(bench_data *data)
+{
+	for (int bulk = 0; bulk <= 1; bulk++) {
+		load_balancer *main = bench_cluster(BENCH_SERVERS);
+		bench_bulk_state state = {data, 0};
+		int server_id;
+
+		unsigned long long start = lat_now_ns();
+		if (bulk) {
+			loader_bulk_load(main, bench_bulk_next, &state);
+		} else {
+			for (int i = 0; i < data->no_keys; i++)
+				loader_store(main, data->keys[i], data->values[i],
+							 &server_id);
+		}
+		bench_report(bulk ? "load (bulk)" : "load (per key)", data->no_keys,
+					 lat_now_ns() - start);
+
+		start = lat_now_ns();
+		for (int i = 0; i < data->no_keys; i++)
+			DIE(strcmp(loader_retrieve(main, data->keys[i], &server_id),
+					   data->values[i]), "stored key not found");
+		bench_report(bulk ? "retrieve (bulk)" : "retrieve (per key)",
+					 data->no_keys, lat_now_ns() - start);
+
+		start = lat_now_ns();
+		free_load_balancer(main);
+		bench_report(bulk ? "free (bulk)" : "free (per key)", data->no_keys,
+					 lat_now_ns() - start);
+	}
+}
+
+/* store throughput without a log and with each fsync() policy */
+static void bench_wal(bench_data *data)
+{
+	struct {
+		const char *name;
+		int enabled;
+		wal_sync_policy policy;
+		unsigned long long param;
+	} configs[] = {
+		{"store (wal off)", 0, WAL_SYNC_NONE, 0},
+		{"store (wal, no fsync)", 1, WAL_SYNC_NONE, 0},
+		{"store (wal, fsync 10ms)", 1, WAL_SYNC_INTERVAL, 10},
+		{"store (wal, fsync /1000)", 1, WAL_SYNC_EVERY_N, 1000},
+		{"store (wal, fsync /100)", 1, WAL_SYNC_EVERY_N, 100},
+	};
+
+	for (unsigned int c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+		load_balancer *main = bench_cluster(BENCH_SERVERS);
+		int server_id;
+
+		unlink(BENCH_WAL_PATH);
+		if (configs[c].enabled) {
+			main->wal = wal_open(BENCH_WAL_PATH, configs[c].policy,
+								 configs[c].param, 1);
+			DIE(!main->wal, "wal_open() failed");
+		}
+
+		unsigned long long start = lat_now_ns();
+		for (int i = 0; i < data->no_keys; i++)
+			loader_store(main, data->keys[i], data->values[i], &server_id);
+		DIE(wal_flush(main->wal), "wal_flush() failed");
+		unsigned long long ns = lat_now_ns() - start;
+
+		bench_report(configs[c].name, data->no_keys, ns);
+		if (main->wal)
+			printf("%28s %llu writes, %llu fsyncs\n", "", main->wal->writes,
+				   main->wal->syncs);
+
+		DIE(wal_close(main->wal), "wal_close() failed");
+		main->wal = NULL;
+		free_load_balancer(main);
+	}
+
+	unlink(BENCH_WAL_PATH);
+}
+
+/*
+ * Per-request latency while servers are added to a loaded cluster, with
+ * eager and with lazy migration: 10 servers are added, each followed by
+ * retrieves (and background migration steps, in lazy mode).
+ */
+static void bench_migration(bench_data *data)
+{
+	for (int lazy = 0; lazy <= 1; lazy++) {
+		load_balancer *main = bench_cluster(BENCH_SERVERS);
+		lat_hist add_hist, request_hist;
+		int server_id, key = 0;
+
+		for (int i = 0; i < data->no_keys; i++)
+			loader_store(main, data->keys[i], data->values[i], &server_id);
+
+		main->lazy_migration = lazy;
+		lat_hist_reset(&add_hist);
+		lat_hist_reset(&request_hist);
+
+		for (int s = 0; s < 10; s++) {
+			unsigned long long start = lat_now_ns();
+			loader_add_server(main, BENCH_SERVERS + s);
+			lat_hist_record(&add_hist, lat_now_ns() - start);
+
+			for (int r = 0; r < 2000; r++) {
+				key = (key + 7919) % data->no_keys;
+				start = lat_now_ns();
+				DIE(!loader_retrieve(main, data->keys[key], &server_id),
+					"stored key not found");
+				if (main->migrations)
+					loader_migrate_step(main, MIGRATION_STEP_BUDGET);
+				lat_hist_record(&request_hist, lat_now_ns() - start);
+			}
+		}
+
+		migration_status status;
+		loader_migration_status(main, &status);
+		printf("%s: add_server p50 %llu ns max %llu ns, request p99 %llu ns "
+			   "max %llu ns\n", lazy ? "lazy " : "eager",
+			   lat_hist_percentile(&add_hist, 0.5), add_hist.max,
+			   lat_hist_percentile(&request_hist, 0.99), request_hist.max);
+		if (lazy)
+			printf("       moved on access %llu, in background %llu, "
+				   "%d migrations pending\n", status.moved_on_access,
+				   status.moved_in_background, status.pending);
+
+		free_load_balancer(main);
+	}
+}
+
+/*
+ * Stores with a TTL while the clock moves (one tick every 4 stores), then
+ * a last tick past every expiry: the wheel must free all the keys.
+ */
+static void bench_ttl(bench_data *data)
+{
+	load_balancer *main = bench_cluster(BENCH_SERVERS);
+	unsigned long long state = 0x2545F4914F6CDD1Dull;
+	unsigned long long tick_ns = 0, expired = 0;
+	int server_id;
+
+	unsigned long long start = lat_now_ns();
+	for (int i = 0; i < data->no_keys; i++) {
+		// mostly short TTLs, some beyond the span of the wheel
+		unsigned long long ttl = i % 10 ? 1 + bench_rand(&state) % 100000
+										: TTL_WHEEL_SPAN + i;
+
+		loader_store_ttl(main, data->keys[i], data->values[i], ttl,
+						 &server_id);
+		if (i % 4 == 3) {
+			unsigned long long tick_start = lat_now_ns();
+			expired += loader_tick(main, main->now + 1);
+			tick_ns += lat_now_ns() - tick_start;
+		}
+	}
+	unsigned long long ns = lat_now_ns() - start;
+	bench_report("store (ttl)", data->no_keys, ns - tick_ns);
+	bench_report("tick", data->no_keys / 4, tick_ns);
+
+	start = lat_now_ns();
+	expired += loader_tick(main, main->now + 2 * TTL_WHEEL_SPAN);
+	bench_report("final tick (keys expired)", expired, lat_now_ns() - start);
+
+	for (int i = 0; i < BENCH_SERVERS; i++)
+		DIE(ht_get_size(main->servers[i]->memory), "keys left after expiry");
+
+	free_load_balancer(main);
+}
+
+/*
+ * Cache-aside workload on servers whose budget holds a quarter of the keys:
+ * 90% of the lookups go to 10% of the keys, a miss stores the key back.
+ * Halfway through, one scan reads every key once.
+ */
+static void bench_budget(bench_data *data)
+{
+	load_balancer *main = bench_cluster(BENCH_SERVERS);
+	unsigned long long state = 0x853C49E6748FEA9Bull;
+	unsigned long long hits = 0, bytes = 0;
+	int no_requests = 4 * data->no_keys, server_id;
+
+	for (int i = 0; i < data->no_keys; i++)
+		bytes += strlen(data->keys[i]) + strlen(data->values[i]) + 2 +
+				 HT_ENTRY_OVERHEAD;
+	loader_set_server_budget(main, bytes / 4 / BENCH_SERVERS);
+
+	unsigned long long start = lat_now_ns();
+	for (int r = 0; r < no_requests; r++) {
+		int key;
+
+		if (r >= no_requests / 2 && r < no_requests / 2 + data->no_keys)
+			key = r - no_requests / 2;  // the scan
+		else if (bench_rand(&state) % 10)
+			key = bench_rand(&state) % (data->no_keys / 10);
+		else
+			key = bench_rand(&state) % data->no_keys;
+
+		if (loader_retrieve(main, data->keys[key], &server_id))
+			hits++;
+		else
+			loader_store(main, data->keys[key], data->values[key],
+						 &server_id);
+	}
+	bench_report("cache-aside (budget 1/4)", no_requests,
+				 lat_now_ns() - start);
+
+	unsigned long long evicted = 0;
+	for (int i = 0; i < BENCH_SERVERS; i++)
+		evicted += main->servers[i]->evicted;
+	printf("%28s hit ratio %.2f%%, %llu evictions\n", "",
+		   100.0 * hits / no_requests, evicted);
+
+	free_load_balancer(main);
+}
+
+/*
+ * Skewed reads (half of them on 16 hot keys) with 1, 2 and 3 copies per
+ * key: the busiest server bounds the read throughput of the cluster, so
+ * its share of the reads is reported next to the single-thread rate.
+ */
+static void bench_replication(bench_data *data)
+{
+	for (int copies = 1; copies <= 3; copies++) {
+		load_balancer *main = bench_cluster(BENCH_SERVERS);
+		unsigned long long state = 0xDA942042E4DD58B5ull;
+		int server_id;
+
+		loader_set_replication(main, copies);
+		for (int i = 0; i < data->no_keys; i++)
+			loader_store(main, data->keys[i], data->values[i], &server_id);
+
+		unsigned long long start = lat_now_ns();
+		for (int r = 0; r < data->no_keys; r++) {
+			int key = bench_rand(&state) % 2 ? bench_rand(&state) % 16
+											  : bench_rand(&state) %
+												data->no_keys;
+
+			DIE(!loader_retrieve(main, data->keys[key], &server_id),
+				"stored key not found");
+		}
+		unsigned long long ns = lat_now_ns() - start;
+
+		unsigned long long busiest = 0;
+		for (int i = 0; i < BENCH_SERVERS; i++)
+			if (main->servers[i]->hits > busiest)
+				busiest = main->servers[i]->hits;
+
+		char name[32];
+		snprintf(name, sizeof(name), "retrieve (%d copies)", copies);
+		bench_report(name, data->no_keys, ns);
+		printf("%28s busiest server: %.2f%% of the reads (cluster "
+			   "capacity: %.1f servers)\n", "",
+			   100.0 * busiest / data->no_keys,
+			   (double)data->no_keys / busiest);
+
+		free_load_balancer(main);
+	}
+}
+
+/*
+ * The skewed reads of the replication section, with and without hot-key
+ * detection: the cost of the sketch on every read, the reads answered by
+ * the front cache, and the share of the busiest server.
+ */
+static void bench_hotkeys(bench_data *data)
+{
+	for (int detect = 0; detect <= 1; detect++) {
+		load_balancer *main = bench_cluster(BENCH_SERVERS);
+		unsigned long long state = 0xDA942042E4DD58B5ull;
+		int server_id;
+
+		if (detect)
+			loader_enable_hot_keys(main, 32, 64);
+		for (int i = 0; i < data->no_keys; i++)
+			loader_store(main, data->keys[i], data->values[i], &server_id);
+
+		unsigned long long start = lat_now_ns();
+		for (int r = 0; r < data->no_keys; r++) {
+			int key = bench_rand(&state) % 2 ? bench_rand(&state) % 16
+											  : bench_rand(&state) %
+												data->no_keys;
+
+			DIE(!loader_retrieve(main, data->keys[key], &server_id),
+				"stored key not found");
+		}
+		unsigned long long ns = lat_now_ns() - start;
+
+		unsigned long long busiest = 0;
+		for (int i = 0; i < BENCH_SERVERS; i++)
+			if (main->servers[i]->hits > busiest)
+				busiest = main->servers[i]->hits;
+
+		bench_report(detect ? "retrieve (hot keys)" : "retrieve (plain)",
+					 data->no_keys, ns);
+		printf("%28s front cache: %.2f%% of the reads, busiest server: "
+			   "%.2f%%\n", "", 100.0 * main->front_hits / data->no_keys,
+			   100.0 * busiest / data->no_keys);
+
+		free_load_balancer(main);
+	}
+}
+
+/*
+ * JSON documents of a few hundred bytes, stored raw and compressed (above
+ * 128 bytes): memory of the servers, store and retrieve rates.
+ */
+static void bench_compress(bench_data *data)
+{
+	int no_docs = data->no_keys / 4;
+	char (*docs)[1024] = calloc(no_docs, sizeof(*docs));
+	DIE(!docs, "calloc() for docs failed\n");
+
+	unsigned long long state = 0x2545F4914F6CDD1Dull;
+	for (int i = 0; i < no_docs; i++)
+		snprintf(docs[i], sizeof(docs[i]),
+				 "{\"id\":%d,\"status\":\"%s\",\"owner\":{\"name\":"
+				 "\"user_%llu\",\"region\":\"eu-west-%llu\"},\"tags\":"
+				 "[\"cache\",\"session\",\"v%llu\"],\"settings\":{\"retries\":"
+				 "%llu,\"timeout_ms\":%llu,\"compression\":false,\"replicas\":"
+				 "3},\"created_at\":\"2023-05-%02lluT%02llu:%02llu:00Z\","
+				 "\"checksum\":\"%016llx\"}", i,
+				 bench_rand(&state) % 3 ? "active" : "suspended",
+				 bench_rand(&state) % 100000, bench_rand(&state) % 3,
+				 bench_rand(&state) % 10, bench_rand(&state) % 5,
+				 bench_rand(&state) % 5000, bench_rand(&state) % 28 + 1,
+				 bench_rand(&state) % 24, bench_rand(&state) % 60,
+				 bench_rand(&state));
+
+	for (int compress = 0; compress <= 1; compress++) {
+		load_balancer *main = bench_cluster(BENCH_SERVERS);
+		int server_id;
+
+		if (compress)
+			loader_enable_compression(main, 128);
+
+		unsigned long long start = lat_now_ns();
+		for (int i = 0; i < no_docs; i++)
+			loader_store(main, data->keys[i], docs[i], &server_id);
+		bench_report(compress ? "store (compressed)" : "store (raw)", no_docs,
+					 lat_now_ns() - start);
+
+		start = lat_now_ns();
+		for (int i = 0; i < no_docs; i++)
+			DIE(!loader_retrieve(main, data->keys[i], &server_id),
+				"stored key not found");
+		bench_report(compress ? "retrieve (compressed)" : "retrieve (raw)",
+					 no_docs, lat_now_ns() - start);
+
+		unsigned long long bytes = 0;
+		for (int i = 0; i < BENCH_SERVERS; i++)
+			bytes += main->servers[i]->memory->bytes;
+		printf("%28s server memory: %.2f MB\n", "", bytes / 1e6);
+
+		free_load_balancer(main);
+	}
+
+	free(docs);
+}
+
+/*
+ * Values drawn from 64 distinct status blobs, stored with and without
+ * deduplication: store rate, time to add servers to the loaded cluster and
+ * the value bytes allocated.
+ */
+static void bench_dedup(bench_data *data)
+{
+	char blobs[64][BENCH_VALUE_LENGTH];
+
+	for (int i = 0; i < 64; i++)
+		snprintf(blobs[i], sizeof(blobs[i]),
+				 "{\"status\":\"%s\",\"version\":%d,\"flags\":%d}",
+				 i % 2 ? "ok" : "degraded", i / 2, i % 7);
+
+	for (int dedup = 0; dedup <= 1; dedup++) {
+		load_balancer *main = bench_cluster(BENCH_SERVERS);
+		int server_id;
+
+		if (dedup)
+			loader_enable_dedup(main);
+
+		unsigned long long start = lat_now_ns();
+		for (int i = 0; i < data->no_keys; i++)
+			loader_store(main, data->keys[i], blobs[i % 64], &server_id);
+		bench_report(dedup ? "store (dedup)" : "store (private copies)",
+					 data->no_keys, lat_now_ns() - start);
+
+		start = lat_now_ns();
+		for (int i = 0; i < BENCH_SERVERS / 5; i++)
+			loader_add_server(main, BENCH_SERVERS + i);
+		bench_report(dedup ? "add_server (dedup)" : "add_server (private)",
+					 BENCH_SERVERS / 5, lat_now_ns() - start);
+
+		unsigned long long value_bytes = 0;
+		if (dedup) {
+			value_bytes = main->values->bytes;
+		} else {
+			for (int i = 0; i < data->no_keys; i++)
+				value_bytes += strlen(blobs[i % 64]) + 1;
+		}
+		printf("%28s value bytes allocated: %llu\n", "", value_bytes);
+
+		free_load_balancer(main);
+	}
+}
+
+/* state of the scan of the scan section */
+typedef struct bench_scan_state bench_scan_state;
+struct bench_scan_state {
+	unsigned long long visited;
+	int first_half;  /* keys stored before the scan */
+	char *seen;  /* by ID ("id" field of the value) */
+};
+
+static void bench_scan_pair(char *key, size_t key_len, char *value,
+							size_t value_len, unsigned long long expires,
+							void *ctx)
+{
+	bench_scan_state *state = ctx;
+	int id = atoi(value + strlen("{\"id\":"));
+
+	(void)key;
+	(void)key_len;
+	(void)value_len;
+	(void)expires;
+	state->visited++;
+	if (id < state->first_half)
+		state->seen[id] = 1;
+}
+
+/*
+ * A server scanned 64 pairs at a time while stores keep growing its table:
+ * the longest slice, and whether every pair stored before the scan was
+ * visited.
+ */
+static void bench_scan(bench_data *data)
+{
+	server_memory *server = init_server_memory();
+	bench_scan_state state = {0, data->no_keys / 2, NULL};
+	unsigned long long longest = 0, total = 0;
+	unsigned int cursor = 0;
+	int next = state.first_half, missed = 0;
+
+	state.seen = calloc(state.first_half, sizeof(*state.seen));
+	DIE(!state.seen, "calloc() for state.seen failed\n");
+	for (int i = 0; i < state.first_half; i++)
+		server_store(server, data->keys[i], data->values[i]);
+
+	do {
+		unsigned long long start = lat_now_ns();
+		cursor = server_scan(server, cursor, 64, bench_scan_pair, &state);
+		unsigned long long ns = lat_now_ns() - start;
+
+		total += ns;
+		if (ns > longest)
+			longest = ns;
+
+		// the second half of the keys is stored during the scan
+		for (int i = 0; i < 64 && next < data->no_keys; i++, next++)
+			server_store(server, data->keys[next], data->values[next]);
+	} while (cursor);
+
+	for (int i = 0; i < state.first_half; i++)
+		missed += !state.seen[i];
+
+	bench_report("server_scan (64 per slice)", state.visited, total);
+	printf("%28s longest slice: %.1f us, buckets: %u, keys stored before "
+		   "the scan and missed: %d\n", "", longest / 1e3,
+		   ht_get_hmax(server->memory), missed);
+
+	free(state.seen);
+	free_server_memory(server);
+}
+
+/* decommissioning of loaded servers: every entry is handed over */
+static void bench_remove(bench_data *data)
+{
+	load_balancer *main = bench_cluster(BENCH_SERVERS);
+	int server_id;
+	unsigned int moved = 0;
+
+	for (int i = 0; i < data->no_keys; i++)
+		loader_store(main, data->keys[i], data->values[i], &server_id);
+
+	unsigned long long start = lat_now_ns();
+	for (int s = 0; s < BENCH_SERVERS / 2; s++) {
+		moved += ht_get_size(main->servers[s]->memory);
+		loader_remove_server(main, s);
+	}
+	bench_report("remove_server (keys moved)", moved, lat_now_ns() - start);
+
+	free_load_balancer(main);
+}
+
+int main(int argc, char *argv[])
+{
+	struct {
+		const char *name;
+		void (*run)(bench_data *data);
+	} sections[] = {
+		{"store", bench_store},
+		{"typed", bench_typed},
+		{"bulk", bench_bulk},
+		{"wal", bench_wal},
+		{"migration", bench_migration},
+		{"remove", bench_remove},
+		{"zones", bench_zones},
+		{"churn", bench_churn},
+		{"ring", bench_ring},
+		{"planner", bench_planner},
+		{"ttl", bench_ttl},
+		{"budget", bench_budget},
+		{"replication", bench_replication},
+		{"hotkeys", bench_hotkeys},
+		{"compress", bench_compress},
+		{"dedup", bench_dedup},
+		{"scan", bench_scan},
+	};
+	int no_sections = sizeof(sections) / sizeof(sections[0]);
+	bench_data data;
+
+	bench_data_init(&data, BENCH_KEYS);
+
+	for (int s = 0; s < no_sections; s++) {
+		int selected = argc == 1;
+
+		for (int i = 1; i < argc; i++)
+			if (!strcmp(argv[i], sections[s].name))
+				selected = 1;
+
+		if (selected) {
+			printf("== %s\n", sections[s].name);
+			sections[s].run(&data);
+		}
+	}
+
+	bench_data_free(&data);
+
+#ifdef LB_PROFILE
+	prof_dump(stderr);
+	prof_free();
+#endif
+
+	return 0;
+}
@@ -0,0 +1,198 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#include "utils.h"
+#include "bulk_load.h"
+#include "replication.h"
+#include "migration.h"
+#include "hotkeys.h"
+#include "wal.h"
+
+/* a copy of a pair for one of its servers */
+typedef struct bulk_copy bulk_copy;
+struct bulk_copy {
+	unsigned int pair;
+	int server_id;
+};
+
+/* where a pair was copied to, with its lengths */
+typedef struct bulk_pair bulk_pair;
+struct bulk_pair {
+	unsigned long long offset;  /* of the key; the value follows it */
+	size_t key_len;
+	unsigned int value_len;
+};
+
+/* the pairs read by the first pass, copied (key, then value) to a buffer */
+typedef struct bulk_batch bulk_batch;
+struct bulk_batch {
+	unsigned char *data;
+	unsigned long long size;
+	unsigned long long capacity;
+
+	bulk_pair *pairs;
+	unsigned int no_pairs;
+	unsigned int max_pairs;
+
+	bulk_copy *copies;
+	unsigned int no_copies;
+	unsigned int max_copies;
+};
+
+static void bulk_add_pair(bulk_batch *batch, const void *key, size_t key_len,
+						  const void *value, unsigned int value_len)
+{
+	while (batch->size + key_len + value_len > batch->capacity) {
+		batch->capacity *= 2;
+		batch->data = realloc(batch->data, batch->capacity);
+		DIE(!batch->data, "realloc() for batch->data failed\n");
+	}
+
+	if (batch->no_pairs == batch->max_pairs) {
+		batch->max_pairs *= 2;
+		batch->pairs = realloc(batch->pairs,
+							   batch->max_pairs * sizeof(*batch->pairs));
+		DIE(!batch->pairs, "realloc() for batch->pairs failed\n");
+	}
+
+	bulk_pair *pair = &batch->pairs[batch->no_pairs++];
+	pair->offset = batch->size;
+	pair->key_len = key_len;
+	pair->value_len = value_len;
+	memcpy(batch->data + batch->size, key, key_len);
+	memcpy(batch->data + batch->size + key_len, value, value_len);
+	batch->size += key_len + value_len;
+}
+
+static void bulk_add_copy(bulk_batch *batch, unsigned int pair, int server_id)
+{
+	if (batch->no_copies == batch->max_copies) {
+		batch->max_copies *= 2;
+		batch->copies = realloc(batch->copies,
+								batch->max_copies * sizeof(*batch->copies));
+		DIE(!batch->copies, "realloc() for batch->copies failed\n");
+	}
+
+	batch->copies[batch->no_copies].pair = pair;
+	batch->copies[batch->no_copies].server_id = server_id;
+	batch->no_copies++;
+}
+
+/*
+ * Second pass: the copies are sorted by server (counting sort, which keeps
+ * the order of the pairs, so the last write of a key still wins) and every
+ * server stores its share at once.
+ */
+static void bulk_store(load_balancer *main, bulk_batch *batch)
+{
+	unsigned int *starts = calloc(MAX_SERVERS + 1, sizeof(*starts));
+	const void **keys = malloc(batch->no_copies * sizeof(*keys));
+	size_t *key_lens = malloc(batch->no_copies * sizeof(*key_lens));
+	const void **values = malloc(batch->no_copies * sizeof(*values));
+	unsigned int *value_lens = malloc(batch->no_copies * sizeof(*value_lens));
+	DIE(!starts || !keys || !key_lens || !values || !value_lens,
+		"allocation failed\n");
+
+	for (unsigned int i = 0; i < batch->no_copies; i++)
+		starts[batch->copies[i].server_id + 1]++;
+	for (int i = 0; i < MAX_SERVERS; i++)
+		starts[i + 1] += starts[i];
+
+	for (unsigned int i = 0; i < batch->no_copies; i++) {
+		bulk_copy *copy = &batch->copies[i];
+		unsigned int position = starts[copy->server_id]++;
+		bulk_pair *pair = &batch->pairs[copy->pair];
+
+		keys[position] = batch->data + pair->offset;
+		key_lens[position] = pair->key_len;
+		values[position] = batch->data + pair->offset + pair->key_len;
+		value_lens[position] = pair->value_len;
+	}
+
+	// starts[i] is now the end of the share of server i
+	for (int i = 0, start = 0; i < MAX_SERVERS; start = starts[i++]) {
+		if (starts[i] == (unsigned int)start)
+			continue;
+
+		ht_set_clock(main->servers[i]->memory, main->now);
+		server_store_bulk(main->servers[i], keys + start, key_lens + start,
+						  values + start, value_lens + start,
+						  starts[i] - start);
+	}
+
+	free(starts);
+	free(keys);
+	free(key_lens);
+	free(values);
+	free(value_lens);
+}
+
+unsigned int loader_bulk_load(load_balancer *main,
+							  int (*next)(const void **key, size_t *key_len,
+										  const void **value,
+										  unsigned int *value_len,
+										  void *ctx),
+							  void *ctx)
+{
+	bulk_batch batch = {
+		.capacity = BULK_LOAD_MIN_BYTES,
+		.max_pairs = BULK_LOAD_MIN_PAIRS,
+		.max_copies = BULK_LOAD_MIN_PAIRS,
+	};
+	const void *key, *value;
+	size_t key_len;
+	unsigned int value_len;
+
+	if (!main->no_servers)
+		return 0;
+
+	batch.data = malloc(batch.capacity);
+	batch.pairs = malloc(batch.max_pairs * sizeof(*batch.pairs));
+	batch.copies = malloc(batch.max_copies * sizeof(*batch.copies));
+	DIE(!batch.data || !batch.pairs || !batch.copies, "malloc() failed\n");
+
+	// first pass: the pairs are logged, copied and assigned to their servers
+	while (next(&key, &key_len, &value, &value_len, ctx)) {
+		unsigned int hash = hash_function_key_len(key, key_len);
+
+		if (main->wal)
+			main->wal_lsn = wal_log_store(main->wal, key, key_len, value,
+										  value_len);
+		if (main->hotkeys) {
+			hotkeys_record(main->hotkeys, key, key_len, hash);
+			ht_remove_entry_len(main->front_cache, key, key_len);
+		}
+
+		if (main->replication > 1) {
+			int server_ids[MAX_REPLICATION];
+			int count = hashring_preference_list(main, hash, server_ids,
+								main->replication < MAX_REPLICATION ?
+								main->replication : MAX_REPLICATION);
+
+			for (int i = 0; i < count; i++)
+				bulk_add_copy(&batch, batch.no_pairs, server_ids[i]);
+		} else {
+			bulk_add_copy(&batch, batch.no_pairs,
+						  hashring_find_server(main, hash));
+		}
+
+		bulk_add_pair(&batch, key, key_len, value, value_len);
+	}
+
+	bulk_store(main, &batch);
+
+	// the older copies that still wait to be moved are stale now
+	if (main->migrations)
+		for (unsigned int i = 0; i < batch.no_pairs; i++) {
+			bulk_pair *pair = &batch.pairs[i];
+			key = batch.data + pair->offset;
+			unsigned int hash = hash_function_key_len(key, pair->key_len);
+
+			migration_forget(main, key, pair->key_len, hash,
+							 hashring_find_server(main, hash));
+		}
+
+	free(batch.data);
+	free(batch.pairs);
+	free(batch.copies);
+
+	return batch.no_pairs;
+}
@@ -0,0 +1,41 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#ifndef BULK_LOAD_H_
+#define BULK_LOAD_H_
+
+#include "load_balancer.h"
+
+/*
+ * Bulk loading of a dataset: one loader_store() per pair makes every
+ * server's table grow step by step and costs five allocations per entry.
+ * loader_bulk_load() reads all the pairs first, partitioning them by the
+ * servers that will hold them, then sizes each server's table once for its
+ * share and fills it from one slab (see server_store_bulk()).
+ *
+ * The result is the one of storing the pairs in order with loader_store():
+ * a key given twice keeps its last value, the pairs are written to the
+ * write-ahead log, replicated, compressed and deduplicated as configured.
+ */
+
+/* initial size of the staging buffer and of the pair array */
+#define BULK_LOAD_MIN_BYTES 65536
+#define BULK_LOAD_MIN_PAIRS 1024
+
+/**
+ * loader_bulk_load() - Stores every pair produced by an iterator.
+ *
+ * @arg1: Load balancer, with at least one server.
+ * @arg2: Iterator: sets *key, *value and their lengths, in bytes, to the
+ *        next pair (any bytes, that only have to stay valid until the next
+ *        call) and returns 1, or returns 0 once there are no more pairs.
+ * @arg3: Passed to the iterator.
+ *
+ * Return: the number of pairs read (0 if the system has no servers).
+ */
+unsigned int loader_bulk_load(load_balancer *main,
+							  int (*next)(const void **key, size_t *key_len,
+										  const void **value,
+										  unsigned int *value_len,
+										  void *ctx),
+							  void *ctx);
+
+#endif  // BULK_LOAD_H_
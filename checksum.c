@@ -0,0 +1,32 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#include "checksum.h"
+
+static unsigned int crc32_table[256];
+static int crc32_ready;
+
+static void crc32_init(void)
+{
+	for (unsigned int i = 0; i < 256; i++) {
+		unsigned int crc = i;
+
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+		crc32_table[i] = crc;
+	}
+
+	crc32_ready = 1;
+}
+
+unsigned int crc32(unsigned int crc, const void *buf, size_t len)
+{
+	const unsigned char *bytes = buf;
+
+	if (!crc32_ready)
+		crc32_init();
+
+	crc = ~crc;
+	while (len--)
+		crc = crc32_table[(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
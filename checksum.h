@@ -0,0 +1,18 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#ifndef CHECKSUM_H_
+#define CHECKSUM_H_
+
+#include <stddef.h>
+
+/**
+ * crc32() - Updates a CRC-32 (IEEE 802.3, reflected) with a block of bytes.
+ *
+ * @arg1: CRC of the previous blocks (0 for the first block).
+ * @arg2: Bytes to add to the checksum.
+ * @arg3: Number of bytes.
+ *
+ * Return: the updated CRC.
+ */
+unsigned int crc32(unsigned int crc, const void *buf, size_t len);
+
+#endif  // CHECKSUM_H_
@@ -0,0 +1,314 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#include "utils.h"
+#include "codec.h"
+
+#define CODEC_SEGMENT 64  /* length of a dictionary segment */
+#define CODEC_GRAM 8  /* length of the substrings scored by the training */
+#define CODEC_GRAM_BITS 16
+
+static unsigned int codec_read32(const unsigned char *p)
+{
+	unsigned int value;
+
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static unsigned int codec_hash(unsigned int sequence)
+{
+	return (sequence * 2654435761u) >> (32 - CODEC_HASH_BITS);
+}
+
+/* makes a buffer hold at least `size` bytes */
+static void codec_reserve(unsigned char **buf, unsigned int *capacity,
+						  unsigned int size)
+{
+	if (*capacity >= size)
+		return;
+
+	unsigned char *new_buf = realloc(*buf, size);
+	DIE(!new_buf, "realloc() for codec buffer failed\n");
+	*buf = new_buf;
+	*capacity = size;
+}
+
+value_codec *codec_create(void)
+{
+	value_codec *codec = calloc(1, sizeof(*codec));
+	DIE(!codec, "calloc() for *codec failed\n");
+
+	return codec;
+}
+
+void codec_free(value_codec *codec)
+{
+	if (!codec)
+		return;
+
+	free(codec->work);
+	free(codec->out);
+	free(codec->scratch);
+	free(codec);
+}
+
+void codec_add_sample(value_codec *codec, const void *value,
+					  unsigned int size)
+{
+	if (codec->trained)
+		return;
+
+	unsigned int room = CODEC_SAMPLE_BYTES - codec->samples_size;
+	if (size > CODEC_SAMPLE_MAX)
+		size = CODEC_SAMPLE_MAX;
+	if (size > room)
+		size = room;
+
+	memcpy(codec->samples + codec->samples_size, value, size);
+	codec->samples_size += size;
+
+	if (codec->samples_size == CODEC_SAMPLE_BYTES)
+		codec_train(codec);
+}
+
+static unsigned int codec_gram_hash(const unsigned char *p)
+{
+	unsigned long long gram;
+
+	memcpy(&gram, p, sizeof(gram));
+	return (gram * 0x9E3779B97F4A7C15ull) >> (64 - CODEC_GRAM_BITS);
+}
+
+/* the frequency of the substrings of a segment that occur more than once */
+static unsigned long long codec_segment_score(const unsigned char *segment,
+											  const unsigned int *counts)
+{
+	unsigned long long score = 0;
+
+	for (int i = 0; i + CODEC_GRAM <= CODEC_SEGMENT; i++) {
+		unsigned int count = counts[codec_gram_hash(segment + i)];
+
+		if (count > 1)
+			score += count;
+	}
+
+	return score;
+}
+
+void codec_train(value_codec *codec)
+{
+	if (codec->trained)
+		return;
+	codec->trained = 1;
+
+	unsigned int no_segments = codec->samples_size / CODEC_SEGMENT;
+	unsigned int *counts = calloc(1 << CODEC_GRAM_BITS, sizeof(*counts));
+	DIE(!counts, "calloc() for counts failed\n");
+
+	for (unsigned int i = 0; i + CODEC_GRAM <= codec->samples_size; i++)
+		counts[codec_gram_hash(codec->samples + i)]++;
+
+	// greedy cover: take the best segment, then forget its substrings so
+	// that the next segments bring new content; the dictionary is filled
+	// from its end, which gives the best segments the shortest offsets
+	unsigned int room = CODEC_DICT_SIZE;
+	while (room >= CODEC_SEGMENT) {
+		unsigned long long best_score = 0;
+		unsigned int best = 0;
+
+		for (unsigned int s = 0; s < no_segments; s++) {
+			unsigned long long score =
+				codec_segment_score(codec->samples + s * CODEC_SEGMENT,
+									counts);
+
+			if (score > best_score) {
+				best_score = score;
+				best = s;
+			}
+		}
+		if (!best_score)
+			break;
+
+		const unsigned char *segment = codec->samples + best * CODEC_SEGMENT;
+		for (int i = 0; i + CODEC_GRAM <= CODEC_SEGMENT; i++)
+			counts[codec_gram_hash(segment + i)] = 0;
+
+		room -= CODEC_SEGMENT;
+		memcpy(codec->dict + room, segment, CODEC_SEGMENT);
+	}
+	free(counts);
+
+	codec->dict_size = CODEC_DICT_SIZE - room;
+	memmove(codec->dict, codec->dict + room, codec->dict_size);
+
+	memset(codec->dict_table, 0, sizeof(codec->dict_table));
+	for (unsigned int p = 0; p + CODEC_MIN_MATCH <= codec->dict_size; p++)
+		codec->dict_table[codec_hash(codec_read32(codec->dict + p))] = p + 1;
+}
+
+/* writes a length that does not fit in its 4 bits of the token */
+static unsigned char *codec_put_length(unsigned char *op, unsigned int length)
+{
+	for (; length >= 255; length -= 255)
+		*op++ = 255;
+	*op++ = length;
+	return op;
+}
+
+static unsigned char *codec_put_sequence(unsigned char *op,
+										 const unsigned char *literals,
+										 unsigned int no_literals,
+										 unsigned int offset,
+										 unsigned int match_length)
+{
+	unsigned int match_code = offset ? match_length - CODEC_MIN_MATCH : 0;
+	unsigned char *token = op++;
+
+	*token = (no_literals < 15 ? no_literals : 15) << 4 |
+			 (match_code < 15 ? match_code : 15);
+	if (no_literals >= 15)
+		op = codec_put_length(op, no_literals - 15);
+	memcpy(op, literals, no_literals);
+	op += no_literals;
+
+	if (!offset)
+		return op;
+
+	*op++ = offset & 0xFF;
+	*op++ = offset >> 8;
+	if (match_code >= 15)
+		op = codec_put_length(op, match_code - 15);
+	return op;
+}
+
+unsigned int codec_compress(value_codec *codec, const void *value,
+							unsigned int size, const unsigned char **blob)
+{
+	unsigned int table[1 << CODEC_HASH_BITS];
+	unsigned int start = codec->trained ? codec->dict_size : 0;
+	unsigned int end = start + size;
+
+	// the dictionary comes right before the value, so a match can start in
+	// it; the blob may grow by 1 byte per 255 literals
+	codec_reserve(&codec->work, &codec->work_size, end);
+	codec_reserve(&codec->out, &codec->out_size,
+				  CODEC_HEADER_SIZE + size + size / 255 + 16);
+	memcpy(codec->work, codec->dict, start);
+	memcpy(codec->work + start, value, size);
+	if (start)
+		memcpy(table, codec->dict_table, sizeof(table));
+	else
+		memset(table, 0, sizeof(table));
+
+	const unsigned char *base = codec->work;
+	unsigned char *op = codec->out;
+	unsigned int anchor = start, p = start;
+
+	*op++ = start ? CODEC_FLAG_DICT : 0;
+	memcpy(op, &size, sizeof(size));
+	op += sizeof(size);
+
+	while (p + CODEC_MIN_MATCH <= end) {
+		unsigned int sequence = codec_read32(base + p);
+		unsigned int hash = codec_hash(sequence);
+		unsigned int ref = table[hash];
+
+		table[hash] = p + 1;
+		if (!ref || p - (ref - 1) > CODEC_MAX_OFFSET ||
+			codec_read32(base + ref - 1) != sequence) {
+			p++;
+			continue;
+		}
+		ref--;
+
+		unsigned int length = CODEC_MIN_MATCH;
+		while (p + length < end && base[ref + length] == base[p + length])
+			length++;
+
+		op = codec_put_sequence(op, base + anchor, p - anchor, p - ref, length);
+		p += length;
+		anchor = p;
+
+		// the position before the end of the match, for repeated runs
+		if (p + CODEC_MIN_MATCH <= end)
+			table[codec_hash(codec_read32(base + p - 2))] = p - 1;
+	}
+	op = codec_put_sequence(op, base + anchor, end - anchor, 0, 0);
+
+	unsigned int blob_size = op - codec->out;
+	if (blob_size >= size)
+		return 0;
+
+	codec->compressed++;
+	codec->raw_bytes += size;
+	codec->stored_bytes += blob_size;
+	*blob = codec->out;
+	return blob_size;
+}
+
+/* reads the rest of a length that did not fit in its 4 bits of the token */
+static const unsigned char *codec_get_length(const unsigned char *ip,
+											 unsigned int *length)
+{
+	unsigned char byte;
+
+	do {
+		byte = *ip++;
+		*length += byte;
+	} while (byte == 255);
+
+	return ip;
+}
+
+void *codec_decompress(value_codec *codec, const void *blob,
+					   unsigned int size, unsigned int *value_size)
+{
+	const unsigned char *ip = blob;
+	const unsigned char *iend = ip + size;
+	unsigned int dict_size = *ip & CODEC_FLAG_DICT ? codec->dict_size : 0;
+	unsigned int raw_size;
+
+	memcpy(&raw_size, ip + 1, sizeof(raw_size));
+	ip += CODEC_HEADER_SIZE;
+	codec_reserve(&codec->scratch, &codec->scratch_size, raw_size);
+
+	unsigned char *out = codec->scratch;
+	unsigned int op = 0;
+
+	while (ip < iend) {
+		unsigned int token = *ip++;
+		unsigned int no_literals = token >> 4;
+
+		if (no_literals == 15)
+			ip = codec_get_length(ip, &no_literals);
+		memcpy(out + op, ip, no_literals);
+		ip += no_literals;
+		op += no_literals;
+		if (ip >= iend)
+			break;
+
+		unsigned int offset = ip[0] | ip[1] << 8;
+		unsigned int length = token & 15;
+
+		ip += 2;
+		if (length == 15)
+			ip = codec_get_length(ip, &length);
+		length += CODEC_MIN_MATCH;
+
+		if (op >= offset && offset >= length) {
+			memcpy(out + op, out + op - offset, length);
+			op += length;
+			continue;
+		}
+
+		// byte by byte: the match overlaps its own output, or begins in
+		// the dictionary
+		for (unsigned int i = 0; i < length; i++, op++)
+			out[op] = op >= offset ? out[op - offset]
+								   : codec->dict[dict_size - (offset - op)];
+	}
+
+	codec->decompressed++;
+	if (value_size)
+		*value_size = raw_size;
+	return out;
+}
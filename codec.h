@@ -0,0 +1,103 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#ifndef CODEC_H_
+#define CODEC_H_
+
+/*
+ * Value compression: an LZ77 compressor in the style of LZ4 (greedy
+ * matching through a hash of the next 4 bytes, byte-aligned sequences of
+ * literals and back-references), which can also reference a dictionary
+ * trained on sample values. Short JSON values repeat mostly the field
+ * names and formatting of the other values, which the dictionary holds.
+ *
+ * The dictionary is trained once, from the first CODEC_SAMPLE_BYTES bytes
+ * of samples; values compressed before that do not use it (every blob
+ * records whether it does), so they stay readable.
+ *
+ * Blob: flags (1 byte), size of the value (4 bytes), then sequences of
+ * token (literal length << 4 | match length - CODEC_MIN_MATCH), extra
+ * literal length bytes, literals, 2-byte offset, extra match length bytes.
+ * The last sequence has only literals.
+ */
+
+#define CODEC_DICT_SIZE 4096
+#define CODEC_SAMPLE_BYTES 32768
+#define CODEC_SAMPLE_MAX 1024  /* bytes of one value kept as a sample */
+#define CODEC_HASH_BITS 12
+#define CODEC_MIN_MATCH 4
+#define CODEC_MAX_OFFSET 65535
+#define CODEC_HEADER_SIZE 5
+
+#define CODEC_FLAG_DICT 1
+
+typedef struct value_codec value_codec;
+struct value_codec {
+	unsigned char dict[CODEC_DICT_SIZE];
+	unsigned int dict_size;
+	int trained;
+	/* positions (+ 1) of the dictionary's 4-byte sequences, by hash */
+	unsigned int dict_table[1 << CODEC_HASH_BITS];
+
+	unsigned char samples[CODEC_SAMPLE_BYTES];
+	unsigned int samples_size;
+
+	/* dictionary followed by the value being compressed, and the blob */
+	unsigned char *work;
+	unsigned int work_size;
+	unsigned char *out;
+	unsigned int out_size;
+	/* value decompressed by the last codec_decompress() */
+	unsigned char *scratch;
+	unsigned int scratch_size;
+
+	/* values compressed, their size and the size of their blobs */
+	unsigned long long compressed;
+	unsigned long long raw_bytes;
+	unsigned long long stored_bytes;
+	unsigned long long decompressed;
+};
+
+value_codec *codec_create(void);
+void codec_free(value_codec *codec);
+
+/*
+ * codec_add_sample() - Keeps (the start of) a value for the training of the
+ * dictionary, which is trained once enough samples were added.
+ */
+void codec_add_sample(value_codec *codec, const void *value,
+					  unsigned int size);
+
+/*
+ * codec_train() - Builds the dictionary from the samples added so far (a
+ * no-op once trained): the 64-byte segments whose 8-byte substrings are
+ * the most frequent across the samples, the best one closest to the data.
+ */
+void codec_train(value_codec *codec);
+
+/**
+ * codec_compress() - Compresses a value.
+ *
+ * @arg1: Codec.
+ * @arg2: Value.
+ * @arg3: Size of the value, in bytes.
+ * @arg4: Returns the blob, valid until the next codec_compress().
+ *
+ * Return: the size of the blob, or 0 if it is not smaller than the value.
+ */
+unsigned int codec_compress(value_codec *codec, const void *value,
+							unsigned int size, const unsigned char **blob);
+
+/**
+ * codec_decompress() - Decompresses a blob into the scratch buffer of the
+ *                      codec (valid until the next codec_decompress()).
+ *
+ * @arg1: Codec that compressed the blob.
+ * @arg2: Blob.
+ * @arg3: Size of the blob, in bytes.
+ * @arg4: Returns the size of the value (may be NULL).
+ *
+ * Return: the value.
+ */
+void *codec_decompress(value_codec *codec, const void *blob,
+					   unsigned int size, unsigned int *value_size);
+
+#endif  // CODEC_H_
@@ -0,0 +1,408 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#include "utils.h"
+#include "hashring.h"
+
+/* a node underfull below this is merged with a neighbor, if they fit */
+#define HASHRING_MIN_ENTRIES (HASHRING_NODE_SIZE / 4)
+
+static hashring_leaf *as_leaf(hashring_node *node)
+{
+	return (hashring_leaf *)node;
+}
+
+static hashring_inner *as_inner(hashring_node *node)
+{
+	return (hashring_inner *)node;
+}
+
+static hashring_node *node_create(int is_leaf)
+{
+	hashring_node *node;
+
+	// the leaves have no children, so they are smaller
+	if (is_leaf) {
+		hashring_leaf *leaf = calloc(1, sizeof(*leaf));
+		DIE(!leaf, "calloc() for *leaf failed\n");
+		node = &leaf->node;
+	} else {
+		hashring_inner *inner = calloc(1, sizeof(*inner));
+		DIE(!inner, "calloc() for *inner failed\n");
+		node = &inner->node;
+	}
+
+	node->is_leaf = is_leaf;
+	return node;
+}
+
+static void node_free(hashring_node *node)
+{
+	if (!node->is_leaf)
+		for (int i = 0; i < node->no_entries; i++)
+			node_free(as_inner(node)->children[i]);
+	free(node);
+}
+
+/* first entry whose hash is >= the given one (no_entries if none) */
+static int node_lower_bound(const hashring_node *node, unsigned int hash)
+{
+	int start = 0;
+	int end = node->no_entries;
+
+	while (start < end) {
+		int mid = start + (end - start) / 2;  // avoid overflow
+
+		if (node->hashes[mid] < hash)
+			start = mid + 1;
+		else
+			end = mid;
+	}
+
+	return start;
+}
+
+static unsigned int node_max(const hashring_node *node)
+{
+	return node->hashes[node->no_entries - 1];
+}
+
+/* points under a node */
+static int node_count(const hashring_node *node)
+{
+	if (node->is_leaf)
+		return node->no_entries;
+
+	int count = 0;
+	for (int i = 0; i < node->no_entries; i++)
+		count += node->values[i];
+	return count;
+}
+
+/* moves `count` entries of src (from src_slot) to dst (at dst_slot) */
+static void node_copy(hashring_node *dst, int dst_slot,
+					  const hashring_node *src, int src_slot, int count)
+{
+	memmove(dst->hashes + dst_slot, src->hashes + src_slot,
+			count * sizeof(*dst->hashes));
+	memmove(dst->values + dst_slot, src->values + src_slot,
+			count * sizeof(*dst->values));
+	if (!dst->is_leaf)
+		memmove(as_inner(dst)->children + dst_slot,
+				((const hashring_inner *)src)->children + src_slot,
+				count * sizeof(hashring_node *));
+}
+
+static void node_put(hashring_node *node, int slot, unsigned int hash,
+					 int value, hashring_node *child)
+{
+	node_copy(node, slot + 1, node, slot, node->no_entries - slot);
+	node->hashes[slot] = hash;
+	node->values[slot] = value;
+	if (!node->is_leaf)
+		as_inner(node)->children[slot] = child;
+	node->no_entries++;
+}
+
+static void node_remove(hashring_node *node, int slot)
+{
+	node_copy(node, slot, node, slot + 1, node->no_entries - slot - 1);
+	node->no_entries--;
+}
+
+/* takes a leaf out of the list of the leaves */
+static void leaf_unlink(hashring *ring, hashring_leaf *leaf)
+{
+	if (leaf->prev)
+		leaf->prev->next = leaf->next;
+	else
+		ring->first = leaf->next;
+
+	if (leaf->next)
+		leaf->next->prev = leaf->prev;
+	else
+		ring->last = leaf->prev;
+}
+
+/* moves the upper half of an overflowing node to a new right sibling */
+static hashring_node *node_split(hashring *ring, hashring_node *node)
+{
+	hashring_node *right = node_create(node->is_leaf);
+	int half = node->no_entries / 2;
+
+	node_copy(right, 0, node, half, node->no_entries - half);
+	right->no_entries = node->no_entries - half;
+	node->no_entries = half;
+
+	if (node->is_leaf) {
+		hashring_leaf *leaf = as_leaf(node), *right_leaf = as_leaf(right);
+
+		right_leaf->prev = leaf;
+		right_leaf->next = leaf->next;
+		if (leaf->next)
+			leaf->next->prev = right_leaf;
+		else
+			ring->last = right_leaf;
+		leaf->next = right_leaf;
+	}
+
+	return right;
+}
+
+/*
+ * Inserts a point under a node, adding to *index the points before it;
+ * returns the new right sibling of the node if the node was split.
+ */
+static hashring_node *node_insert(hashring *ring, hashring_node *node,
+								  int label, unsigned int hash, int *index)
+{
+	int slot = node_lower_bound(node, hash);
+
+	if (node->is_leaf) {
+		*index += slot;
+		node_put(node, slot, hash, label, NULL);
+	} else {
+		// past the largest hash of the node, the point goes to its last
+		// child
+		if (slot == node->no_entries)
+			slot--;
+		for (int i = 0; i < slot; i++)
+			*index += node->values[i];
+
+		hashring_node *child = as_inner(node)->children[slot];
+		hashring_node *sibling = node_insert(ring, child, label, hash, index);
+
+		node->hashes[slot] = node_max(child);
+		node->values[slot]++;
+		if (sibling) {
+			node->values[slot] = node_count(child);
+			node_put(node, slot + 1, node_max(sibling), node_count(sibling),
+					 sibling);
+		}
+	}
+
+	if (node->no_entries > HASHRING_NODE_SIZE)
+		return node_split(ring, node);
+	return NULL;
+}
+
+int hashring_insert(hashring *ring, int label, unsigned int hash)
+{
+	int index = 0;
+
+	if (!ring->root) {
+		ring->root = node_create(1);
+		ring->first = as_leaf(ring->root);
+		ring->last = ring->first;
+	}
+
+	hashring_node *sibling = node_insert(ring, ring->root, label, hash,
+										 &index);
+
+	// a split root gets a parent: the tree grows by one level
+	if (sibling) {
+		hashring_node *root = node_create(0);
+
+		node_put(root, 0, node_max(ring->root), node_count(ring->root),
+				 ring->root);
+		node_put(root, 1, node_max(sibling), node_count(sibling), sibling);
+		ring->root = root;
+	}
+
+	ring->no_points++;
+	return index;
+}
+
+/*
+ * After a removal under the child at a slot: an empty child is freed, and
+ * an underfull one is merged with a neighbor when both fit in one node.
+ */
+static void node_rebalance(hashring *ring, hashring_node *node, int slot)
+{
+	hashring_node *child = as_inner(node)->children[slot];
+
+	if (!child->no_entries) {
+		if (child->is_leaf)
+			leaf_unlink(ring, as_leaf(child));
+		free(child);
+		node_remove(node, slot);
+		return;
+	}
+
+	node->hashes[slot] = node_max(child);
+	if (child->no_entries >= HASHRING_MIN_ENTRIES || node->no_entries < 2)
+		return;
+
+	int left_slot = slot ? slot - 1 : slot;
+	hashring_node *left = as_inner(node)->children[left_slot];
+	hashring_node *right = as_inner(node)->children[left_slot + 1];
+
+	if (left->no_entries + right->no_entries > HASHRING_NODE_SIZE)
+		return;
+
+	node_copy(left, left->no_entries, right, 0, right->no_entries);
+	left->no_entries += right->no_entries;
+	if (right->is_leaf)
+		leaf_unlink(ring, as_leaf(right));
+	free(right);
+
+	node->hashes[left_slot] = node_max(left);
+	node->values[left_slot] += node->values[left_slot + 1];
+	node_remove(node, left_slot + 1);
+}
+
+/* removes the point with a hash under a node; returns its index under it */
+static int node_erase(hashring *ring, hashring_node *node, unsigned int hash)
+{
+	int slot = node_lower_bound(node, hash);
+
+	if (slot == node->no_entries)
+		return -1;
+
+	if (node->is_leaf) {
+		if (node->hashes[slot] != hash)
+			return -1;
+		node_remove(node, slot);
+		return slot;
+	}
+
+	int index = node_erase(ring, as_inner(node)->children[slot], hash);
+	if (index < 0)
+		return -1;
+
+	for (int i = 0; i < slot; i++)
+		index += node->values[i];
+	node->values[slot]--;
+	node_rebalance(ring, node, slot);
+
+	return index;
+}
+
+int hashring_erase(hashring *ring, unsigned int hash)
+{
+	if (!ring->root)
+		return -1;
+
+	int index = node_erase(ring, ring->root, hash);
+	if (index < 0)
+		return -1;
+	ring->no_points--;
+
+	// a root left with one child hands over to it: one level less
+	hashring_node *root = ring->root;
+	if (!root->is_leaf && root->no_entries == 1) {
+		ring->root = as_inner(root)->children[0];
+		free(root);
+	} else if (!root->no_entries) {
+		if (root->is_leaf)
+			leaf_unlink(ring, as_leaf(root));
+		free(root);
+		ring->root = NULL;
+	}
+
+	return index;
+}
+
+void hashring_init(hashring *ring)
+{
+	memset(ring, 0, sizeof(*ring));
+}
+
+void hashring_free(hashring *ring)
+{
+	if (ring->root)
+		node_free(ring->root);
+	hashring_init(ring);
+}
+
+hashring_pos hashring_seek(const hashring *ring, unsigned int hash)
+{
+	hashring_pos pos = {ring->first, 0};
+	hashring_node *node = ring->root;
+
+	// past the last point, the first one is responsible (circular vector)
+	if (!node || hash > node_max(node))
+		return pos;
+
+	while (!node->is_leaf)
+		node = as_inner(node)->children[node_lower_bound(node, hash)];
+
+	pos.leaf = as_leaf(node);
+	pos.slot = node_lower_bound(node, hash);
+	return pos;
+}
+
+int hashring_find(const hashring *ring, unsigned int hash)
+{
+	hashring_node *node = ring->root;
+	int index = 0;
+
+	if (!node || hash > node_max(node))
+		return 0;
+
+	// the points of the children skipped on the way come before
+	while (!node->is_leaf) {
+		int slot = node_lower_bound(node, hash);
+
+		for (int i = 0; i < slot; i++)
+			index += node->values[i];
+		node = as_inner(node)->children[slot];
+	}
+
+	return index + node_lower_bound(node, hash);
+}
+
+int hashring_owner(const hashring *ring, unsigned int hash)
+{
+	if (!ring->root)
+		return -1;
+
+	return hashring_pos_label(hashring_seek(ring, hash));
+}
+
+hashring_pos hashring_at(const hashring *ring, int index)
+{
+	hashring_node *node = ring->root;
+	hashring_pos pos;
+
+	while (!node->is_leaf) {
+		int slot = 0;
+
+		while (index >= node->values[slot])
+			index -= node->values[slot++];
+		node = as_inner(node)->children[slot];
+	}
+
+	pos.leaf = as_leaf(node);
+	pos.slot = index;
+	return pos;
+}
+
+hashring_pos hashring_begin(const hashring *ring)
+{
+	hashring_pos pos = {ring->first, 0};
+
+	return pos;
+}
+
+void hashring_step(hashring_pos *pos)
+{
+	if (++pos->slot == pos->leaf->node.no_entries) {
+		pos->leaf = pos->leaf->next;
+		pos->slot = 0;
+	}
+}
+
+void hashring_next(const hashring *ring, hashring_pos *pos)
+{
+	hashring_step(pos);
+	if (!pos->leaf)
+		pos->leaf = ring->first;
+}
+
+void hashring_prev(const hashring *ring, hashring_pos *pos)
+{
+	if (pos->slot--)
+		return;
+
+	pos->leaf = pos->leaf->prev ? pos->leaf->prev : ring->last;
+	pos->slot = pos->leaf->node.no_entries - 1;
+}
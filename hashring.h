@@ -0,0 +1,130 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#ifndef HASHRING_H_
+#define HASHRING_H_
+
+/*
+ * Circle of points kept sorted by hash: every point has a label (a server
+ * replica, or a zone in the zoned mode) and the hash of that label, and a
+ * hash belongs to the first point clockwise whose hash is >= it.
+ *
+ * The points are stored in a B+-tree: the leaves hold up to
+ * HASHRING_NODE_SIZE points each and are linked in ring order, and every
+ * inner node keeps the largest hash and the number of points under each
+ * child. A lookup is one descent, an insertion or a removal rewrites one
+ * leaf and the nodes above it (O(log n), whatever the size of the ring),
+ * and the point at a given index is found through the counts.
+ */
+
+/* points of a leaf, children of an inner node */
+#define HASHRING_NODE_SIZE 63
+
+/*
+ * The leaves and the inner nodes share their first member, the header: a
+ * node is allocated as the one it is, and its header is cast back to it
+ * once is_leaf was checked.
+ */
+typedef struct hashring_node hashring_node;
+struct hashring_node {
+	int is_leaf;
+	int no_entries;
+
+	/* one spare entry: a node overflows before it is split */
+	/* leaf: hash of each point; inner node: largest hash under each child */
+	unsigned int hashes[HASHRING_NODE_SIZE + 1];
+	/* leaf: label of each point; inner node: points under each child */
+	int values[HASHRING_NODE_SIZE + 1];
+};
+
+typedef struct hashring_leaf hashring_leaf;
+struct hashring_leaf {
+	hashring_node node;
+	hashring_leaf *prev, *next;  /* neighbor leaves */
+};
+
+typedef struct hashring_inner hashring_inner;
+struct hashring_inner {
+	hashring_node node;
+	hashring_node *children[HASHRING_NODE_SIZE + 1];
+};
+
+typedef struct hashring hashring;
+struct hashring {
+	int no_points;
+	hashring_node *root;
+	hashring_leaf *first;  /* leaf with the smallest hashes */
+	hashring_leaf *last;  /* leaf with the largest hashes */
+};
+
+/* position of a point: its leaf (NULL: no point) and its slot in the leaf */
+typedef struct hashring_pos hashring_pos;
+struct hashring_pos {
+	hashring_leaf *leaf;
+	int slot;
+};
+
+/* hashring_init() - Initializes an empty ring. */
+void hashring_init(hashring *ring);
+
+/* hashring_free() - Frees the points of a ring (the ring can be reused). */
+void hashring_free(hashring *ring);
+
+/**
+ * hashring_insert() - Inserts a point, keeping the ring sorted.
+ *
+ * @arg1: Ring.
+ * @arg2: Label of the point.
+ * @arg3: Hash of the label.
+ *
+ * Return: index of the new point.
+ */
+int hashring_insert(hashring *ring, int label, unsigned int hash);
+
+/**
+ * hashring_erase() - Removes the point with a given hash.
+ *
+ * Return: the index the point had, or -1 if there is no such point.
+ */
+int hashring_erase(hashring *ring, unsigned int hash);
+
+/**
+ * hashring_find() - Finds the point responsible for a hash: the first point
+ * whose hash is >= the given one, wrapping around to the first point.
+ *
+ * Return: index of the point (0 if the ring is empty).
+ */
+int hashring_find(const hashring *ring, unsigned int hash);
+
+/* hashring_owner() - Label responsible for a hash (-1 if the ring is empty). */
+int hashring_owner(const hashring *ring, unsigned int hash);
+
+/* hashring_seek() - Position of the point responsible for a hash. */
+hashring_pos hashring_seek(const hashring *ring, unsigned int hash);
+
+/* hashring_at() - Position of the point at an index (< ring->no_points). */
+hashring_pos hashring_at(const hashring *ring, int index);
+
+/*
+ * hashring_begin() / hashring_step() - Walk over the points in the order
+ * of their hashes, once: the leaf of the position is NULL past the last one.
+ */
+hashring_pos hashring_begin(const hashring *ring);
+void hashring_step(hashring_pos *pos);
+
+/*
+ * hashring_next() / hashring_prev() - Move a position to the next point
+ * clockwise / counterclockwise, wrapping around the ring.
+ */
+void hashring_next(const hashring *ring, hashring_pos *pos);
+void hashring_prev(const hashring *ring, hashring_pos *pos);
+
+static inline int hashring_pos_label(hashring_pos pos)
+{
+	return pos.leaf->node.values[pos.slot];
+}
+
+static inline unsigned int hashring_pos_hash(hashring_pos pos)
+{
+	return pos.leaf->node.hashes[pos.slot];
+}
+
+#endif  // HASHRING_H_
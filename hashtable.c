@@ -36,25 +36,23 @@ int compare_function_strings(void *a, void *b)
 /*
  * Hashing functions
  */
-unsigned int hash_function_int(void *a)
+static inline unsigned int ht_hash_int(unsigned int uint_a)
 {
 	/*
 	 * Credits: https://stackoverflow.com/a/12996028/7883884
 	 */
-	unsigned int uint_a = *((unsigned int *)a);
-
 	uint_a = ((uint_a >> 16u) ^ uint_a) * 0x45d9f3b;
 	uint_a = ((uint_a >> 16u) ^ uint_a) * 0x45d9f3b;
 	uint_a = (uint_a >> 16u) ^ uint_a;
 	return uint_a;
 }
 
-unsigned int hash_function_string(void *a)
+static inline unsigned int ht_hash_string(const char *a)
 {
 	/*
 	 * Credits: http://www.cse.yorku.ca/~oz/hash.html
 	 */
-	unsigned char *puchar_a = (unsigned char*) a;
+	const unsigned char *puchar_a = (const unsigned char*) a;
 	unsigned long hash = 5381;
 	int c;
 
@@ -64,6 +62,34 @@ unsigned int hash_function_string(void *a)
 	return hash;
 }
 
+/* the same hash over key_len bytes: a string gets the hash of its chars */
+static inline unsigned int ht_hash_bytes(const void *key, size_t key_len)
+{
+	const unsigned char *puchar_key = (const unsigned char *)key;
+	unsigned int hash = 5381;
+
+	for (size_t i = 0; i < key_len; i++)
+		hash = ((hash << 5u) + hash) + puchar_key[i];
+
+	return hash;
+}
+
+/* the typed variants (ht_int_*, ht_bytes_*) inline the same hashes */
+unsigned int hash_function_int(void *a)
+{
+	return ht_hash_int(*((unsigned int *)a));
+}
+
+unsigned int hash_function_string(void *a)
+{
+	return ht_hash_string(a);
+}
+
+unsigned int hash_function_bytes(const void *key, size_t key_len)
+{
+	return ht_hash_bytes(key, key_len);
+}
+
 /*
  * Function used to free the memory allocated for the key and
  * value of a pair in the hashtable.
@@ -78,13 +104,72 @@ void key_val_free_function(void *data) {
 
 	free(pair->key);
 	pair->key = NULL;
-	free(pair->value);
+	if (pair->shared == HT_SHARED_STORE)
+		value_store_release(pair->value);
+	else if (pair->shared == HT_SHARED_LOG)
+		value_log_release(pair->value);
+	else
+		free(pair->value);
 	pair->value = NULL;
 
 	free(data);
 	data = NULL;
 }
 
+/*
+ * Bucket of a key hash: the number of buckets is a power of two, so the hash
+ * is mixed first (its low bits alone would be too regular).
+ */
+static unsigned int ht_bucket(hashtable_t *ht, unsigned int hash)
+{
+	hash = ((hash >> 16u) ^ hash) * 0x45d9f3b;
+	hash = (hash >> 16u) ^ hash;
+	return hash & (ht->hmax - 1);
+}
+
+/*
+ * Doubles the number of buckets: the entries of bucket i either stay or go
+ * to bucket i + old hmax, and their nodes are relinked, not copied.
+ */
+static void ht_grow(hashtable_t *ht)
+{
+	unsigned int old_hmax = ht->hmax;
+	list_t **buckets = realloc(ht->buckets, 2 * old_hmax * sizeof(*buckets));
+	DIE(buckets == NULL, "realloc() for ht->buckets failed\n");
+
+	ht->buckets = buckets;
+	ht->hmax = 2 * old_hmax;
+	for (unsigned int i = old_hmax; i < ht->hmax; i++) {
+		ht->buckets[i] = ll_create(sizeof(info));
+		DIE(ht->buckets[i] == NULL, "calloc() for ht->buckets[i] failed\n");
+	}
+
+	for (unsigned int i = 0; i < old_hmax; i++) {
+		node_t *prev_node = NULL;
+		node_t *curr_node = ht->buckets[i]->head;
+
+		while (curr_node != NULL) {
+			node_t *next_node = curr_node->next;
+			unsigned int index = ht_bucket(ht, ((info *)curr_node->data)->hash);
+
+			if (index != i) {
+				ll_unlink_next(ht->buckets[i], prev_node);
+				ll_link_head(ht->buckets[index], curr_node);
+			} else {
+				prev_node = curr_node;
+			}
+			curr_node = next_node;
+		}
+	}
+}
+
+/* called after an entry was added: keeps the chains short */
+static void ht_check_load(hashtable_t *ht)
+{
+	if (ht->size > HT_MAX_LOAD * ht->hmax)
+		ht_grow(ht);
+}
+
 /*
  * Function used to initialize a hashtable after its allocation.
  * The linked lists must also be allocated and initialized.
@@ -96,6 +181,12 @@ hashtable_t *ht_create(unsigned int hmax, unsigned int (*hash_function)(void*),
 	if (!hash_function || !compare_function)
 		return NULL;
 
+	// the number of buckets is rounded up to a power of two
+	unsigned int buckets = 1;
+	while (buckets < hmax)
+		buckets *= 2;
+	hmax = buckets;
+
 	// create hashtable and assign initial values for
 	// the data types in the hashtable structure
 	hashtable_t* ht = calloc(1, sizeof(*ht));
@@ -120,60 +211,124 @@ hashtable_t *ht_create(unsigned int hmax, unsigned int (*hash_function)(void*),
 	return ht;
 }
 
+void *ht_get(hashtable_t *ht, void *key)
+{
+	info *entry = ht_get_entry(ht, key);
+
+	return entry ? entry->value : NULL;
+}
+
 /*
- * Function that returns:
- * 1, if for the key key a value was previously associated in the hashtable
- * using the put function;
- * 0, otherwise.
+ * Sets the value of an entry: interned if ht has a store, else appended to
+ * its log if it has one, else copied.
  */
-int ht_has_key(hashtable_t *ht, void *key)
+static void ht_value_set(hashtable_t *ht, info *data, void *value,
+						 unsigned int value_size)
 {
-	if (!ht || !key) {
-		return ERROR_CODE;
+	if (ht->values) {
+		data->shared = HT_SHARED_STORE;
+		data->value = value_store_intern(ht->values, value, value_size);
+		return;
+	}
+	if (ht->log) {
+		data->shared = HT_SHARED_LOG;
+		data->value = value_log_append(ht->log, value, value_size,
+									   &data->value);
+		return;
 	}
 
-	unsigned int index = ht->hash_function(key) % (ht->hmax);
-	list_t* bucket = ht->buckets[index];
-	node_t* curr_node = bucket->head;
+	data->shared = 0;
 
-	while (curr_node != NULL) {
-		info* curr_data = (info*) curr_node->data;
-		if (!curr_data)
-			return ERROR_CODE;
+	data->value = calloc(1, value_size);
+	DIE(data->value == NULL, "calloc() for data->value failed\n");
+	memcpy(data->value, value, value_size);
+}
 
-		if (ht->compare_function(curr_data->key, key) == 0)
-			return 1;
+/*
+ * Frees the value of an entry, or drops its reference to a shared one, or
+ * marks it dead in its log.
+ */
+static void ht_value_free(info *data)
+{
+	// a packed value goes with the slab of its entry
+	if (data->packed & HT_PACKED_VALUE)
+		data->packed &= ~HT_PACKED_VALUE;
+	else if (data->shared == HT_SHARED_STORE)
+		value_store_release(data->value);
+	else if (data->shared == HT_SHARED_LOG)
+		value_log_release(data->value);
+	else
+		free(data->value);
+	data->value = NULL;
+}
 
-		curr_node = curr_node->next;
+struct ht_slab {
+	unsigned long long refs;  /* entries carved from it, and its creator */
+	unsigned long long size;
+	unsigned long long used;
+	unsigned char data[];
+};
+
+/*
+ * Frees an entry (key, value, info structure and list node) that has
+ * already been unlinked from its bucket; the memory of a packed entry is
+ * given back to its slab.
+ */
+static void ht_free_node(node_t *node)
+{
+	info *curr_data = (info *) node->data;
+
+	ht_value_free(curr_data);
+	free(curr_data->timer);
+	curr_data->timer = NULL;
+
+	// the slab of a packed entry is stored right before its node
+	if (curr_data->packed & HT_PACKED_ENTRY) {
+		ht_slab_release(((ht_slab **)node)[-1]);
+		return;
 	}
 
-	return 0;
+	free(curr_data->key);
+	curr_data->key = NULL;
+	free(curr_data);
+	free(node);
 }
 
-void *ht_get(hashtable_t *ht, void *key)
+/*
+ * Adds a new entry at the head of its bucket and returns it; the caller
+ * finishes setting it up before the table may grow (ht_check_load()),
+ * which relinks the nodes. The key_len bytes of the key are copied into
+ * key_size zeroed bytes (a length-explicit key gets its terminator).
+ */
+static info *ht_add_entry(hashtable_t *ht, const void *key, size_t key_len,
+						  unsigned int key_size, void *value,
+						  unsigned int value_size, unsigned int hash)
 {
-	if (!ht || !key || ht_has_key(ht, key) != 1)
-		return NULL;
+	node_t *node = calloc(1, sizeof(*node));
+	DIE(node == NULL, "calloc() for *node failed\n");
 
-	// find bucket index where the key should be found
-	unsigned int index = ht->hash_function(key) % (ht->hmax);
-	list_t *bucket = ht->buckets[index];
-	node_t *curr_node = bucket->head;
+	info* curr_data = calloc(1, sizeof(info));
+	DIE(curr_data == NULL, "calloc() for *curr_data failed\n");
 
-	// iterate through the bucket until the searched key is found or
-	// until the end of the linked list
-	while (curr_node != NULL) {
-		info* curr_data = (info*) curr_node->data;
-		if (!curr_data)
-			return NULL;
+	curr_data->key = calloc(1, key_size);
+	DIE(curr_data->key == NULL,
+		"calloc() for curr_data->key failed\n");
 
-		if (ht->compare_function(curr_data->key, key) == 0)
-			return curr_data->value;
+	// copy new key and value into the new node
+	memcpy(curr_data->key, key, key_len);
+	ht_value_set(ht, curr_data, value, value_size);
+	curr_data->key_size = key_size;
+	curr_data->value_size = value_size;
+	curr_data->hash = hash;
 
-		curr_node = curr_node->next;
-	}
+	// link the new node on the first position of the list (the info is
+	// its data as it is, not a copy)
+	node->data = curr_data;
+	ll_link_head(ht->buckets[ht_bucket(ht, hash)], node);
+	ht->size++;
+	ht->bytes += key_size + value_size + HT_ENTRY_OVERHEAD;
 
-	return NULL;
+	return curr_data;
 }
 
 /*
@@ -196,60 +351,400 @@ void *ht_get(hashtable_t *ht, void *key)
 void ht_put(hashtable_t *ht, void *key, unsigned int key_size,
 	void *value, unsigned int value_size)
 {
-	if (!ht || !key || !value)
-		return;
+	ht_put_ttl(ht, key, key_size, value, value_size, 0);
+}
 
-	// calculate bucket index where the new value must be added/updated
-	unsigned int index = ht->hash_function(key) % (ht->hmax);
-	list_t *bucket = ht->buckets[index];
-	node_t *curr_node = bucket->head;
+static void ht_expiry_unlink(hashtable_t *ht)
+{
+	*ht->expiry_pprev = ht->expiry_next;
+	if (ht->expiry_next)
+		ht->expiry_next->expiry_pprev = ht->expiry_pprev;
+	ht->expiry_next = NULL;
+	ht->expiry_pprev = NULL;
+}
 
-	// check if there is already a key-value pair with the same key;
-	// if there is, update the value associated with the pair
-	if (ht_has_key(ht, key) == 1) {
-		while (curr_node != NULL) {
-			info* curr_data = (info*) curr_node->data;
+/*
+ * The timer wheel of ht (created on first use), which a timer is about to
+ * be added to: ht joins its expiry list first, if it is not on it.
+ */
+static ttl_wheel *ht_ttl_wheel(hashtable_t *ht)
+{
+	if (ht->expiry && !ht->expiry_pprev) {
+		ht_expiry_list *list = ht->expiry;
 
-			if (ht->compare_function(curr_data->key, key) == 0) {
-				// free old value and allocate space for the new value
-				free(curr_data->value);
-				curr_data->value = NULL;
+		ht->expiry_next = list->tables;
+		ht->expiry_pprev = &list->tables;
+		if (list->tables)
+			list->tables->expiry_pprev = &ht->expiry_next;
+		list->tables = ht;
 
-				curr_data->value = calloc(1, value_size);
-				DIE(curr_data->value == NULL,
-					"calloc() for curr_data->value failed\n");
+		// the clock of a table off the list was left behind
+		ht_expire(ht, list->now);
+	}
 
-				memcpy(curr_data->value, value, value_size);
-			}
+	if (!ht->ttl)
+		ht->ttl = ttl_wheel_create(ht->clock);
+
+	return ht->ttl;
+}
 
-			curr_node = curr_node->next;  // next node in the bucket
+/* sets (or clears, if expires is 0) the expiry of an entry of ht */
+static void ht_set_expiry(hashtable_t *ht, info *data,
+						  unsigned long long expires)
+{
+	if (data->timer) {
+		ttl_wheel_cancel(ht->ttl, data->timer);
+		if (!expires) {
+			free(data->timer);
+			data->timer = NULL;
+			return;
 		}
 	} else {
-		// if no such pair exists, create one and put it into
-		// the current linked list
-		info* curr_data = calloc(1, sizeof(info));
-		DIE(curr_data == NULL, "calloc() for *curr_data failed\n");
-
-		curr_data->key = calloc(1, key_size);
-		DIE(curr_data->key == NULL,
-			"calloc() for curr_data->key failed\n");
-		curr_data->value = calloc(1, value_size);
-		DIE(curr_data->value == NULL,
-			"calloc() for curr_data->value failed\n");
-
-		// copy new key and value into the new node
-		memcpy(curr_data->key, key, key_size);
-		memcpy(curr_data->value, value, value_size);
+		if (!expires)
+			return;
+
+		data->timer = calloc(1, sizeof(*data->timer));
+		DIE(data->timer == NULL, "calloc() for data->timer failed\n");
+		data->timer->entry = data;
+	}
+
+	data->timer->expires = expires;
+	ttl_wheel_add(ht_ttl_wheel(ht), data->timer);
+}
+
+void ht_put_ttl(hashtable_t *ht, void *key, unsigned int key_size,
+				void *value, unsigned int value_size,
+				unsigned long long expires)
+{
+	ht_put_encoded(ht, key, key_size, value, value_size, expires, 0);
+}
+
+void ht_set_clock(hashtable_t *ht, unsigned long long now)
+{
+	if (ht && now > ht->clock)
+		ht->clock = now;
+}
+
+/* unlinks the node after prev from a bucket of ht, with its timer */
+static void ht_unlink_node(hashtable_t *ht, list_t *bucket, node_t *prev)
+{
+	node_t *node = ll_unlink_next(bucket, prev);
+	info *curr_data = (info *) node->data;
+
+	// the timer leaves the wheel with the entry
+	if (curr_data->timer)
+		ttl_wheel_cancel(ht->ttl, curr_data->timer);
+	ht->size--;
+	ht->bytes -= curr_data->key_size + curr_data->value_size +
+				 HT_ENTRY_OVERHEAD;
+}
+
+/* frees an entry of ht, found in its bucket by the stored hash */
+static void ht_remove_stored(hashtable_t *ht, info *data)
+{
+	list_t *bucket = ht->buckets[ht_bucket(ht, data->hash)];
+	node_t *prev_node = NULL;
+	node_t *curr_node = bucket->head;
+
+	while (curr_node->data != data) {
+		prev_node = curr_node;
+		curr_node = curr_node->next;
+	}
+
+	ht_unlink_node(ht, bucket, prev_node);
+	ht_free_node(curr_node);
+}
+
+/* an entry whose timer fired is freed (its key is not looked up again) */
+static void ht_fire(ttl_timer *timer, void *ctx)
+{
+	hashtable_t *ht = (hashtable_t *)ctx;
+
+	ht_remove_stored(ht, timer->entry);
+	ht->expired++;
+}
+
+/*
+ * Moves the clock of ht forward and frees the entries that expired by then;
+ * only the timers that fire are visited, never the whole table.
+ * Returns the number of freed entries.
+ */
+unsigned int ht_expire(hashtable_t *ht, unsigned long long now)
+{
+	if (!ht)
+		return 0;
 
-		// add new node on the first position of the list
-		ll_add_nth_node(ht->buckets[index], 0, curr_data);
-		ht->size++;
+	ht_set_clock(ht, now);
+	if (!ht->ttl)
+		return 0;
 
-		free(curr_data);
-		curr_data = NULL;
+	return ttl_wheel_advance(ht->ttl, ht->clock, ht_fire, ht);
+}
+
+unsigned int ht_expire_list(ht_expiry_list *list, unsigned long long now)
+{
+	unsigned int expired = 0;
+
+	if (now > list->now)
+		list->now = now;
+
+	for (hashtable_t *ht = list->tables, *next; ht; ht = next) {
+		next = ht->expiry_next;
+		expired += ht_expire(ht, list->now);
+		if (!ht->ttl->pending)
+			ht_expiry_unlink(ht);
 	}
+
+	return expired;
 }
 
+/*
+ * Function that adds a new entry without looking for the key first; the
+ * caller guarantees that the key is not already in the hashtable (e.g. when
+ * a whole table is rebuilt from a snapshot).
+ */
+void ht_insert_new(hashtable_t *ht, void *key, unsigned int key_size,
+	void *value, unsigned int value_size)
+{
+	if (!ht || !key || !value)
+		return;
+
+	ht_add_entry(ht, key, key_size, key_size, value, value_size,
+				 ht->hash_function(key));
+	ht_check_load(ht);
+}
+
+/*
+ * The lookups and updates of the table, written once and generated for each
+ * key type by HT_DEFINE_TYPED(): the hash and the comparison of the keys are
+ * expressions that the compiler inlines, instead of calls through
+ * ht->hash_function and ht->compare_function. hash_key(ht, key) must give
+ * what ht->hash_function() gives for the key (the hash is stored in the
+ * entries, which the other variants read too); equal_keys(ht, entry, key)
+ * is nonzero if the entry has the key. A new entry gets the
+ * key_length(key, key_size) bytes at key_bytes(key), in key_size bytes.
+ */
+#define HT_DEFINE_TYPED(scope, name, key_type, hash_key, equal_keys,		\
+						key_bytes, key_length)								\
+/* the node of a key (NULL if it is absent) and the one before it */		\
+static node_t *ht_##name##_find(hashtable_t *ht, key_type key,				\
+								unsigned int key_hash, node_t **prev)		\
+{																			\
+	node_t *prev_node = NULL;												\
+	node_t *curr_node = ht->buckets[ht_bucket(ht, key_hash)]->head;			\
+																			\
+	/* the hashes are compared first, the keys only when they match */		\
+	while (curr_node != NULL) {												\
+		info *curr_data = (info *) curr_node->data;							\
+																			\
+		if (curr_data->hash == key_hash &&									\
+			equal_keys(ht, curr_data, key))									\
+			break;															\
+																			\
+		prev_node = curr_node;												\
+		curr_node = curr_node->next;										\
+	}																		\
+																			\
+	if (prev)																\
+		*prev = prev_node;													\
+	return curr_node;														\
+}																			\
+																			\
+scope void ht_##name##_remove_entry(hashtable_t *ht, key_type key)			\
+{																			\
+	if (!ht || !key)														\
+		return;																\
+																			\
+	/* the node to be deleted, and the one before it, in one walk */		\
+	unsigned int key_hash = hash_key(ht, key);								\
+	node_t *prev_node;														\
+	node_t *curr_node = ht_##name##_find(ht, key, key_hash, &prev_node);	\
+	if (!curr_node)															\
+		return;																\
+																			\
+	/* unlink the node (with its timer), then free the whole entry */		\
+	ht_unlink_node(ht, ht->buckets[ht_bucket(ht, key_hash)], prev_node);	\
+	ht_free_node(curr_node);												\
+}																			\
+																			\
+scope int ht_##name##_has_key(hashtable_t *ht, key_type key)				\
+{																			\
+	unsigned int key_hash = hash_key(ht, key);								\
+																			\
+	return ht_##name##_find(ht, key, key_hash, NULL) != NULL;				\
+}																			\
+																			\
+scope info *ht_##name##_get_entry(hashtable_t *ht, key_type key)			\
+{																			\
+	if (!ht || !key)														\
+		return NULL;														\
+																			\
+	/* one walk of the bucket where the key should be found */				\
+	unsigned int key_hash = hash_key(ht, key);								\
+	node_t *curr_node = ht_##name##_find(ht, key, key_hash, NULL);			\
+	if (!curr_node)															\
+		return NULL;														\
+																			\
+	/* an entry whose time has passed is freed on access */					\
+	info *curr_data = (info *) curr_node->data;								\
+	if (curr_data->timer && curr_data->timer->expires <= ht->clock) {		\
+		ht_##name##_remove_entry(ht, key);									\
+		ht->expired++;														\
+		return NULL;														\
+	}																		\
+																			\
+	curr_data->referenced = 1;												\
+	return curr_data;														\
+}																			\
+																			\
+scope info *ht_##name##_put_encoded(hashtable_t *ht, key_type key,			\
+									unsigned int key_size, void *value,		\
+									unsigned int value_size,				\
+									unsigned long long expires,				\
+									unsigned char encoding)					\
+{																			\
+	if (!ht || !key || !value)												\
+		return NULL;														\
+																			\
+	/* an existing pair (one walk of its bucket) gets the new value */		\
+	unsigned int key_hash = hash_key(ht, key);								\
+	node_t *curr_node = ht_##name##_find(ht, key, key_hash, NULL);			\
+																			\
+	if (curr_node != NULL) {												\
+		info *curr_data = (info *) curr_node->data;							\
+																			\
+		/* free old value and allocate space for the new value */			\
+		ht_value_free(curr_data);											\
+		ht_value_set(ht, curr_data, value, value_size);						\
+		ht->bytes += value_size;											\
+		ht->bytes -= curr_data->value_size;									\
+		curr_data->value_size = value_size;									\
+		curr_data->encoding = encoding;										\
+		ht_set_expiry(ht, curr_data, expires);								\
+		return curr_data;													\
+	}																		\
+																			\
+	/* else a new pair goes at the head of the bucket */					\
+	info *new_data = ht_add_entry(ht, key_bytes(key),						\
+								  key_length(key, key_size), key_size,		\
+								  value, value_size, key_hash);				\
+																			\
+	new_data->encoding = encoding;											\
+	if (expires)															\
+		ht_set_expiry(ht, new_data, expires);								\
+	ht_check_load(ht);														\
+	return new_data;														\
+}
+
+/* a length-explicit key, as the ht_bytes_*() variant takes it */
+typedef struct ht_bytes ht_bytes;
+struct ht_bytes {
+	const void *data;
+	size_t len;
+};
+
+#define HT_HASH_GENERIC(ht, key) ((ht)->hash_function(key))
+#define HT_EQUAL_GENERIC(ht, entry, key)									\
+	((ht)->compare_function((entry)->key, (key)) == 0)
+#define HT_HASH_BYTES(ht, key) ht_hash_bytes((key)->data, (key)->len)
+/* the stored key has one more byte: its terminator */
+#define HT_EQUAL_BYTES(ht, entry, key)										\
+	((entry)->key_size == (key)->len + 1 &&									\
+	 memcmp((entry)->key, (key)->data, (key)->len) == 0)
+#define HT_HASH_INT(ht, key) ht_hash_int(*(key))
+#define HT_EQUAL_INT(ht, entry, key) (*(int *)(entry)->key == *(key))
+#define HT_KEY_AS_IS(key) (key)
+#define HT_KEY_SIZE(key, key_size) (key_size)
+#define HT_KEY_DATA(key) ((key)->data)
+#define HT_KEY_LEN(key, key_size) ((key)->len)
+
+HT_DEFINE_TYPED(static, generic, void *, HT_HASH_GENERIC, HT_EQUAL_GENERIC,
+				HT_KEY_AS_IS, HT_KEY_SIZE)
+HT_DEFINE_TYPED(static, bytes, const ht_bytes *, HT_HASH_BYTES,
+				HT_EQUAL_BYTES, HT_KEY_DATA, HT_KEY_LEN)
+HT_DEFINE_TYPED(, int, int *, HT_HASH_INT, HT_EQUAL_INT, HT_KEY_AS_IS,
+				HT_KEY_SIZE)
+
+/*
+ * Function that returns:
+ * 1, if for the key key a value was previously associated in the hashtable
+ * using the put function;
+ * 0, otherwise.
+ */
+int ht_has_key(hashtable_t *ht, void *key)
+{
+	if (!ht || !key) {
+		return ERROR_CODE;
+	}
+
+	return ht_generic_has_key(ht, key);
+}
+
+/*
+ * Same lookup as ht_get(), returning the whole entry (sizes, expiry), which
+ * stays valid until the next change of the table.
+ */
+info *ht_get_entry(hashtable_t *ht, void *key)
+{
+	return ht_generic_get_entry(ht, key);
+}
+
+void ht_put_encoded(hashtable_t *ht, void *key, unsigned int key_size,
+					void *value, unsigned int value_size,
+					unsigned long long expires, unsigned char encoding)
+{
+	ht_generic_put_encoded(ht, key, key_size, value, value_size, expires,
+						   encoding);
+}
+
+int ht_has_key_len(hashtable_t *ht, const void *key, size_t key_len)
+{
+	ht_bytes bytes = {key, key_len};
+
+	if (!ht || !key)
+		return ERROR_CODE;
+
+	return ht_bytes_has_key(ht, &bytes);
+}
+
+info *ht_get_entry_len(hashtable_t *ht, const void *key, size_t key_len)
+{
+	ht_bytes bytes = {key, key_len};
+
+	return key ? ht_bytes_get_entry(ht, &bytes) : NULL;
+}
+
+info *ht_put_encoded_len(hashtable_t *ht, const void *key, size_t key_len,
+						 const void *value, unsigned int value_size,
+						 unsigned long long expires, unsigned char encoding)
+{
+	ht_bytes bytes = {key, key_len};
+
+	if (!key)
+		return NULL;
+
+	return ht_bytes_put_encoded(ht, &bytes, key_len + 1, (void *)value,
+								value_size, expires, encoding);
+}
+
+void ht_insert_new_len(hashtable_t *ht, const void *key, size_t key_len,
+					   const void *value, unsigned int value_size)
+{
+	if (!ht || !key || !value)
+		return;
+
+	ht_add_entry(ht, key, key_len, key_len + 1, (void *)value, value_size,
+				 ht_hash_bytes(key, key_len));
+	ht_check_load(ht);
+}
+
+void ht_remove_entry_len(hashtable_t *ht, const void *key, size_t key_len)
+{
+	ht_bytes bytes = {key, key_len};
+
+	if (key)
+		ht_bytes_remove_entry(ht, &bytes);
+}
 
 /*
  * Procedure that removes from the hash table the entry associated with the key.
@@ -260,46 +755,333 @@ void ht_put(hashtable_t *ht, void *key, unsigned int key_size,
  */
 void ht_remove_entry(hashtable_t *ht, void *key)
 {
-	if (!ht || !key || ht_has_key(ht, key) != 1)
-		return;
+	ht_generic_remove_entry(ht, key);
+}
 
-	// calculate bucket index using the hask of the key
-	unsigned int index = ht->hash_function(key) % (ht->hmax);
-	list_t *bucket = ht->buckets[index];
-	node_t *curr_node = bucket->head;
+/*
+ * Whether ht has an entry with the key of another entry: the stored keys
+ * are compared as bytes, so that a length-explicit key is told apart from
+ * the string it starts with.
+ */
+static int ht_holds_key(hashtable_t *ht, info *data)
+{
+	node_t *curr_node = ht->buckets[ht_bucket(ht, data->hash)]->head;
+
+	for (; curr_node != NULL; curr_node = curr_node->next) {
+		info *curr_data = (info *) curr_node->data;
+
+		if (curr_data->hash == data->hash &&
+			curr_data->key_size == data->key_size &&
+			memcmp(curr_data->key, data->key, data->key_size) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Links an entry unlinked from src into ht. If ht already holds the key, its
+ * own entry is kept and the incoming one is freed.
+ * Returns 1 if the entry was linked, 0 if it was dropped.
+ */
+static int ht_link_node(hashtable_t *src, hashtable_t *ht, node_t *node)
+{
+	info *new_data = (info *) node->data;
+
+	// the stored hash is kept, unless the tables hash differently
+	if (src->hash_function != ht->hash_function)
+		new_data->hash = ht->hash_function(new_data->key);
+
+	if (ht_holds_key(ht, new_data)) {
+		ht_free_node(node);
+		return 0;
+	}
+
+	ll_link_head(ht->buckets[ht_bucket(ht, new_data->hash)], node);
+	ht->size++;
+	ht->bytes += new_data->key_size + new_data->value_size +
+				 HT_ENTRY_OVERHEAD;
+	if (new_data->timer)
+		ttl_wheel_add(ht_ttl_wheel(ht), new_data->timer);
+	ht_check_load(ht);
+	return 1;
+}
 
-	// to keep track of the position of the node to be deleted
-	unsigned int index_node = 0;
+/*
+ * Moves the entry associated with the key from src to dst by relinking its
+ * node: the key, the value and the node are reused, nothing is copied. If
+ * dst already has an entry with the same key, that entry is kept and the
+ * one from src is freed.
+ * Returns 1 if the entry was moved, 0 otherwise.
+ */
+int ht_move_entry(hashtable_t *src, hashtable_t *dst, void *key)
+{
+	if (!src || !dst || !key || src == dst)
+		return 0;
+
+	unsigned int hash = src->hash_function(key);
+	node_t *prev_node;
+	node_t *curr_node = ht_generic_find(src, key, hash, &prev_node);
+
+	if (curr_node == NULL)
+		return 0;
+
+	ht_unlink_node(src, src->buckets[ht_bucket(src, hash)], prev_node);
+	return ht_link_node(src, dst, curr_node);
+}
+
+int ht_move_entry_len(hashtable_t *src, hashtable_t *dst, const void *key,
+					  size_t key_len)
+{
+	if (!src || !dst || !key || src == dst)
+		return 0;
+
+	ht_bytes bytes = {key, key_len};
+	unsigned int hash = ht_hash_bytes(key, key_len);
+	node_t *prev_node;
+	node_t *curr_node = ht_bytes_find(src, &bytes, hash, &prev_node);
+
+	if (curr_node == NULL)
+		return 0;
+
+	ht_unlink_node(src, src->buckets[ht_bucket(src, hash)], prev_node);
+	return ht_link_node(src, dst, curr_node);
+}
+
+/*
+ * Walks one bucket of src and moves every entry for which dest_of() returns
+ * another hashtable there (by relinking, as ht_move_entry() does); entries
+ * for which it returns NULL (or src) stay in place.
+ * Returns the number of examined entries.
+ */
+unsigned int ht_move_bucket(hashtable_t *src, unsigned int index,
+							hashtable_t *(*dest_of)(info *entry, void *ctx),
+							void *ctx)
+{
+	if (!src || index >= src->hmax)
+		return 0;
+
+	list_t *bucket = src->buckets[index];
+	node_t *prev_node = NULL;
+	node_t *curr_node = bucket->head;
+	unsigned int examined = 0;
 
 	while (curr_node != NULL) {
-		info* curr_data = (info*) curr_node->data;
-		if (!curr_data)
-			return;
+		node_t *next_node = curr_node->next;
+		info *curr_data = (info *) curr_node->data;
+		hashtable_t *dst = dest_of(curr_data, ctx);
 
-		// if the node to be deleted is found,
-		// free the allocated memory for the node
-		if (ht->compare_function(curr_data->key, key) == 0) {
-			free(curr_data->key);
-			curr_data->key = NULL;
-			free(curr_data->value);
-			curr_data->value = NULL;
-			free(curr_data);
-			curr_data = NULL;
-
-			// delete the node itself from the list and free its memory
-			node_t* del_node;
-			del_node = ll_remove_nth_node(ht->buckets[index], index_node);
-			free(del_node);
-			del_node = NULL;
-
-			ht->size--;
-			return;
+		if (dst && dst != src) {
+			ht_unlink_node(src, bucket, prev_node);
+			ht_link_node(src, dst, curr_node);
+		} else {
+			prev_node = curr_node;
 		}
-		curr_node = curr_node->next;
-		index_node++;
+
+		examined++;
+		curr_node = next_node;
+	}
+
+	return examined;
+}
+
+unsigned int ht_evict(hashtable_t *ht, unsigned long long max_bytes,
+					  const info *keep)
+{
+	unsigned int evicted = 0;
+
+	if (!ht)
+		return 0;
+
+	while (ht->bytes > max_bytes && ht->size > (keep ? 1u : 0u)) {
+		list_t *bucket = ht->buckets[ht->clock_hand];
+		node_t *prev_node = NULL;
+		node_t *curr_node = bucket->head;
+
+		while (curr_node != NULL && ht->bytes > max_bytes) {
+			node_t *next_node = curr_node->next;
+			info *curr_data = (info *) curr_node->data;
+
+			if (curr_data == keep) {
+				prev_node = curr_node;
+			} else if (curr_data->referenced) {
+				// read since the last pass: second chance
+				curr_data->referenced = 0;
+				prev_node = curr_node;
+			} else {
+				ht_unlink_node(ht, bucket, prev_node);
+				ht_free_node(curr_node);
+				evicted++;
+			}
+
+			curr_node = next_node;
+		}
+
+		// a bucket left half-way is resumed by the next call
+		if (curr_node == NULL)
+			ht->clock_hand = (ht->clock_hand + 1) & (ht->hmax - 1);
+	}
+
+	return evicted;
+}
+
+static unsigned int ht_reverse_bits(unsigned int bits)
+{
+	bits = ((bits >> 1) & 0x55555555) | ((bits & 0x55555555) << 1);
+	bits = ((bits >> 2) & 0x33333333) | ((bits & 0x33333333) << 2);
+	bits = ((bits >> 4) & 0x0F0F0F0F) | ((bits & 0x0F0F0F0F) << 4);
+	bits = ((bits >> 8) & 0x00FF00FF) | ((bits & 0x00FF00FF) << 8);
+	return (bits >> 16) | (bits << 16);
+}
+
+/*
+ * The cursor counts in reverse binary: its highest bucket bits change
+ * first, so the buckets already visited map, after a doubling, to the
+ * buckets that the cursor has already passed (and are not visited again).
+ */
+unsigned int ht_scan_next(hashtable_t *ht, unsigned int cursor)
+{
+	cursor |= ~(ht->hmax - 1);
+	cursor = ht_reverse_bits(cursor);
+	cursor++;
+	return ht_reverse_bits(cursor);
+}
+
+unsigned int ht_scan_position(hashtable_t *ht, unsigned int cursor)
+{
+	unsigned int bits = 0;
+
+	while ((1u << bits) < ht->hmax)
+		bits++;
+
+	return bits ? ht_reverse_bits(cursor & (ht->hmax - 1)) >> (32 - bits) : 0;
+}
+
+unsigned int ht_scan(hashtable_t *ht, unsigned int cursor, unsigned int count,
+					 void (*callback)(info *entry, void *ctx), void *ctx)
+{
+	unsigned long long visited = 0, buckets = 0;
+
+	if (!ht)
+		return 0;
+
+	// a run of empty buckets also ends the slice, as Redis does
+	do {
+		node_t *curr_node = ht->buckets[cursor & (ht->hmax - 1)]->head;
+
+		for (; curr_node != NULL; curr_node = curr_node->next, visited++)
+			callback(curr_node->data, ctx);
+
+		cursor = ht_scan_next(ht, cursor);
+	} while (cursor && visited < count &&
+			 ++buckets < (unsigned long long)HT_SCAN_EMPTY_FACTOR * count);
+
+	return cursor;
+}
+
+/* ht_move_bucket() applied to every bucket of src */
+void ht_move_entries(hashtable_t *src,
+					 hashtable_t *(*dest_of)(info *entry, void *ctx),
+					 void *ctx)
+{
+	if (!src)
+		return;
+
+	for (unsigned int i = 0; i < src->hmax; i++)
+		ht_move_bucket(src, i, dest_of, ctx);
+}
+
+ht_slab *ht_slab_create(unsigned long long size)
+{
+	ht_slab *slab = malloc(sizeof(*slab) + size);
+	DIE(slab == NULL, "malloc() for *slab failed\n");
+
+	slab->refs = 1;
+	slab->size = size;
+	slab->used = 0;
+	return slab;
+}
+
+void ht_slab_release(ht_slab *slab)
+{
+	if (slab && !--slab->refs)
+		free(slab);
+}
+
+/* slab pointer, node, info, key and value, 8-byte aligned */
+unsigned long long ht_slab_entry_size(unsigned int key_size,
+									  unsigned int value_size)
+{
+	unsigned long long size = sizeof(ht_slab *) + sizeof(node_t) +
+							  sizeof(info) + key_size + value_size;
+
+	return (size + 7) & ~7ull;
+}
+
+void ht_put_packed(hashtable_t *ht, ht_slab *slab, const void *key,
+				   size_t key_len, const void *value, unsigned int value_size,
+				   unsigned char encoding)
+{
+	if (!ht || !slab || !key || !value)
+		return;
+
+	// the value is packed too, unless it is encoded, shared or logged
+	int pack_value = !encoding && !ht->values && !ht->log;
+	unsigned int key_size = key_len + 1;
+	unsigned long long size = ht_slab_entry_size(key_size,
+												 pack_value ? value_size : 0);
+
+	ht_bytes bytes = {key, key_len};
+	unsigned int hash = ht_hash_bytes(key, key_len);
+
+	// last write wins: an update replaces the value of the entry
+	if (ht_bytes_find(ht, &bytes, hash, NULL) ||
+		slab->used + size > slab->size) {
+		ht_put_encoded_len(ht, key, key_len, value, value_size, 0, encoding);
+		return;
 	}
+
+	unsigned char *block = slab->data + slab->used;
+	node_t *node = (node_t *)(block + sizeof(ht_slab *));
+	info *curr_data = (info *)(node + 1);
+
+	slab->used += size;
+	slab->refs++;
+	*(ht_slab **)block = slab;
+
+	memset(curr_data, 0, sizeof(*curr_data));
+	curr_data->key = curr_data + 1;
+	memcpy(curr_data->key, key, key_len);
+	((char *)curr_data->key)[key_len] = 0;
+	curr_data->key_size = key_size;
+	curr_data->hash = hash;
+	curr_data->packed = HT_PACKED_ENTRY;
+
+	if (pack_value) {
+		curr_data->value = (unsigned char *)curr_data->key + key_size;
+		memcpy(curr_data->value, value, value_size);
+		curr_data->packed |= HT_PACKED_VALUE;
+	} else {
+		ht_value_set(ht, curr_data, (void *)value, value_size);
+	}
+	curr_data->value_size = value_size;
+	curr_data->encoding = encoding;
+
+	node->data = curr_data;
+	ll_link_head(ht->buckets[ht_bucket(ht, hash)], node);
+	ht->size++;
+	ht->bytes += key_size + value_size + HT_ENTRY_OVERHEAD;
+	ht_check_load(ht);
 }
 
+void ht_reserve(hashtable_t *ht, unsigned int no_entries)
+{
+	if (!ht)
+		return;
+
+	while (ht->hmax < no_entries)
+		ht_grow(ht);
+}
 
 /*
  * Function that frees the memory used by all the entries in the hashtable, and
@@ -311,29 +1093,43 @@ void ht_free(hashtable_t *ht)
 		return;
 
 	// to free the memory carefully, iterate through each bucket
-	// and for each bucket, free the memory for the nodes in the list,
+	// and for each bucket, free the entries in the list (nodes included),
 	// then free the list itself, and at the end, free the array of buckets
 	for (unsigned int i = 0; i < ht->hmax; i++) {
 		node_t* curr_node = ht->buckets[i]->head;
 
 		while (curr_node != NULL) {
-			info* curr_data = (info*)curr_node->data;
-			if (!curr_data)
-				return;
-
-			free(curr_data->key);
-			curr_data->key = NULL;
-			free(curr_data->value);
-			curr_data->value = NULL;
+			node_t *next_node = curr_node->next;
 
-			curr_node = curr_node->next;
+			ht_free_node(curr_node);
+			curr_node = next_node;
 		}
-		ll_free(&ht->buckets[i]);
+		free(ht->buckets[i]);
 		ht->buckets[i] = NULL;
 	}
 
 	free(ht->buckets);
 	ht->buckets = NULL;
+	ttl_wheel_free(ht->ttl);
+	ht->ttl = NULL;
+	if (ht->expiry_pprev)
+		ht_expiry_unlink(ht);
 	free(ht);
 	ht = NULL;
 }
+
+unsigned int ht_get_size(hashtable_t *ht)
+{
+	if (!ht)
+		return 0;
+
+	return ht->size;
+}
+
+unsigned int ht_get_hmax(hashtable_t *ht)
+{
+	if (!ht)
+		return 0;
+
+	return ht->hmax;
+}
@@ -4,9 +4,30 @@
 
 #include "utils.h"
 #include "linked_list.h"
+#include "ttl.h"
+#include "value_store.h"
+#include "value_log.h"
 
-/* HMAX is the maximum number of buckets in the hashtable. */
-#define HMAX 100
+/*
+ * HMAX is the initial number of buckets in the hashtable; the number of
+ * buckets is a power of two, which doubles when there are more than
+ * HT_MAX_LOAD entries per bucket.
+ */
+#define HMAX 128
+#define HT_MAX_LOAD 2
+/* buckets an ht_scan() slice may visit, per entry asked */
+#define HT_SCAN_EMPTY_FACTOR 10
+
+/* info->packed: what of an entry lives in an ht_slab */
+#define HT_PACKED_ENTRY 1  /* the list node, the info and the key */
+#define HT_PACKED_VALUE 2  /* the value */
+
+/* info->shared: what the value of an entry belongs to (0: the entry) */
+#define HT_SHARED_STORE 1  /* a value_store */
+#define HT_SHARED_LOG 2  /* a value_log */
+
+/* memory used by an entry besides its key and value */
+#define HT_ENTRY_OVERHEAD (sizeof(node_t) + sizeof(info))
 
 /*
 Source: https://ocw.cs.pub.ro/courses/sd-ca/laboratoare/lab-04
@@ -16,9 +37,33 @@ typedef struct info info;
 struct info {
 	void *key;
 	void *value;
+	ttl_timer *timer;  /* expiry of the entry (NULL: it never expires) */
+	unsigned int key_size;
+	unsigned int value_size;
+	/*
+	 * Hash of the key (ht->hash_function()): the chain walks compare it
+	 * before reading the key, and the table grows without rehashing.
+	 */
+	unsigned int hash;
+	unsigned char referenced;  /* set by ht_get(), cleared by ht_evict() */
+	unsigned char encoding;  /* how the value is stored (0: as given) */
+	unsigned char shared;  /* HT_SHARED_* (0: the value is the entry's) */
+	unsigned char packed;  /* HT_PACKED_* flags (see ht_slab) */
 };
 
 typedef struct hashtable_t hashtable_t;
+
+/*
+ * Tables whose timer wheel has timers armed, so that a tick visits them
+ * only (see ht_expire_list()) instead of every table that may hold entries
+ * with a TTL.
+ */
+typedef struct ht_expiry_list ht_expiry_list;
+struct ht_expiry_list {
+	hashtable_t *tables;
+	unsigned long long now;  /* tick of the last ht_expire_list() */
+};
+
 struct hashtable_t {
 	list_t **buckets; /* Array of singly-linked lists. */
 	/* Total number of nodes currently existing in all buckets. */
@@ -30,6 +75,37 @@ struct hashtable_t {
 	int (*compare_function)(void*, void*);
 	/* (Pointer to) Function to free the memory occupied by key and value. */
 	void (*key_val_free_function)(void*);
+
+	/* Timers of the entries with a TTL (created with the first one). */
+	ttl_wheel *ttl;
+	/* Current time, in ticks; entries that expired by then are not found. */
+	unsigned long long clock;
+	/* Number of entries that expired (and were freed). */
+	unsigned long long expired;
+	/*
+	 * Optional list that ht joins when a timer is added to its empty wheel
+	 * (put with a TTL, or moved in), and leaves once its wheel is empty.
+	 */
+	ht_expiry_list *expiry;
+	hashtable_t *expiry_next;
+	hashtable_t **expiry_pprev;  /* link to ht in the list (NULL: off it) */
+
+	/* Keys, values and HT_ENTRY_OVERHEAD of all the entries, in bytes. */
+	unsigned long long bytes;
+	/* Bucket where the next ht_evict() starts (CLOCK hand). */
+	unsigned int clock_hand;
+
+	/*
+	 * Optional store where the values put from now on are interned
+	 * (shared with the other tables using it); ht->bytes still counts
+	 * the full size of every value.
+	 */
+	value_store *values;
+	/*
+	 * Optional log where the values put from now on are appended, off the
+	 * heap (see value_log.h); a store, if any, goes first.
+	 */
+	value_log *log;
 };
 
 /* Some functions were taken from the lab support */
@@ -46,10 +122,159 @@ hashtable_t *ht_create(unsigned int hmax, unsigned int (*hash_function)(void*),
 
 int ht_has_key(hashtable_t *ht, void *key);
 void *ht_get(hashtable_t *ht, void *key);
+info *ht_get_entry(hashtable_t *ht, void *key);
 void ht_put(hashtable_t *ht, void *key, unsigned int key_size,
 			void *value, unsigned int value_size);
+/* like ht_put(), for keys known to be absent from ht (no lookup is done) */
+void ht_insert_new(hashtable_t *ht, void *key, unsigned int key_size,
+				   void *value, unsigned int value_size);
 
 void ht_remove_entry(hashtable_t *ht, void *key);
+
+/*
+ * Entries with a time to live: ht_put_ttl() is ht_put() with the tick at
+ * which the entry expires (0: never; a plain ht_put() also clears it).
+ * ht_set_clock() only moves the clock used by the lookups, while
+ * ht_expire() also frees the entries whose timers fired by then.
+ */
+void ht_put_ttl(hashtable_t *ht, void *key, unsigned int key_size,
+				void *value, unsigned int value_size,
+				unsigned long long expires);
+/*
+ * ht_put_encoded() - ht_put_ttl() for a value stored in another form (e.g.
+ * compressed); the entry keeps the encoding, which is left to its readers.
+ */
+void ht_put_encoded(hashtable_t *ht, void *key, unsigned int key_size,
+					void *value, unsigned int value_size,
+					unsigned long long expires, unsigned char encoding);
+void ht_set_clock(hashtable_t *ht, unsigned long long now);
+unsigned int ht_expire(hashtable_t *ht, unsigned long long now);
+/*
+ * ht_expire_list() - ht_expire() of every table on a list; the tables left
+ * with no timer leave it. A table joining the list later has its clock
+ * caught up with the list's.
+ */
+unsigned int ht_expire_list(ht_expiry_list *list, unsigned long long now);
+
+/*
+ * Typed variants of ht_has_key(), ht_get_entry(), ht_put_encoded() and
+ * ht_remove_entry(), generated with the hash and the comparison of the keys
+ * inlined (see HT_DEFINE_TYPED in hashtable.c): ht_int_*() for the tables
+ * created with hash_function_int() and compare_function_ints(); the string
+ * tables have the length-explicit functions below. They can be mixed with
+ * the generic functions on such a table. The put returns the entry.
+ */
+#define HT_DECLARE_TYPED(name, key_type)									\
+	int ht_##name##_has_key(hashtable_t *ht, key_type key);					\
+	info *ht_##name##_get_entry(hashtable_t *ht, key_type key);				\
+	info *ht_##name##_put_encoded(hashtable_t *ht, key_type key,			\
+								  unsigned int key_size, void *value,		\
+								  unsigned int value_size,					\
+								  unsigned long long expires,				\
+								  unsigned char encoding);					\
+	void ht_##name##_remove_entry(hashtable_t *ht, key_type key);
+
+HT_DECLARE_TYPED(int, int *)
+
+/*
+ * Length-explicit keys, for the tables created with hash_function_string()
+ * and compare_function_strings(): a key is any key_len bytes ('\0'
+ * included), hashed with hash_function_bytes() and compared with memcmp()
+ * when the lengths are equal. The table keeps the key with a '\0' after
+ * its bytes (key_size is key_len + 1), so a string key is the same entry
+ * for these functions and for the generic ones, which are given the string.
+ * Values are copied as given: value_size bytes, with no terminator added.
+ */
+unsigned int hash_function_bytes(const void *key, size_t key_len);
+
+int ht_has_key_len(hashtable_t *ht, const void *key, size_t key_len);
+info *ht_get_entry_len(hashtable_t *ht, const void *key, size_t key_len);
+/* ht_put_encoded() of a length-explicit key; returns the entry */
+info *ht_put_encoded_len(hashtable_t *ht, const void *key, size_t key_len,
+						 const void *value, unsigned int value_size,
+						 unsigned long long expires, unsigned char encoding);
+/* like ht_put_encoded_len(), for keys known to be absent (no lookup) */
+void ht_insert_new_len(hashtable_t *ht, const void *key, size_t key_len,
+					   const void *value, unsigned int value_size);
+void ht_remove_entry_len(hashtable_t *ht, const void *key, size_t key_len);
+int ht_move_entry_len(hashtable_t *src, hashtable_t *dst, const void *key,
+					  size_t key_len);
+
+/**
+ * ht_evict() - Frees entries until the table uses at most max_bytes.
+ *
+ * CLOCK over the buckets: the hand walks the chains, clears the reference
+ * bit of the entries read since its last pass and frees the others, so each
+ * eviction costs O(1) amortized and entries that were only written once
+ * (e.g. by a scan) go first.
+ *
+ * @arg1: Hashtable.
+ * @arg2: Memory budget, in bytes (see ht->bytes).
+ * @arg3: Entry that must not be evicted (NULL: none).
+ *
+ * Return: the number of evicted entries.
+ */
+unsigned int ht_evict(hashtable_t *ht, unsigned long long max_bytes,
+					  const info *keep);
+
+/*
+ * Moving entries between hashtables by relinking their nodes (no key or
+ * value is copied); an entry already present in the destination wins.
+ */
+int ht_move_entry(hashtable_t *src, hashtable_t *dst, void *key);
+unsigned int ht_move_bucket(hashtable_t *src, unsigned int index,
+							hashtable_t *(*dest_of)(info *entry, void *ctx),
+							void *ctx);
+void ht_move_entries(hashtable_t *src,
+					 hashtable_t *(*dest_of)(info *entry, void *ctx),
+					 void *ctx);
+
+/*
+ * Incremental iteration, in the style of Redis SCAN: ht_scan() visits whole
+ * buckets from the cursor (0 to start) until at least `count` entries were
+ * passed to the callback (or HT_SCAN_EMPTY_FACTOR * count buckets were
+ * visited), and returns the cursor to continue from (0 once
+ * every bucket was visited). An entry present during the whole scan is
+ * visited at least once, even if the table grows between the calls; the
+ * callback must not add or remove entries.
+ *
+ * ht_scan_next() is the cursor that follows a bucket, and
+ * ht_scan_position() the number of buckets visited before a cursor.
+ */
+unsigned int ht_scan(hashtable_t *ht, unsigned int cursor, unsigned int count,
+					 void (*callback)(info *entry, void *ctx), void *ctx);
+unsigned int ht_scan_next(hashtable_t *ht, unsigned int cursor);
+unsigned int ht_scan_position(hashtable_t *ht, unsigned int cursor);
+
+/*
+ * Bulk loading: an ht_slab is one allocation carved into whole entries
+ * (list node, info, key and value) by ht_put_packed(), instead of the five
+ * allocations of an ht_put(). The entries are still updated, moved and
+ * freed one at a time; the slab is freed with the last of them, once its
+ * creator released it.
+ *
+ * ht_slab_entry_size() is the room an entry takes (value_size 0 for the
+ * values that are not packed: encoded ones, or those of a table with a
+ * value_store or a value_log). ht_put_packed() takes length-explicit keys (see
+ * ht_put_encoded_len()); an entry that does not fit in the slab anymore, or
+ * whose key is already in the table, is put as ht_put_encoded_len() would.
+ */
+typedef struct ht_slab ht_slab;
+
+ht_slab *ht_slab_create(unsigned long long size);
+void ht_slab_release(ht_slab *slab);
+unsigned long long ht_slab_entry_size(unsigned int key_size,
+									  unsigned int value_size);
+void ht_put_packed(hashtable_t *ht, ht_slab *slab, const void *key,
+				   size_t key_len, const void *value, unsigned int value_size,
+				   unsigned char encoding);
+
+/*
+ * ht_reserve() - Grows the table up front so that it can hold no_entries
+ * entries with at most one per bucket on average (it never shrinks).
+ */
+void ht_reserve(hashtable_t *ht, unsigned int no_entries);
+
 void ht_free(hashtable_t *ht);
 unsigned int ht_get_size(hashtable_t *ht);
 unsigned int ht_get_hmax(hashtable_t *ht);
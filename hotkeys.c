@@ -0,0 +1,180 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#include "utils.h"
+#include "hotkeys.h"
+
+/* second, independent hash of a key (the rows use hash + i * hash2) */
+static unsigned int hotkeys_hash2(unsigned int hash)
+{
+	hash ^= hash >> 16;
+	hash *= 0x7feb352d;
+	hash ^= hash >> 15;
+	hash *= 0x846ca68b;
+	hash ^= hash >> 16;
+	return hash | 1;  // odd, so the rows never collide all together
+}
+
+hotkeys *hotkeys_create(unsigned int top_k, unsigned int hot_min,
+						void (*on_cool)(const char *key, size_t key_len,
+										void *ctx),
+						void *ctx)
+{
+	hotkeys *detector = calloc(1, sizeof(*detector));
+	DIE(!detector, "calloc() for *detector failed\n");
+
+	detector->top_k = top_k < HOTKEYS_MAX_TOP ? top_k : HOTKEYS_MAX_TOP;
+	detector->hot_min = hot_min;
+	detector->on_cool = on_cool;
+	detector->ctx = ctx;
+
+	return detector;
+}
+
+static void hotkey_swap(hotkey *a, hotkey *b)
+{
+	hotkey aux = *a;
+
+	*a = *b;
+	*b = aux;
+}
+
+/* restores the heap below a position whose count grew */
+static void hotkeys_sift_down(hotkeys *detector, unsigned int index)
+{
+	while (1) {
+		unsigned int smallest = index;
+		unsigned int left = 2 * index + 1, right = 2 * index + 2;
+
+		if (left < detector->no_top &&
+			detector->top[left].count < detector->top[smallest].count)
+			smallest = left;
+		if (right < detector->no_top &&
+			detector->top[right].count < detector->top[smallest].count)
+			smallest = right;
+		if (smallest == index)
+			return;
+
+		hotkey_swap(&detector->top[index], &detector->top[smallest]);
+		index = smallest;
+	}
+}
+
+static void hotkeys_sift_up(hotkeys *detector, unsigned int index)
+{
+	while (index) {
+		unsigned int parent = (index - 1) / 2;
+
+		if (detector->top[parent].count <= detector->top[index].count)
+			return;
+
+		hotkey_swap(&detector->top[index], &detector->top[parent]);
+		index = parent;
+	}
+}
+
+/* halves every count, so that keys which are no longer used cool down */
+static void hotkeys_decay(hotkeys *detector)
+{
+	for (int row = 0; row < HOTKEYS_DEPTH; row++)
+		for (int i = 0; i < HOTKEYS_WIDTH; i++)
+			detector->counters[row][i] >>= 1;
+
+	// halving keeps the heap order
+	for (unsigned int i = 0; i < detector->no_top; i++)
+		detector->top[i].count >>= 1;
+
+	detector->operations = 0;
+}
+
+int hotkeys_record(hotkeys *detector, const void *key, size_t key_len,
+				   unsigned int hash)
+{
+	unsigned int hash2 = hotkeys_hash2(hash);
+	unsigned int count = ~0u;
+
+	if (++detector->operations == HOTKEYS_WINDOW_FACTOR * HOTKEYS_WIDTH)
+		hotkeys_decay(detector);
+
+	// the estimate is the smallest of the incremented counters
+	for (int row = 0; row < HOTKEYS_DEPTH; row++) {
+		unsigned int *counter = &detector->counters[row]
+									[(hash + row * hash2) & (HOTKEYS_WIDTH - 1)];
+
+		if (*counter != ~0u)
+			(*counter)++;
+		if (*counter < count)
+			count = *counter;
+	}
+
+	// a key already in the heap has a count of at least the heap minimum,
+	// so most keys are rejected by one comparison
+	int full = detector->no_top == detector->top_k;
+	if (!detector->top_k || (full && count <= detector->top[0].count))
+		return 0;
+
+	for (unsigned int i = 0; i < detector->no_top; i++) {
+		hotkey *curr = &detector->top[i];
+
+		if (curr->hash == hash && curr->key_len == key_len &&
+			!memcmp(curr->key, key, key_len)) {
+			curr->count = count;
+			hotkeys_sift_down(detector, i);
+			return count >= detector->hot_min;
+		}
+	}
+
+	// the key takes the place of the coldest tracked key
+	char *copy = malloc(key_len + 1);
+	DIE(!copy, "malloc() for copy failed\n");
+	memcpy(copy, key, key_len);
+	copy[key_len] = 0;
+
+	if (full) {
+		if (detector->on_cool)
+			detector->on_cool(detector->top[0].key, detector->top[0].key_len,
+							  detector->ctx);
+		free(detector->top[0].key);
+
+		detector->top[0] = (hotkey){copy, key_len, hash, count};
+		hotkeys_sift_down(detector, 0);
+	} else {
+		detector->top[detector->no_top] = (hotkey){copy, key_len, hash,
+												   count};
+		hotkeys_sift_up(detector, detector->no_top++);
+	}
+
+	return count >= detector->hot_min;
+}
+
+static int compare_hotkeys(const void *a, const void *b)
+{
+	const hotkey *key_a = a;
+	const hotkey *key_b = b;
+
+	if (key_a->count != key_b->count)
+		return key_a->count < key_b->count ? 1 : -1;
+	return strcmp(key_a->key, key_b->key);
+}
+
+void hotkeys_print(hotkeys *detector, FILE *out)
+{
+	hotkey sorted[HOTKEYS_MAX_TOP];
+
+	memcpy(sorted, detector->top, detector->no_top * sizeof(*sorted));
+	qsort(sorted, detector->no_top, sizeof(*sorted), compare_hotkeys);
+
+	fprintf(out, "%10s %4s %s\n", "estimate", "hot", "key");
+	for (unsigned int i = 0; i < detector->no_top; i++)
+		fprintf(out, "%10u %4s %s\n", sorted[i].count,
+				sorted[i].count >= detector->hot_min ? "yes" : "no",
+				sorted[i].key);
+}
+
+void hotkeys_free(hotkeys *detector)
+{
+	if (!detector)
+		return;
+
+	for (unsigned int i = 0; i < detector->no_top; i++)
+		free(detector->top[i].key);
+	free(detector);
+}
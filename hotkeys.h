@@ -0,0 +1,77 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#ifndef HOTKEYS_H_
+#define HOTKEYS_H_
+
+#include <stdio.h>
+
+/*
+ * Streaming heavy-hitter detection: a count-min sketch estimates how often
+ * each key was seen (never less than the real count), and a min-heap keeps
+ * the HOTKEYS_MAX_TOP keys with the highest estimates. Every
+ * HOTKEYS_WINDOW_FACTOR * HOTKEYS_WIDTH operations all counts are halved,
+ * so keys that stop being accessed cool down.
+ *
+ * The memory used is fixed: HOTKEYS_DEPTH * HOTKEYS_WIDTH counters, and the
+ * heap (with a copy of each key).
+ */
+
+#define HOTKEYS_DEPTH 4
+#define HOTKEYS_WIDTH 4096  /* power of two */
+#define HOTKEYS_WINDOW_FACTOR 16
+#define HOTKEYS_MAX_TOP 64
+
+typedef struct hotkey hotkey;
+struct hotkey {
+	char *key;  /* copy of the key, followed by a '\0' */
+	size_t key_len;
+	unsigned int hash;
+	unsigned int count;  /* estimate when the key was last seen */
+};
+
+typedef struct hotkeys hotkeys;
+struct hotkeys {
+	unsigned int counters[HOTKEYS_DEPTH][HOTKEYS_WIDTH];
+	unsigned int top_k;  /* size of the heap */
+	unsigned int hot_min;  /* estimate from which a key in the heap is hot */
+	unsigned int operations;  /* since the last halving */
+
+	unsigned int no_top;
+	hotkey top[HOTKEYS_MAX_TOP];  /* min-heap by count */
+
+	/* called with a key that leaves the heap (e.g. to drop cached copies) */
+	void (*on_cool)(const char *key, size_t key_len, void *ctx);
+	void *ctx;
+};
+
+/**
+ * hotkeys_create() - Creates a detector.
+ *
+ * @arg1: Number of keys to track (at most HOTKEYS_MAX_TOP).
+ * @arg2: Estimate from which a tracked key is reported hot.
+ * @arg3: Optional callback for the keys that leave the tracked set.
+ * @arg4: Passed to on_cool().
+ */
+hotkeys *hotkeys_create(unsigned int top_k, unsigned int hot_min,
+						void (*on_cool)(const char *key, size_t key_len,
+										void *ctx),
+						void *ctx);
+
+/**
+ * hotkeys_record() - Counts one access to a key.
+ *
+ * @arg1: Detector.
+ * @arg2: Key (any bytes).
+ * @arg3: Length of the key, in bytes.
+ * @arg4: Hash of the key (hash_function_key_len()), computed by the caller.
+ *
+ * Return: 1 if the key is hot, 0 otherwise.
+ */
+int hotkeys_record(hotkeys *detector, const void *key, size_t key_len,
+				   unsigned int hash);
+
+/* hotkeys_print() - Prints the tracked keys, hottest first. */
+void hotkeys_print(hotkeys *detector, FILE *out);
+
+void hotkeys_free(hotkeys *detector);
+
+#endif  // HOTKEYS_H_
@@ -0,0 +1,172 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#define _POSIX_C_SOURCE 199309L
+#include <time.h>
+#include "utils.h"
+#include "latency.h"
+
+static const char *lat_op_names[LAT_OPS] = {
+	"store", "retrieve", "add_server", "remove_server"
+};
+
+/* histograms of every recording thread, merged on demand by lat_collect() */
+static lat_hist *lat_threads[LAT_MAX_THREADS];
+static unsigned int lat_no_threads;
+static __thread lat_hist *lat_local;
+
+unsigned long long lat_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static unsigned int lat_bucket_index(unsigned long long value)
+{
+	// small values have a bucket of their own
+	if (value < LAT_SUB_COUNT)
+		return (unsigned int)value;
+
+	// keep the top LAT_SUB_BITS + 1 bits of the value
+	unsigned int msb = 63 - __builtin_clzll(value);
+	unsigned int shift = msb - LAT_SUB_BITS;
+	unsigned int sub = (unsigned int)(value >> shift) - LAT_SUB_COUNT;
+
+	return (shift + 1) * LAT_SUB_COUNT + sub;
+}
+
+/* highest value that falls into the given bucket */
+static unsigned long long lat_bucket_value(unsigned int index)
+{
+	if (index < LAT_SUB_COUNT)
+		return index;
+
+	unsigned int shift = index / LAT_SUB_COUNT - 1;
+	unsigned long long sub = index % LAT_SUB_COUNT + LAT_SUB_COUNT;
+
+	return ((sub + 1) << shift) - 1;
+}
+
+void lat_hist_reset(lat_hist *hist)
+{
+	memset(hist, 0, sizeof(*hist));
+}
+
+void lat_hist_record(lat_hist *hist, unsigned long long value)
+{
+	hist->counts[lat_bucket_index(value)]++;
+	hist->sum += value;
+	if (!hist->total || value < hist->min)
+		hist->min = value;
+	if (value > hist->max)
+		hist->max = value;
+	hist->total++;
+}
+
+void lat_hist_merge(lat_hist *dst, const lat_hist *src)
+{
+	if (!src->total)
+		return;
+
+	for (unsigned int i = 0; i < LAT_BUCKETS; i++)
+		dst->counts[i] += src->counts[i];
+
+	if (!dst->total || src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	dst->sum += src->sum;
+	dst->total += src->total;
+}
+
+unsigned long long lat_hist_percentile(const lat_hist *hist, double fraction)
+{
+	if (!hist->total)
+		return 0;
+
+	// rank of the searched value (1-indexed)
+	unsigned long long rank = (unsigned long long)(fraction * hist->total);
+	if (rank < 1)
+		rank = 1;
+	if (rank > hist->total)
+		rank = hist->total;
+
+	unsigned long long seen = 0;
+	for (unsigned int i = 0; i < LAT_BUCKETS; i++) {
+		seen += hist->counts[i];
+		if (seen >= rank) {
+			unsigned long long value = lat_bucket_value(i);
+			return value < hist->max ? value : hist->max;
+		}
+	}
+
+	return hist->max;
+}
+
+void lat_record(lat_op op, unsigned long long ns)
+{
+	if (!lat_local) {
+		unsigned int slot = __atomic_fetch_add(&lat_no_threads, 1,
+											   __ATOMIC_RELAXED);
+		DIE(slot >= LAT_MAX_THREADS, "too many threads recording latencies");
+
+		lat_local = calloc(LAT_OPS, sizeof(lat_hist));
+		DIE(!lat_local, "calloc() for lat_local failed\n");
+		__atomic_store_n(&lat_threads[slot], lat_local, __ATOMIC_RELEASE);
+	}
+
+	lat_hist_record(&lat_local[op], ns);
+}
+
+void lat_collect(lat_hist *out)
+{
+	for (int op = 0; op < LAT_OPS; op++)
+		lat_hist_reset(&out[op]);
+
+	// the counters are read without stopping the writers, so a snapshot
+	// taken while other threads record may be off by a few samples
+	unsigned int no_threads = __atomic_load_n(&lat_no_threads,
+											  __ATOMIC_RELAXED);
+	for (unsigned int i = 0; i < no_threads && i < LAT_MAX_THREADS; i++) {
+		lat_hist *set = __atomic_load_n(&lat_threads[i], __ATOMIC_ACQUIRE);
+		if (!set)
+			continue;
+
+		for (int op = 0; op < LAT_OPS; op++)
+			lat_hist_merge(&out[op], &set[op]);
+	}
+}
+
+void lat_dump(FILE *out)
+{
+	lat_hist merged[LAT_OPS];
+
+	lat_collect(merged);
+
+	fprintf(out, "%-14s %10s %10s %10s %10s %10s %10s\n", "op(ns)", "count",
+			"avg", "p50", "p99", "p999", "max");
+	for (int op = 0; op < LAT_OPS; op++) {
+		lat_hist *hist = &merged[op];
+		if (!hist->total)
+			continue;
+
+		fprintf(out, "%-14s %10llu %10llu %10llu %10llu %10llu %10llu\n",
+				lat_op_names[op], hist->total, hist->sum / hist->total,
+				lat_hist_percentile(hist, 0.50),
+				lat_hist_percentile(hist, 0.99),
+				lat_hist_percentile(hist, 0.999), hist->max);
+	}
+}
+
+void lat_free(void)
+{
+	unsigned int no_threads = __atomic_load_n(&lat_no_threads,
+											  __ATOMIC_RELAXED);
+	for (unsigned int i = 0; i < no_threads && i < LAT_MAX_THREADS; i++) {
+		free(lat_threads[i]);
+		lat_threads[i] = NULL;
+	}
+
+	lat_no_threads = 0;
+	lat_local = NULL;
+}
@@ -0,0 +1,81 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include <stdio.h>
+
+/*
+ * Log-bucketed (HDR-style) latency histograms, one per operation type.
+ *
+ * Every power of two is split into 2^LAT_SUB_BITS linear sub-buckets, so a
+ * recorded value is kept with a relative error of at most 1 / 2^LAT_SUB_BITS
+ * (~3%) for any magnitude, in a fixed-size array of counters.
+ *
+ * Recording is compiled in only when LB_LATENCY is defined
+ * (`make LATENCY=1`); otherwise LAT_BEGIN()/LAT_END() expand to nothing.
+ */
+
+#define LAT_SUB_BITS 5
+#define LAT_SUB_COUNT (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS ((64 - LAT_SUB_BITS + 1) * LAT_SUB_COUNT)
+
+/* maximum number of threads that can record at the same time */
+#define LAT_MAX_THREADS 64
+
+typedef enum lat_op {
+	LAT_STORE,
+	LAT_RETRIEVE,
+	LAT_ADD_SERVER,
+	LAT_REMOVE_SERVER,
+	LAT_OPS
+} lat_op;
+
+typedef struct lat_hist lat_hist;
+struct lat_hist {
+	unsigned long long counts[LAT_BUCKETS];
+	unsigned long long total;  /* number of recorded values */
+	unsigned long long sum;  /* sum of recorded values (ns) */
+	unsigned long long min;
+	unsigned long long max;
+};
+
+/* monotonic clock, in nanoseconds */
+unsigned long long lat_now_ns(void);
+
+void lat_hist_reset(lat_hist *hist);
+void lat_hist_record(lat_hist *hist, unsigned long long value);
+void lat_hist_merge(lat_hist *dst, const lat_hist *src);
+
+/*
+ * lat_hist_percentile() - Returns the value below which the given fraction
+ * (0.0 - 1.0) of the recorded values fall, rounded up to its bucket.
+ */
+unsigned long long lat_hist_percentile(const lat_hist *hist, double fraction);
+
+/*
+ * lat_record() - Records a latency for an operation in the histograms of the
+ * calling thread (allocated and registered on the first call).
+ */
+void lat_record(lat_op op, unsigned long long ns);
+
+/*
+ * lat_collect() - Merges the histograms of every thread that has recorded
+ * something into out[LAT_OPS].
+ */
+void lat_collect(lat_hist *out);
+
+/* lat_dump() - Prints count/avg/p50/p99/p999/max for every operation. */
+void lat_dump(FILE *out);
+
+/* lat_free() - Releases the histograms of all threads. */
+void lat_free(void);
+
+#ifdef LB_LATENCY
+#define LAT_BEGIN(start) unsigned long long start = lat_now_ns()
+#define LAT_END(op, start) lat_record((op), lat_now_ns() - (start))
+#else
+#define LAT_BEGIN(start)
+#define LAT_END(op, start)
+#endif
+
+#endif  // LATENCY_H_
@@ -107,6 +107,44 @@ node_t* ll_remove_nth_node(list_t* list, unsigned int n)
 	return curr;
 }
 
+/*
+ * Links an existing node (and its data) at the beginning of the list;
+ * nothing is allocated or copied. The node must not belong to another list.
+ */
+void ll_link_head(list_t* list, node_t* node)
+{
+	if (!list || !node)
+		return;
+
+	node->next = list->head;
+	list->head = node;
+	list->size++;
+}
+
+/*
+ * Unlinks the node that follows prev (or the head of the list, if prev is
+ * NULL) and returns it; the node keeps its data, so it can be linked into
+ * another list with ll_link_head(). Returns NULL if there is no such node.
+ */
+node_t* ll_unlink_next(list_t* list, node_t* prev)
+{
+	if (!list)
+		return NULL;
+
+	node_t *curr = prev ? prev->next : list->head;
+	if (!curr)
+		return NULL;
+
+	if (prev)
+		prev->next = curr->next;
+	else
+		list->head = curr->next;
+
+	curr->next = NULL;
+	list->size--;
+	return curr;
+}
+
 /*
  * Function that frees the memory used by all nodes in the list, and at
  * the end, frees the memory used by the list structure and updates
@@ -27,6 +27,10 @@ list_t *ll_create(unsigned int data_size);
 
 void ll_add_nth_node(list_t* list, unsigned int n, const void* new_data);
 node_t *ll_remove_nth_node(list_t* list, unsigned int n);
+
+/* relinking of existing nodes, without copying their data */
+void ll_link_head(list_t* list, node_t* node);
+node_t *ll_unlink_next(list_t* list, node_t* prev);
 unsigned int ll_get_size(list_t* list);
 
 void ll_free(list_t** pp_list);
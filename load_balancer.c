@@ -1,6 +1,14 @@
 /* Copyright 2023 Munteanu Eugen 315CA */
 #include "load_balancer.h"
 #include "hashtable.h"
+#include "latency.h"
+#include "profile.h"
+#include "wal.h"
+#include "migration.h"
+#include "replication.h"
+#include "hotkeys.h"
+#include "hashring.h"
+#include "zones.h"
 
 unsigned int hash_function_servers(void *a) {
 	unsigned int uint_a = *((unsigned int *)a);
@@ -22,6 +30,11 @@ unsigned int hash_function_key(void *a) {
 	return hash;
 }
 
+unsigned int hash_function_key_len(const void *key, size_t key_len) {
+	// the hash of the servers' tables, which the entries keep
+	return hash_function_bytes(key, key_len);
+}
+
 load_balancer *init_load_balancer() {
 	// allocate new load balancer
 	load_balancer *new_load = calloc(1, sizeof(load_balancer));
@@ -31,29 +44,79 @@ load_balancer *init_load_balancer() {
 	new_load->servers = calloc(MAX_SERVERS, sizeof(server_memory *));
 	DIE(!(new_load->servers), "calloc() for new_load->servers failed\n");
 
-	new_load->hashring = calloc(REPLICAS, sizeof(int));
-	DIE(!(new_load->hashring), "calloc() for new_load->hashring failed\n");
+	hashring_init(&new_load->ring);
 
 	new_load->no_servers = 0;
-	new_load->no_hashring_points = 0;
-	new_load->max_no_hashring_points = REPLICAS;
+	new_load->replication = 1;
 
 	return new_load;
 }
 
+int hashring_find_index(load_balancer *main, unsigned int hash) {
+	// first server that hash_server >= hash, or the first server of the
+	// hashring (0 if there are no servers)
+	return hashring_find(&main->ring, hash);
+}
+
+int hashring_find_server(load_balancer *main, unsigned int hash) {
+	PROF_BEGIN(prof_start);
+	int server_id;
+
+	// in the zoned mode, the zone is found first, then its server
+	if (main->zones) {
+		server_id = zones_find_server(main->zones, hash);
+	} else {
+		// keep index in bounds (maximum 99999 servers); with no servers,
+		// the ID is 0
+		int label = hashring_owner(&main->ring, hash);
+
+		server_id = label < 0 ? 0 : label % MAX_SERVERS;
+	}
+
+	PROF_END(PROF_ROUTING, prof_start);
+	return server_id;
+}
+
+int hashring_arc_contains(unsigned int arc_start, unsigned int arc_end,
+						   unsigned int hash) {
+	unsigned int offset = hash - arc_start;
+
+	return offset && offset <= arc_end - arc_start;
+}
+
+/* an arc of the hashring handed over to another server */
+typedef struct arc_transfer arc_transfer;
+struct arc_transfer {
+	unsigned int arc_start;
+	unsigned int arc_end;
+	hashtable_t *dest;
+};
+
+/* the entries whose key falls inside the arc go to the new owner */
+static hashtable_t *arc_transfer_dest(info *entry, void *ctx) {
+	arc_transfer *transfer = (arc_transfer *)ctx;
+
+	if (hashring_arc_contains(transfer->arc_start, transfer->arc_end,
+							  entry->hash))
+		return transfer->dest;
+	return NULL;
+}
+
 void balance_load_balancer(load_balancer *main, int index, unsigned int label) {
-	// used for calculating the position of the neighbor server
-	unsigned int aux_index = 0;
-	// used for storing the position of the neighbor server in the hashring
+	// position of the new replica, then of its right neighbor
+	hashring_pos pos, next_pos;
+	// used for storing the ID of the neighbor server in the hashring
 	unsigned int next_server_index = 0;
 
 	// if we have at most one server in the system, we do nothing
-	if (main->no_hashring_points <= 1) {
+	if (main->ring.no_points <= 1) {
 		return;
 	} else {
-		// find the position of the right neighbor server for the current index
-		aux_index = (index + 1) % main->no_hashring_points;
-		next_server_index = main->hashring[aux_index] % MAX_SERVERS;
+		// find the right neighbor server of the current index
+		pos = hashring_at(&main->ring, index);
+		next_pos = pos;
+		hashring_next(&main->ring, &next_pos);
+		next_server_index = hashring_pos_label(next_pos) % MAX_SERVERS;
 	}
 
 	// if the current server (identified by label) is the same as the
@@ -61,120 +124,78 @@ void balance_load_balancer(load_balancer *main, int index, unsigned int label) {
 	if (label % MAX_SERVERS == next_server_index)
 		return;
 
-	// else, redistribute the elements to the next server on the right
-	for (int i = 0; i < HMAX; i++) {
-		if (main->servers[next_server_index]->memory->buckets[i] != NULL) {
-			// iterate the current bucket, element by element
-			server_memory *curr_server = main->servers[next_server_index];
-			node_t* curr_elem = curr_server->memory->buckets[i]->head;
-
-			while (curr_elem != NULL) {
-				// find the key-value pair for the current element
-				info *info = curr_elem->data;
-				char *key = (char *)info->key;
-				char *value = (char *)info->value;
-
-				// redistribute the content to the next server
-				server_store(main->servers[label % MAX_SERVERS], key, value);
+	// with several copies per key, the keys are re-replicated once all the
+	// replicas of the server are on the hashring (see replication.h)
+	if (main->replication > 1)
+		return;
 
-				curr_elem = curr_elem->next;
-			}
-		}
+	// the new replica takes over the arc (hash of the previous point,
+	// hash of the replica] from its right neighbor
+	hashring_pos prev_pos = pos;
+	hashring_prev(&main->ring, &prev_pos);
+	unsigned int arc_start = hashring_pos_hash(prev_pos);
+	unsigned int arc_end = hashring_pos_hash(pos);
+
+	// in lazy mode, only remember that the arc changed owner
+	if (main->lazy_migration) {
+		migration_add(main, next_server_index, label % MAX_SERVERS,
+					  arc_start, arc_end);
+		return;
 	}
-}
-
-void insert_at_position_in_hashring(load_balancer *main, int index,
-									unsigned int label) {
-	// insert the corresponding server, depending on the position
-
-	// 0-index case (at the beginning of the hashring)
-	if (index == 0) {
-		main->no_hashring_points++;
 
-		// iterate through hashring and shift servers to the right
-		for (int k = main->no_hashring_points - 1; k > index; k--)
-			main->hashring[k] = main->hashring[k - 1];
-
-		// insert the server itself at the respective position
-		main->hashring[index] = label;
-	} else {
-		// last-index case (at the end of the hashring)
-		if (index == main->no_hashring_points) {
-			main->no_hashring_points++;
-			main->hashring[index] = label;
-
-		// between-two-consecutive-servers-index case
-		} else {
-			main->no_hashring_points++;
-			// iterate through hashring and shift servers to the right
-			for (int k = main->no_hashring_points - 1; k > index - 1; k--)
-				main->hashring[k] = main->hashring[k - 1];
-
-			// insert the server itself at the respective position
-			main->hashring[index] = label;
-		}
-	}
+	// else, relink the entries of the arc from the neighbor server
+	// to the new one (no key or value is copied)
+	PROF_BEGIN(prof_start);
+	arc_transfer transfer = {arc_start, arc_end,
+							 main->servers[label % MAX_SERVERS]->memory};
+	ht_move_entries(main->servers[next_server_index]->memory,
+					arc_transfer_dest, &transfer);
+	PROF_END(PROF_MIGRATION, prof_start);
 }
 
 void add_to_hashring(load_balancer *main, unsigned int label,
 						unsigned int hash_label) {
-	int start = 0;
-	int end = main->no_hashring_points - 1;
-	int index = -1;
-
-	// iterate through hashring (binary search);
-	// search for index in hashring where the server will be added
-	while (start <= end) {
-		int mid = start + (end - start) / 2;  // avoid overflow
-		int curr_server_value = main->hashring[mid];
-
-		if (hash_label > hash_function_servers(&curr_server_value)) {
-			start = mid + 1;
-		} else {
-			index = mid;
-			end = mid - 1;
-		}
-	}
-
-	// if we have no servers, we will add the server on the first position
-	if (index == -1 && !(main->no_hashring_points))
-		index = 0;
-
-	// if we did not find the index but we have servers, add the server at
-	// the end of the hashring (last index + 1)
-	if (index == -1 && main->no_hashring_points)
-		index = main->no_hashring_points;
+	// insert the server itself at its position (the hashring keeps the
+	// points sorted by hash), then redistribute the data in the system
+	// uniformly (balance_load_balancer())
+	int index = hashring_insert(&main->ring, label, hash_label);
 
-	index = index % MAX_SERVERS;  // maximum 99999 servers
-
-	// next, insert the server itself at the found position, then
-	// redistribute the data in the system uniformly (balance_load_balancer())
-	insert_at_position_in_hashring(main, index, label);
 	balance_load_balancer(main, index, label);
 }
 
-void loader_add_server(load_balancer* main, int server_id) {
-	// if the maximum number of servers in the system has been reached,
-	// reallocate the memory for the servers array accordingly
-	if ((main->no_hashring_points != REPLICAS * MAX_SERVERS) &&
-		(main->no_hashring_points + REPLICAS > main->max_no_hashring_points)) {
-		// double capacity
-		main->max_no_hashring_points *= 2;
-
-		// check server limit
-		if (main->max_no_hashring_points > REPLICAS * MAX_SERVERS) {
-			main->max_no_hashring_points = REPLICAS * MAX_SERVERS;
-		}
-		main->hashring = realloc(main->hashring,
-								 main->max_no_hashring_points * sizeof(int));
-	}
-
-	// init new server
+server_memory *loader_init_server(load_balancer *main, int server_id) {
 	server_memory *new_server = init_server_memory();
 
 	// add server in servers array and update no. of servers
 	main->servers[server_id % MAX_SERVERS] = new_server;
 	main->no_servers++;
+	new_server->budget = main->server_budget;
+	server_set_compression(new_server, main->codec, main->compress_min);
+	new_server->memory->values = main->values;
+	new_server->memory->expiry = &main->expiring;
+	if (main->value_logs)
+		new_server->memory->log = value_log_create(main->value_logs);
+
+	return new_server;
+}
+
+void loader_add_server(load_balancer* main, int server_id) {
+	LAT_BEGIN(lat_start);
+
+	if (main->wal)
+		main->wal_lsn = wal_log_server(main->wal, WAL_ADD_SERVER, server_id);
+
+	// in the zoned mode, only the ring of the server's zone changes
+	if (main->zones) {
+		loader_add_server_to_zone(main, server_id,
+								  server_id % main->zones->default_zones);
+
+		LAT_END(LAT_ADD_SERVER, lat_start);
+		return;
+	}
+
+	// init new server
+	server_memory *new_server = loader_init_server(main, server_id);
 
 	// generate no. of replicas for a server, as well as the hash of each one
 	unsigned int labels[REPLICAS] = {0};
@@ -185,79 +206,139 @@ void loader_add_server(load_balancer* main, int server_id) {
 		hash_labels[i] = hash_function_servers(&labels[i]);
 	}
 
-	// next, for adding the server in the hashring, we will use several functions:
-	//   add_to_hashring(), which will call at the end successively:
-	//   insert_at_position_in_hashring(), and balance_load_balancer()
+	// next, for adding the server in the hashring, we will use
+	//   add_to_hashring(), which inserts each replica, then calls
+	//   balance_load_balancer()
 	for (int i = 0; i < REPLICAS; i++)
 		add_to_hashring(main, labels[i], hash_labels[i]);
+
+	if (main->replication > 1)
+		replication_add_server(main, server_id);
+
+	// the keys taken over from the neighbors may exceed the budget
+	server_fit_budget(new_server);
+
+	LAT_END(LAT_ADD_SERVER, lat_start);
 }
 
-void erase_at_position_in_hashring(load_balancer *main, int index) {
-	// delete the corresponding server, depending on the position
-	// 0-index case (at the beginning of the hashring)
-	if (index == 0) {
-		// iterate through hashring and shift servers to the left
-		for (int k = index; k < main->no_hashring_points - 1; k++)
-			main->hashring[k] = main->hashring[k + 1];
+/* a key that leaves the tracked set is no longer served by the front cache */
+static void front_cache_cool(const char *key, size_t key_len, void *ctx) {
+	load_balancer *main = (load_balancer *)ctx;
 
-		main->no_hashring_points--;
+	ht_remove_entry_len(main->front_cache, key, key_len);
+}
 
-	// last-index case (at the end of the hashring)
-	} else {
-		if (index == main->no_hashring_points) {
-			main->no_hashring_points--;
+/* counts a store, whose key must not be read from an older front copy */
+static void front_cache_invalidate(load_balancer *main, const void *key,
+								   size_t key_len, unsigned int hash) {
+	hotkeys_record(main->hotkeys, key, key_len, hash);
+	ht_remove_entry_len(main->front_cache, key, key_len);
+}
 
-		// between-two-consecutive-servers-index case
-		} else {
-			// iterate through hashring and shift servers to the left
-			for (int k = index; k < main->no_hashring_points - 1; k++)
-				main->hashring[k] = main->hashring[k + 1];
+/* copies a hot key (with its expiry) from the server that was read */
+static void front_cache_promote(load_balancer *main, const void *key,
+								size_t key_len, const char *value,
+								size_t value_len, int server_id) {
+	info *entry = ht_get_entry_len(main->servers[server_id]->memory, key,
+								   key_len);
+	unsigned long long expires = 0;
 
-			main->no_hashring_points--;
-		}
-	}
+	if (entry && entry->timer)
+		expires = entry->timer->expires;
+
+	ht_put_encoded_len(main->front_cache, key, key_len, value, value_len,
+					   expires, 0);
 }
 
-void delete_from_hashring(load_balancer *main, unsigned int hash_label) {
-	int start = 0;
-	int end = main->no_hashring_points - 1;
-	int index = -1;
-
-	// iterate through hashring (binary search)
-	while (start <= end) {
-		int mid = start + (end - start) / 2;  // avoid overflow
-		int curr_server_value = main->hashring[mid];
-
-		if (hash_label > hash_function_servers(&curr_server_value)) {
-			start = mid + 1;
-		} else {
-			if (hash_label < hash_function_servers(&curr_server_value)) {
-				index = mid;
-				end = mid - 1;
-			} else {
-				index = mid;
-				break;
-			}
-		}
-	}
+void loader_enable_hot_keys(load_balancer *main, unsigned int top_k,
+							unsigned int hot_min) {
+	hotkeys_free(main->hotkeys);
+	ht_free(main->front_cache);
+
+	main->hotkeys = hotkeys_create(top_k, hot_min, front_cache_cool, main);
+	main->front_cache = ht_create(HMAX, hash_function_string,
+								  compare_function_strings,
+								  key_val_free_function);
+	main->front_hits = 0;
+}
+
+void loader_print_hot_keys(load_balancer *main, FILE *out) {
+	if (!main->hotkeys)
+		return;
+
+	hotkeys_print(main->hotkeys, out);
+	fprintf(out, "front cache: %u keys, %llu reads answered\n",
+			ht_get_size(main->front_cache), main->front_hits);
+}
 
-	// if we have no servers, we will delete the first server
-	if (index == -1 && !(main->no_hashring_points))
-		index = 0;
+/*
+ * Stores a pair (that expires at the given tick, if not 0) on the server
+ * responsible for it and returns its ID.
+ */
+static int store_on_hashring(load_balancer *main, const void *key,
+							 size_t key_len, const void *value,
+							 size_t value_len, unsigned long long expires) {
+	// find hash value for the received key, then the server responsible
+	// for it
+	unsigned int hash_value = hash_function_key_len(key, key_len);
 
-	// if we did not find the index but we have servers, delete the server at
-	// the end of the hashring (last index + 1)
-	if (index == -1 && main->no_hashring_points)
-		index = main->no_hashring_points;
+	if (main->hotkeys)
+		front_cache_invalidate(main, key, key_len, hash_value);
 
-	index = index % MAX_SERVERS;  // maximum 99999 servers
+	if (main->replication > 1)
+		return replication_store(main, key, key_len, hash_value, value,
+								 value_len, expires);
+
+	int server_index = hashring_find_server(main, hash_value);
+
+	ht_set_clock(main->servers[server_index]->memory, main->now);
+	server_store_len(main->servers[server_index], key, key_len, value,
+					 value_len, expires);
+
+	// an older copy may still wait to be moved from a previous owner
+	if (main->migrations)
+		migration_forget(main, key, key_len, hash_value, server_index);
+
+	return server_index;
+}
+
+/*
+ * The arcs of a removed server: every key it holds lies in the arc of one
+ * of its replicas, and goes to the server that inherits that arc.
+ */
+typedef struct ring_drain ring_drain;
+struct ring_drain {
+	unsigned int arc_ends[REPLICAS];  /* replica hashes, sorted */
+	server_memory *heirs[REPLICAS];
+};
+
+/* the heir of the first replica at or after the key (circular vector) */
+static hashtable_t *ring_drain_dest(info *entry, void *ctx) {
+	ring_drain *drain = (ring_drain *)ctx;
+	unsigned int hash = entry->hash;
+
+	for (int i = 0; i < REPLICAS; i++)
+		if (hash <= drain->arc_ends[i])
+			return drain->heirs[i]->memory;
+	return drain->heirs[0]->memory;
+}
 
-	// next, delete the server from the system at the found position,
-	// using a helper function
-	erase_at_position_in_hashring(main, index);
+void delete_from_hashring(load_balancer *main, unsigned int hash_label) {
+	// the point with this hash leaves the hashring (if it is on it)
+	hashring_erase(&main->ring, hash_label);
 }
 
 void loader_remove_server(load_balancer* main, int server_id) {
+	LAT_BEGIN(lat_start);
+
+	if (main->wal)
+		main->wal_lsn = wal_log_server(main->wal, WAL_REMOVE_SERVER,
+									   server_id);
+
+	// the removed server may still be the source or the owner of keys
+	// that did not move yet, so the pending migrations are completed first
+	loader_migrate_all(main);
+
 	// generate 3 replicas for a server, as well as the hash of each one
 	unsigned int labels[REPLICAS] = {0};
 	unsigned int hash_labels[REPLICAS] = {0};
@@ -267,116 +348,295 @@ void loader_remove_server(load_balancer* main, int server_id) {
 		hash_labels[i] = hash_function_servers(&labels[i]);
 	}
 
-	// delete current server replicas from the hashring
-	for (int i = 0; i < REPLICAS; i++)
+	// delete current server replicas from the hashring (from the ring of
+	// its zone, in the zoned mode)
+	for (int i = 0; i < REPLICAS && !main->zones; i++)
 		delete_from_hashring(main, hash_labels[i]);
 
-	// redistribute the elements for the next server
-	for (int i = 0; i < HMAX; i++) {
-		if (main->servers[server_id]->memory->buckets[i] != NULL) {
-		   server_memory *curr_server = main->servers[server_id];
-			node_t* curr_elem = curr_server->memory->buckets[i]->head;
-
-			while (curr_elem != NULL) {
-				// find the key-value pair for the current element
-				info *info = curr_elem->data;
-				char *key = (char *)info->key;
-				char *value = (char *)info->value;
-
-				// redistribute all the data stored on the deleted server
-				int aux_server_id = server_id;
-				loader_store(main, key, value, &aux_server_id);
-
-				curr_elem = curr_elem->next;
+	// the arc of each deleted replica is inherited by the next point left
+	// on the hashring; the heirs are found once, then every entry of the
+	// deleted server is relinked to its heir in a single pass (if servers
+	// are left to take it)
+	if (main->zones) {
+		zones_remove_server(main, server_id);
+	} else if (main->replication > 1) {
+		replication_remove_server(main, server_id);
+	} else if (main->ring.no_points) {
+		ring_drain drain;
+
+		for (int i = 0; i < REPLICAS; i++) {
+			unsigned int hash = hash_labels[i];
+			int k = i;
+
+			// insertion sort of the (few) replica hashes
+			for (; k > 0 && drain.arc_ends[k - 1] > hash; k--) {
+				drain.arc_ends[k] = drain.arc_ends[k - 1];
+				drain.heirs[k] = drain.heirs[k - 1];
 			}
+			drain.arc_ends[k] = hash;
+			drain.heirs[k] = main->servers[hashring_find_server(main, hash)];
 		}
+
+		PROF_BEGIN(prof_start);
+		ht_move_entries(main->servers[server_id]->memory, ring_drain_dest,
+						&drain);
+		PROF_END(PROF_MIGRATION, prof_start);
+
+		// the heirs may now be over their memory budget
+		for (int i = 0; i < REPLICAS; i++)
+			server_fit_budget(drain.heirs[i]);
 	}
 
 	// free deleted server memory
 	free_server_memory(main->servers[server_id]);
 	main->servers[server_id] = NULL;
+	main->no_servers--;
+
+	LAT_END(LAT_REMOVE_SERVER, lat_start);
 }
 
 void loader_store(load_balancer *main, char *key, char *value, int *server_id) {
-	// find hash value for the received key
-	unsigned int hash_value = hash_function_key(key);
-	int index = -1;
+	// the value is stored with its null terminator
+	loader_store_len(main, key, strlen(key), value, strlen(value) + 1,
+					 server_id);
+}
 
-	if (main->no_hashring_points == 0) {
-		// if there are no servers, add pair to first server
-		index = 0;
-	} else {
-		// if the hash value is greater than the last server's hash value,
-		// add the pair to the first server (circular vector)
-		int last_server = main->hashring[main->no_hashring_points - 1];
-		if (hash_function_servers(&last_server) < hash_value) {
-			index = 0;
-		} else {
-			// else, find first server that hash_server >= hash_value
-			int start = 0;
-			int end = main->no_hashring_points - 1;
-
-			// iterate through hashring (binary search)
-			while (start <= end) {
-				int mid = start + (end - start) / 2;  // avoid overflow
-				int server_value = main->hashring[mid];
-				if (hash_value > hash_function_servers(&server_value)) {
-					start = mid + 1;
-				} else {
-					end = mid - 1;
-					index = mid;
-				}
-			}
-		}
+void loader_store_ttl(load_balancer *main, char *key, char *value,
+					  unsigned long long ttl, int *server_id) {
+	loader_store_ttl_len(main, key, strlen(key), value, strlen(value) + 1,
+						 ttl, server_id);
+}
+
+void loader_store_len(load_balancer *main, const void *key, size_t key_len,
+					  const void *value, size_t value_len, int *server_id) {
+	LAT_BEGIN(lat_start);
+
+	if (main->wal)
+		main->wal_lsn = wal_log_store(main->wal, key, key_len, value,
+									  value_len);
+
+	// add pair to the responsible server and return the server ID
+	*server_id = store_on_hashring(main, key, key_len, value, value_len, 0);
+
+	LAT_END(LAT_STORE, lat_start);
+}
+
+void loader_store_ttl_len(load_balancer *main, const void *key,
+						  size_t key_len, const void *value, size_t value_len,
+						  unsigned long long ttl, int *server_id) {
+	if (!ttl) {
+		loader_store_len(main, key, key_len, value, value_len, server_id);
+		return;
 	}
 
-	// keep index in bounds (maximum 99999 servers)
-	int server_index = main->hashring[index] % MAX_SERVERS;
+	LAT_BEGIN(lat_start);
 
-	// finally, add pair to the found server and return the server ID
-	server_store(main->servers[server_index], key, value);
-	*server_id = server_index;
+	// logged with the clock, so that a replay knows when the key expires
+	// (and removes it, rather than restore the value it overwrote)
+	if (main->wal)
+		main->wal_lsn = wal_log_store_ttl(main->wal, key, key_len, value,
+										  value_len, main->now,
+										  main->now + ttl);
+
+	*server_id = store_on_hashring(main, key, key_len, value, value_len,
+								   main->now + ttl);
+
+	LAT_END(LAT_STORE, lat_start);
+}
+
+void loader_remove_len(load_balancer *main, const void *key, size_t key_len) {
+	unsigned int hash_value = hash_function_key_len(key, key_len);
+
+	if (main->hotkeys)
+		front_cache_invalidate(main, key, key_len, hash_value);
+
+	if (main->replication > 1) {
+		int server_ids[MAX_REPLICATION];
+		int count = hashring_preference_list(main, hash_value, server_ids,
+							main->replication < MAX_REPLICATION ?
+							main->replication : MAX_REPLICATION);
+
+		for (int i = 0; i < count; i++)
+			server_remove_len(main->servers[server_ids[i]], key, key_len);
+		return;
+	}
+
+	int server_index = hashring_find_server(main, hash_value);
+
+	server_remove_len(main->servers[server_index], key, key_len);
+	if (main->migrations)
+		migration_forget(main, key, key_len, hash_value, server_index);
+}
+
+unsigned int loader_tick(load_balancer *main, unsigned long long now) {
+	if (now > main->now)
+		main->now = now;
+
+	// only the servers with timers armed are visited (zoned mode included)
+	return ht_expire_list(&main->expiring, main->now);
+}
+
+void loader_background_step(load_balancer *main) {
+	// move a few of the keys left behind by lazily added servers
+	if (main->migrations)
+		loader_migrate_step(main, MIGRATION_STEP_BUDGET);
+	// and reclaim a bit of the space of the values overwritten
+	if (main->value_logs)
+		value_log_compact(main->value_logs, VALUE_LOG_STEP_BUDGET);
+	// commit the logged group whose deadline passed
+	DIE(wal_tick(main->wal, lat_now_ns()), "wal_tick() failed");
+}
+
+void loader_print_server_stats(load_balancer *main, FILE *out) {
+	fprintf(out, "%8s %10s %12s %12s %10s %10s %8s %10s %10s\n", "server",
+			"keys", "bytes", "budget", "hits", "misses", "hit%", "evicted",
+			"expired");
+
+	for (int i = 0; i < MAX_SERVERS; i++) {
+		if (!main->servers[i])
+			continue;
+
+		server_memory *server = main->servers[i];
+		unsigned long long lookups = server->hits + server->misses;
+
+		fprintf(out, "%8d %10u %12llu %12llu %10llu %10llu %7.2f%% %10llu "
+				"%10llu\n", i, ht_get_size(server->memory),
+				server->memory->bytes, server->budget, server->hits,
+				server->misses, lookups ? 100.0 * server->hits / lookups : 0.0,
+				server->evicted, server->memory->expired);
+	}
+
+	value_codec *codec = main->codec;
+	if (codec && codec->compressed)
+		fprintf(out, "compression: %llu values, %llu bytes stored as %llu "
+				"(%.2fx), dictionary of %u bytes\n", codec->compressed,
+				codec->raw_bytes, codec->stored_bytes,
+				(double)codec->raw_bytes / codec->stored_bytes,
+				codec->dict_size);
+
+	value_store *values = main->values;
+	if (values && values->refs)
+		fprintf(out, "deduplication: %llu values, %u distinct (%llu bytes), "
+				"%llu bytes shared\n", values->refs, values->no_values,
+				values->bytes, values->shared_bytes);
+
+	value_log_group *logs = main->value_logs;
+	if (logs)
+		fprintf(out, "value log: %u segments, %llu bytes mapped, %llu live, "
+				"%llu bytes moved by compaction (%llu segments freed)\n",
+				logs->no_segments, logs->mapped_bytes, logs->live_bytes,
+				logs->relocated_bytes, logs->compacted);
+}
+
+void loader_enable_compression(load_balancer *main, unsigned int min_size) {
+	if (!main->codec)
+		main->codec = codec_create();
+	main->compress_min = min_size;
+
+	for (int i = 0; i < MAX_SERVERS; i++)
+		server_set_compression(main->servers[i], main->codec, min_size);
+}
+
+void loader_enable_dedup(load_balancer *main) {
+	if (!main->values)
+		main->values = value_store_create();
+
+	for (int i = 0; i < MAX_SERVERS; i++)
+		if (main->servers[i])
+			main->servers[i]->memory->values = main->values;
+}
+
+int loader_enable_value_log(load_balancer *main, const char *dir) {
+	if (!main->value_logs) {
+		main->value_logs = value_log_group_create(dir);
+		if (!main->value_logs)
+			return -1;
+	}
+
+	for (int i = 0; i < MAX_SERVERS; i++)
+		if (main->servers[i] && !main->servers[i]->memory->log)
+			main->servers[i]->memory->log =
+				value_log_create(main->value_logs);
+
+	return 0;
+}
+
+void loader_set_server_budget(load_balancer *main, unsigned long long budget) {
+	main->server_budget = budget;
+
+	for (int i = 0; i < MAX_SERVERS; i++)
+		server_set_budget(main->servers[i], budget);
 }
 
 char* loader_retrieve(load_balancer* main, char* key, int* server_id) {
-	// find hash value for the received key
-	unsigned int hash_value = hash_function_key(key);
-	int index = -1;
+	return loader_retrieve_len(main, key, strlen(key), NULL, server_id);
+}
 
-	if (main->no_hashring_points == 0) {
-		// if there are no servers, first server is found
-		index = 0;
-	} else {
-		// if hash_value >= hash_value_last_server,
-		// search for the pair in the first server (circular vector)
-		int last_server = main->hashring[main->no_hashring_points - 1];
-		if (hash_function_servers(&last_server) < hash_value) {
-			index = 0;
-		} else {
-			// else find first server that hash_server >= hash_value
-			int start = 0;
-			int end = main->no_hashring_points - 1;
-
-			// iterate through hashring (binary search)
-			while (start <= end) {
-				int mid = start + (end - start) / 2;  // avoid overflow
-				int server_value = main->hashring[mid];
-				if (hash_value > hash_function_servers(&server_value)) {
-					start = mid + 1;
-				} else {
-					end = mid - 1;
-					index = mid;
-				}
-			}
+char *loader_retrieve_len(load_balancer *main, const void *key,
+						  size_t key_len, size_t *value_len, int *server_id) {
+	LAT_BEGIN(lat_start);
+
+	// find hash value for the received key, then the server responsible
+	// for it
+	unsigned int hash_value = hash_function_key_len(key, key_len);
+	size_t found_len = 0;
+	int hot = 0;
+
+	if (!value_len)
+		value_len = &found_len;
+
+	// a hot key is answered by its front copy, if there is one
+	if (main->hotkeys &&
+		hotkeys_record(main->hotkeys, key, key_len, hash_value)) {
+		ht_set_clock(main->front_cache, main->now);
+		info *entry = ht_get_entry_len(main->front_cache, key, key_len);
+
+		if (entry) {
+			*server_id = hashring_find_server(main, hash_value);
+			*value_len = entry->value_size;
+			main->front_hits++;
+
+			LAT_END(LAT_RETRIEVE, lat_start);
+			return entry->value;
 		}
+		hot = 1;
 	}
 
-	// keep index in bounds (maximum 99999 servers)
-	int server_index = main->hashring[index] % MAX_SERVERS;
+	// with several copies per key, the reads are spread over them
+	if (main->replication > 1) {
+		char *value = replication_retrieve(main, key, key_len, hash_value,
+										   value_len, server_id);
+		if (hot && value)
+			front_cache_promote(main, key, key_len, value, *value_len,
+								*server_id);
 
-	// return the key-pair value of the found server
+		LAT_END(LAT_RETRIEVE, lat_start);
+		return value;
+	}
+
+	int server_index = hashring_find_server(main, hash_value);
+
+	// return the key-pair value of the found server; a key that was not
+	// moved to the server yet is brought from its previous owner
 	*server_id = server_index;
-	return server_retrieve(main->servers[server_index], key);
+	ht_set_clock(main->servers[server_index]->memory, main->now);
+	char *value = server_retrieve_len(main->servers[server_index], key,
+									  key_len, value_len);
+	if (!value && main->migrations)
+		value = migration_fetch(main, key, key_len, hash_value, server_index,
+								value_len);
+
+	if (value)
+		main->servers[server_index]->hits++;
+	else
+		main->servers[server_index]->misses++;
+
+	if (hot && value)
+		front_cache_promote(main, key, key_len, value, *value_len,
+							server_index);
+
+	LAT_END(LAT_RETRIEVE, lat_start);
+	return value;
 }
 
 void free_load_balancer(load_balancer *main) {
@@ -384,6 +644,10 @@ void free_load_balancer(load_balancer *main) {
 	if (!main)
 		return;
 
+	migration_free(main);
+	hotkeys_free(main->hotkeys);
+	ht_free(main->front_cache);
+	zones_free(main->zones);
 	for (int i = 0; i < MAX_SERVERS; i++)
 		if (main->servers[i]) {
 			free_server_memory(main->servers[i]);
@@ -394,10 +658,14 @@ void free_load_balancer(load_balancer *main) {
 		free(main->servers);
 		main->servers = NULL;
 	}
-	if (main->hashring) {
-		free(main->hashring);
-		main->hashring = NULL;
-	}
+	hashring_free(&main->ring);
+	codec_free(main->codec);
+	main->codec = NULL;
+	// the servers released their values above
+	value_store_free(main->values);
+	main->values = NULL;
+	value_log_group_free(main->value_logs);
+	main->value_logs = NULL;
 
 	if (main) {
 		free(main);
@@ -2,11 +2,18 @@
 #ifndef LOAD_BALANCER_H_
 #define LOAD_BALANCER_H_
 
+#include <stdio.h>
 #include "server.h"
+#include "hashring.h"
 
 #define MAX_SERVERS 100000
 #define REPLICAS 3
 
+struct wal;
+struct migration;
+struct hotkeys;
+struct zone_map;
+
 struct load_balancer;
 typedef struct load_balancer load_balancer;
 struct load_balancer {
@@ -15,15 +22,84 @@ struct load_balancer {
 
 	/*
 	 * We use an imaginary circle hashring;
-	 * we will have a sorted circular vector.
+	 * the points are kept sorted by hash (in a B+-tree, see hashring.h).
 	 * Each server will have 3 points on this circle
 	 * (3 replicas for each server in the system).
 	 */
-	int no_hashring_points;
-	int max_no_hashring_points;
-	int *hashring;
+	hashring ring;
+
+	/* optional write-ahead log of the store/add/remove operations */
+	struct wal *wal;
+	/* sequence number of the last logged (or replayed) operation */
+	unsigned long long wal_lsn;
+
+	/*
+	 * When set, added servers take over their arcs without moving any key;
+	 * the keys follow on access or through loader_migrate_step()
+	 * (see migration.h). Pending migrations are queued oldest first.
+	 */
+	int lazy_migration;
+	struct migration *migrations;
+	struct migration *migrations_tail;
+	unsigned long long moved_on_access;
+	unsigned long long moved_in_background;
+
+	/*
+	 * Current time, in ticks, for the keys stored with a TTL (advanced by
+	 * loader_tick()), and the servers' tables that hold such keys.
+	 */
+	unsigned long long now;
+	ht_expiry_list expiring;
+
+	/* memory budget of every server, in bytes (0: unlimited) */
+	unsigned long long server_budget;
+
+	/* copies of each key (see replication.h), round-robin read counter */
+	int replication;
+	unsigned long long next_read;
+
+	/*
+	 * Optional hot-key detection (see loader_enable_hot_keys()): the keys
+	 * reported hot are read from a small front cache, until they cool down.
+	 */
+	struct hotkeys *hotkeys;
+	hashtable_t *front_cache;
+	unsigned long long front_hits;
+
+	/* codec shared by the servers, size from which values are compressed */
+	value_codec *codec;
+	unsigned int compress_min;
+
+	/* optional store of the values, shared by the servers (deduplication) */
+	value_store *values;
+
+	/*
+	 * Optional off-heap storage of the values: every server appends them to
+	 * a log of its own, whose segments are compacted between the requests
+	 * (see value_log.h).
+	 */
+	value_log_group *value_logs;
+
+	/*
+	 * Two-level hashring of the zoned mode (see zones.h); when set, the
+	 * hashring above stays empty.
+	 */
+	struct zone_map *zones;
 };
 
+/* hash of a replica label, which gives its position on the hashring */
+unsigned int hash_function_servers(void *a);
+
+/* hash of a key (string), which gives its position on the hashring */
+unsigned int hash_function_key(void *a);
+
+/*
+ * hash_function_key_len() - Hash of a length-explicit key (that of the
+ * string for its characters); the servers' tables hash their keys the same
+ * way, so an entry's stored hash (info->hash) is its position on the ring.
+ */
+unsigned int hash_function_key_len(const void *key, size_t key_len);
+
 /**
  * init_load_balancer() - initializes the memory for a new load balancer and
  *                        its fields and returns a pointer to it.
@@ -59,6 +135,150 @@ void free_load_balancer(load_balancer *main);
  */
 void loader_store(load_balancer *main, char *key, char *value, int *server_id);
 
+/**
+ * loader_store_ttl() - Same as loader_store(), for a pair that expires
+ *                      `ttl` ticks after main->now (0: never).
+ *
+ * Keys with a TTL are volatile: they are not written to the write-ahead
+ * log nor to snapshots.
+ */
+void loader_store_ttl(load_balancer *main, char *key, char *value,
+					  unsigned long long ttl, int *server_id);
+
+/**
+ * loader_store_len() - loader_store() of a length-explicit pair.
+ *
+ * The key and the value are any bytes ('\0' included), hashed, compared
+ * and copied by their lengths; loader_store() calls it with the characters
+ * of the key and the whole string of the value (terminator included).
+ *
+ * @arg1: Load balancer which distributes the work.
+ * @arg2: Key.
+ * @arg3: Length of the key, in bytes.
+ * @arg4: Value.
+ * @arg5: Length of the value, in bytes.
+ * @arg6: Returns the ID of the server which stores the pair.
+ */
+void loader_store_len(load_balancer *main, const void *key, size_t key_len,
+					  const void *value, size_t value_len, int *server_id);
+
+/* loader_store_ttl_len() - loader_store_ttl() of a length-explicit pair. */
+void loader_store_ttl_len(load_balancer *main, const void *key,
+						  size_t key_len, const void *value, size_t value_len,
+						  unsigned long long ttl, int *server_id);
+
+/*
+ * loader_remove_len() - Removes a key from every server that holds it (its
+ * copies, and a copy still waiting for a lazy migration). Used by the
+ * replay of the write-ahead log, so it is not logged itself.
+ */
+void loader_remove_len(load_balancer *main, const void *key, size_t key_len);
+
+/**
+ * loader_tick() - Advances the time of the system and frees the entries
+ *                 that expired by then.
+ *
+ * Each server keeps its timers in a hierarchical timer wheel, and only the
+ * servers with timers armed are ticked (main->expiring), so a tick costs
+ * the expired entries, not the size of the cluster; a lookup that finds an
+ * expired entry before the next tick frees it too.
+ *
+ * @arg1: Load balancer.
+ * @arg2: Current time, in ticks (never goes back).
+ *
+ * Return: the number of entries that expired.
+ */
+unsigned int loader_tick(load_balancer *main, unsigned long long now);
+
+/*
+ * loader_background_step() - The work done between two requests and while
+ * the server is idle: a few of the keys left behind by lazily added servers
+ * are moved, a bit of the space of the values overwritten is reclaimed and
+ * the logged group whose deadline passed is committed.
+ */
+void loader_background_step(load_balancer *main);
+
+/*
+ * loader_print_server_stats() - Prints the counters of every server: keys,
+ * memory used and budget, hits, misses and hit ratio of the lookups,
+ * evicted and expired entries.
+ */
+void loader_print_server_stats(load_balancer *main, FILE *out);
+
+/**
+ * loader_enable_compression() - Compresses the values stored from now on
+ *                               that have at least min_size bytes.
+ *
+ * All servers share one codec, whose dictionary is trained on the first
+ * values compressed (see codec.h); server_set_compression() changes the
+ * threshold of a single server.
+ *
+ * @arg1: Load balancer.
+ * @arg2: Smallest value compressed, in bytes (with its terminator).
+ */
+void loader_enable_compression(load_balancer *main, unsigned int min_size);
+
+/**
+ * loader_enable_dedup() - Stores every distinct value once, from now on.
+ *
+ * The servers intern the values they store in one reference-counted store
+ * (see value_store.h): a duplicate value costs a lookup instead of a copy,
+ * and entries moved between servers keep sharing it. The values stored
+ * before are left as they are.
+ *
+ * @arg1: Load balancer.
+ */
+void loader_enable_dedup(load_balancer *main);
+
+/**
+ * loader_enable_value_log() - Stores the values stored from now on off the
+ *                             heap, in memory-mapped files of a directory.
+ *
+ * Every server, present and future, appends its values to a log of its own
+ * (see value_log.h); the values deduplicated by loader_enable_dedup() stay
+ * in their store, and the values stored before are left as they are. The
+ * space of the values overwritten or removed is reclaimed by
+ * value_log_compact(), to be called from the request loop.
+ *
+ * @arg1: Load balancer.
+ * @arg2: Directory of the segment files (unlinked once mapped).
+ *
+ * Return: 0 on success, -1 if no file can be created in the directory.
+ */
+int loader_enable_value_log(load_balancer *main, const char *dir);
+
+/**
+ * loader_set_server_budget() - Sets the memory budget of every server,
+ *                              present and future (see server_set_budget()).
+ *
+ * @arg1: Load balancer.
+ * @arg2: Budget in bytes (0: unlimited).
+ */
+void loader_set_server_budget(load_balancer *main, unsigned long long budget);
+
+/**
+ * loader_enable_hot_keys() - Tracks the most accessed keys and serves the
+ *                            hot ones from a front cache.
+ *
+ * Every store and retrieve is counted by a count-min sketch (see hotkeys.h).
+ * A hot key that is read is copied (with its expiry) to a front cache kept
+ * by the load balancer, which answers its next reads without going to the
+ * server; the copy is dropped when the key is stored again or leaves the
+ * tracked set. The server IDs returned do not change.
+ *
+ * @arg1: Load balancer.
+ * @arg2: Number of keys to track (at most HOTKEYS_MAX_TOP).
+ * @arg3: Estimated accesses from which a tracked key is hot.
+ */
+void loader_enable_hot_keys(load_balancer *main, unsigned int top_k,
+							unsigned int hot_min);
+
+/*
+ * loader_print_hot_keys() - Prints the tracked keys and the reads answered
+ * by the front cache.
+ */
+void loader_print_hot_keys(load_balancer *main, FILE *out);
+
 /**
  * load_retrieve() - Gets a value associated with the key.
  * @arg1: Load balancer which distributes the work.
@@ -76,9 +296,46 @@ void loader_store(load_balancer *main, char *key, char *value, int *server_id);
  */
 char *loader_retrieve(load_balancer *main, char *key, int *server_id);
 
+/**
+ * loader_retrieve_len() - loader_retrieve() of a length-explicit key.
+ *
+ * @arg1: Load balancer which distributes the work.
+ * @arg2: Key.
+ * @arg3: Length of the key, in bytes.
+ * @arg4: Returns the length of the value (may be NULL).
+ * @arg5: Returns the ID of the server which holds the key.
+ *
+ * Return: the value, or NULL if the key does not exist.
+ */
+char *loader_retrieve_len(load_balancer *main, const void *key,
+						  size_t key_len, size_t *value_len, int *server_id);
+
+/**
+ * hashring_find_index() - Finds the hashring point responsible for a hash:
+ * the first point clockwise whose hash is >= the given one, wrapping
+ * around to the first point of the ring.
+ *
+ * @arg1: Load balancer which holds the hashring.
+ * @arg2: Hash of a key.
+ *
+ * Return: index in main->ring (0 if the ring is empty).
+ */
+int hashring_find_index(load_balancer *main, unsigned int hash);
+
+/* hashring_find_server() - ID of the server responsible for a hash. */
+int hashring_find_server(load_balancer *main, unsigned int hash);
+
+/*
+ * hashring_arc_contains() - Checks if a hash lies in the arc
+ * (arc_start, arc_end] of the hashring (which may wrap around 0).
+ */
+int hashring_arc_contains(unsigned int arc_start, unsigned int arc_end,
+						  unsigned int hash);
+
 /*
  * Function that uniformly distributes elements and servers on the hashring of
- * the system, in clockwise order.
+ * the system, in clockwise order: the entries of the arc taken over by the
+ * new replica are relinked from its right neighbor to the new server.
  *
  * @arg1: Load Balancer for uniform distribution of servers.
  * @arg2: position of the new server to be added.
@@ -86,21 +343,11 @@ char *loader_retrieve(load_balancer *main, char *key, int *server_id);
  */
 void balance_load_balancer(load_balancer *main, int index, unsigned int label);
 
-/**
- * Function that inserts a server into a hash ring at a given position.
- *
- * @arg1: Load Balancer for uniform distribution of servers.
- * @arg2: The position at which the new server will be added.
- * @arg3: A replica of the server to be added.
- */
-void insert_at_position_in_hashring(load_balancer *main, int index,
-									unsigned int label);
-
 /**
  * Inserts a server into a simulated hash ring ("imaginary circle").
  *
- * We will use two other helper functions to uniformly distribute the servers
- * in the load balancer after adding the new one at the found 'index' position.
+ * We will use balance_load_balancer() to uniformly distribute the servers
+ * in the load balancer after adding the new one at its 'index' position.
  *
  * @arg1: Load Balancer for uniform distribution of servers.
  * @arg2: A replica of the server to be added to the hash ring.
@@ -110,6 +357,18 @@ void insert_at_position_in_hashring(load_balancer *main, int index,
 void add_to_hashring(load_balancer *main, unsigned int label,
 						unsigned int hash_label);
 
+/**
+ * loader_init_server() - Creates a server with the settings of the load
+ *                        balancer (budget, compression, deduplication),
+ *                        without placing it on the hashring.
+ *
+ * @arg1: Load balancer.
+ * @arg2: ID of the new server.
+ *
+ * Return: the new server, also stored in main->servers.
+ */
+server_memory *loader_init_server(load_balancer *main, int server_id);
+
 /**
  * loader_add_server() - Adds a new server to the system.
  * @arg1: Load balancer which distributes the work.
@@ -127,15 +386,6 @@ void add_to_hashring(load_balancer *main, unsigned int label,
  */
 void loader_add_server(load_balancer *main, int server_id);
 
-/**
- * Function that removes a server from a given position
- * in the simulated hash ring.
- *
- * @arg1: Load Balancer for uniform distribution of servers.
- * @arg2: The position of the server to be removed from the system.
- */
-void erase_at_position_in_hashring(load_balancer *main, int index);
-
 /*
  * Function that removes a server from a hashring.
  *
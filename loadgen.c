@@ -0,0 +1,290 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#define _POSIX_C_SOURCE 200809L
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "latency.h"
+#include "utils.h"
+
+/*
+ * Load generator for the network mode (`./tema2 --listen port`): keeps
+ * `depth` pipelined requests in flight on each of `conns` connections for
+ * `seconds` seconds and reports the throughput and the latency percentiles
+ * (from sending a request to reading its reply).
+ */
+
+#define LOADGEN_KEY_LENGTH 32
+#define LOADGEN_MAX_VALUE 4096
+#define LOADGEN_MAX_REQUEST (LOADGEN_KEY_LENGTH + LOADGEN_MAX_VALUE + 32)
+#define LOADGEN_READ_SIZE 65536
+
+typedef struct loadgen_conn loadgen_conn;
+struct loadgen_conn {
+	int fd;
+	char *out;  /* requests not sent yet */
+	unsigned int out_len;
+	unsigned int out_sent;
+	unsigned long long *sent_at;  /* FIFO of the requests in flight */
+	unsigned int head;
+	unsigned int in_flight;
+};
+
+typedef struct loadgen_options loadgen_options;
+struct loadgen_options {
+	const char *host;
+	int port;
+	int conns;
+	unsigned int depth;
+	int seconds;
+	unsigned int keys;
+	unsigned int value_size;
+	unsigned int store_ratio;  /* percent of the requests that are stores */
+	int servers;  /* add_server requests sent before the run */
+};
+
+/* xorshift */
+static unsigned long long loadgen_rand(unsigned long long *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static int loadgen_connect(const loadgen_options *opt)
+{
+	struct sockaddr_in addr;
+	int one = 1;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	DIE(fd < 0, "socket() failed\n");
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(opt->port);
+	DIE(inet_pton(AF_INET, opt->host, &addr.sin_addr) != 1, "invalid host\n");
+	DIE(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0,
+		"connect() failed\n");
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	return fd;
+}
+
+/* sends the add_server requests and waits for their replies */
+static void loadgen_add_servers(const loadgen_options *opt)
+{
+	char buffer[LOADGEN_READ_SIZE];
+	int fd = loadgen_connect(opt);
+	int replies = 0;
+
+	for (int i = 1; i <= opt->servers; i++) {
+		int len = snprintf(buffer, sizeof(buffer), "add_server %d\n", i);
+		DIE(write(fd, buffer, len) != len, "write() failed\n");
+	}
+
+	while (replies < opt->servers) {
+		ssize_t len = read(fd, buffer, sizeof(buffer));
+		DIE(len <= 0, "the server closed the connection\n");
+
+		for (ssize_t i = 0; i < len; i++)
+			if (buffer[i] == '\n')
+				replies++;
+	}
+
+	close(fd);
+}
+
+/* appends requests until `depth` of them are in flight */
+static void loadgen_fill(loadgen_conn *conn, const loadgen_options *opt,
+						 const char *value, unsigned long long *state)
+{
+	unsigned long long now = lat_now_ns();
+
+	// the requests not sent yet go to the front of the buffer
+	if (conn->out_sent) {
+		memmove(conn->out, conn->out + conn->out_sent,
+				conn->out_len - conn->out_sent);
+		conn->out_len -= conn->out_sent;
+		conn->out_sent = 0;
+	}
+
+	while (conn->in_flight < opt->depth) {
+		unsigned long long random = loadgen_rand(state);
+		unsigned int key = random % opt->keys;
+		char *out = conn->out + conn->out_len;
+		int len;
+
+		if ((random >> 32) % 100 < opt->store_ratio)
+			len = sprintf(out, "store \"key_%u\" \"%s\"\n", key, value);
+		else
+			len = sprintf(out, "retrieve \"key_%u\"\n", key);
+
+		conn->out_len += len;
+		conn->sent_at[(conn->head + conn->in_flight) % opt->depth] = now;
+		conn->in_flight++;
+	}
+}
+
+/* counts the replies read, recording their latencies */
+static void loadgen_read(loadgen_conn *conn, const loadgen_options *opt,
+						 lat_hist *hist, unsigned long long *replies)
+{
+	char buffer[LOADGEN_READ_SIZE];
+
+	while (1) {
+		ssize_t len = read(conn->fd, buffer, sizeof(buffer));
+
+		if (len < 0 && errno == EAGAIN)
+			return;
+		DIE(len <= 0, "the server closed the connection\n");
+
+		unsigned long long now = lat_now_ns();
+		for (ssize_t i = 0; i < len; i++) {
+			if (buffer[i] != '\n')
+				continue;
+
+			DIE(!conn->in_flight, "unexpected reply\n");
+			lat_hist_record(hist, now - conn->sent_at[conn->head]);
+			conn->head = (conn->head + 1) % opt->depth;
+			conn->in_flight--;
+			(*replies)++;
+		}
+	}
+}
+
+static void loadgen_run(const loadgen_options *opt)
+{
+	loadgen_conn *conns = calloc(opt->conns, sizeof(*conns));
+	struct pollfd *fds = calloc(opt->conns, sizeof(*fds));
+	char *value = malloc(opt->value_size + 1);
+	lat_hist *hist = malloc(sizeof(*hist));
+	unsigned long long state = 0x9E3779B97F4A7C15ull;
+	unsigned long long replies = 0, start, end;
+	DIE(!conns || !fds || !value || !hist, "allocation failed\n");
+
+	memset(value, 'v', opt->value_size);
+	value[opt->value_size] = 0;
+	lat_hist_reset(hist);
+
+	for (int i = 0; i < opt->conns; i++) {
+		conns[i].fd = loadgen_connect(opt);
+		fcntl(conns[i].fd, F_SETFL,
+			  fcntl(conns[i].fd, F_GETFL, 0) | O_NONBLOCK);
+		conns[i].out = malloc(opt->depth * LOADGEN_MAX_REQUEST);
+		conns[i].sent_at = malloc(opt->depth * sizeof(*conns[i].sent_at));
+		DIE(!conns[i].out || !conns[i].sent_at, "malloc() failed\n");
+		fds[i].fd = conns[i].fd;
+	}
+
+	start = lat_now_ns();
+	end = start + opt->seconds * 1000000000ull;
+	while (lat_now_ns() < end) {
+		for (int i = 0; i < opt->conns; i++) {
+			if (conns[i].in_flight < opt->depth)
+				loadgen_fill(&conns[i], opt, value, &state);
+
+			fds[i].events = POLLIN;
+			if (conns[i].out_sent < conns[i].out_len)
+				fds[i].events |= POLLOUT;
+		}
+
+		DIE(poll(fds, opt->conns, 100) < 0 && errno != EINTR,
+			"poll() failed\n");
+
+		for (int i = 0; i < opt->conns; i++) {
+			loadgen_conn *conn = &conns[i];
+
+			if (fds[i].revents & (POLLERR | POLLHUP))
+				DIE(1, "the server closed the connection\n");
+
+			if (fds[i].revents & POLLOUT) {
+				ssize_t len = write(conn->fd, conn->out + conn->out_sent,
+									conn->out_len - conn->out_sent);
+				DIE(len < 0 && errno != EAGAIN, "write() failed\n");
+				if (len > 0)
+					conn->out_sent += len;
+			}
+
+			if (fds[i].revents & POLLIN)
+				loadgen_read(conn, opt, hist, &replies);
+		}
+	}
+	end = lat_now_ns();
+
+	printf("%d connections x %u in flight, %u%% stores, %u byte values\n",
+		   opt->conns, opt->depth, opt->store_ratio, opt->value_size);
+	printf("%llu requests in %.2f s: %.0f ops/s\n", replies,
+		   (end - start) / 1e9, replies / ((end - start) / 1e9));
+	printf("latency (us): p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+		   lat_hist_percentile(hist, 0.50) / 1e3,
+		   lat_hist_percentile(hist, 0.99) / 1e3,
+		   lat_hist_percentile(hist, 0.999) / 1e3, hist->max / 1e3);
+
+	for (int i = 0; i < opt->conns; i++) {
+		close(conns[i].fd);
+		free(conns[i].out);
+		free(conns[i].sent_at);
+	}
+	free(conns);
+	free(fds);
+	free(value);
+	free(hist);
+}
+
+int main(int argc, char *argv[])
+{
+	loadgen_options opt = {
+		.host = "127.0.0.1",
+		.port = 7777,
+		.conns = 4,
+		.depth = 16,
+		.seconds = 5,
+		.keys = 10000,
+		.value_size = 64,
+		.store_ratio = 10,
+		.servers = 0,
+	};
+
+	for (int arg = 1; arg < argc; arg += 2) {
+		if (arg + 1 == argc) {
+			printf("Usage:%s [--host ip] [--port n] [--conns n] [--depth n] "
+				   "[--seconds n] [--keys n] [--value-size bytes] "
+				   "[--store-ratio percent] [--servers n]\n", argv[0]);
+			return -1;
+		}
+
+		if (!strcmp(argv[arg], "--host"))
+			opt.host = argv[arg + 1];
+		else if (!strcmp(argv[arg], "--port"))
+			opt.port = atoi(argv[arg + 1]);
+		else if (!strcmp(argv[arg], "--conns"))
+			opt.conns = atoi(argv[arg + 1]);
+		else if (!strcmp(argv[arg], "--depth"))
+			opt.depth = strtoul(argv[arg + 1], NULL, 10);
+		else if (!strcmp(argv[arg], "--seconds"))
+			opt.seconds = atoi(argv[arg + 1]);
+		else if (!strcmp(argv[arg], "--keys"))
+			opt.keys = strtoul(argv[arg + 1], NULL, 10);
+		else if (!strcmp(argv[arg], "--value-size"))
+			opt.value_size = strtoul(argv[arg + 1], NULL, 10);
+		else if (!strcmp(argv[arg], "--store-ratio"))
+			opt.store_ratio = strtoul(argv[arg + 1], NULL, 10);
+		else if (!strcmp(argv[arg], "--servers"))
+			opt.servers = atoi(argv[arg + 1]);
+		else
+			DIE(1, "unknown option\n");
+	}
+
+	DIE(opt.conns < 1 || !opt.depth || !opt.keys ||
+		opt.value_size > LOADGEN_MAX_VALUE, "invalid options\n");
+
+	if (opt.servers)
+		loadgen_add_servers(&opt);
+	loadgen_run(&opt);
+
+	return 0;
+}
@@ -1,10 +1,41 @@
 /* Copyright 2023 Munteanu Eugen 315CA */
+#define _POSIX_C_SOURCE 200809L
+#include <signal.h>
 #include "load_balancer.h"
+#include "latency.h"
+#include "profile.h"
+#include "snapshot.h"
+#include "wal.h"
+#include "replication.h"
+#include "net.h"
+#include "zones.h"
+#include "ring_analysis.h"
+#include "simulator.h"
 #include "utils.h"
 
 #define REQUEST_LENGTH 1024
 #define KEY_LENGTH 128
 #define VALUE_LENGTH 65536
+/* accesses (estimated, over a window) from which a tracked key is hot */
+#define HOT_KEY_MIN_ACCESSES 16
+
+/* set by SIGINT / SIGTERM, stops the network mode */
+static volatile sig_atomic_t stop_serving;
+
+static void request_stop(int signum) {
+	(void)signum;
+	stop_serving = 1;
+}
+
+#ifdef LB_LATENCY
+/* set by SIGUSR1, the histograms are printed by the request loop */
+static volatile sig_atomic_t dump_latency;
+
+static void request_latency_dump(int signum) {
+	(void)signum;
+	dump_latency = 1;
+}
+#endif
 
 void get_key_value(char* key, char* value, char* request) {
 	int key_start = 0, value_start = 0;
@@ -44,25 +75,78 @@ void get_key(char* key, char* request) {
 	}
 }
 
-void apply_requests(FILE* input_file) {
+/*
+ * Parses the fsync policy of the write-ahead log:
+ * "none", "interval:<ms>" or "every:<records>".
+ */
+int parse_wal_sync(char *policy, wal_sync_policy *type,
+				   unsigned long long *param) {
+	if (!strcmp(policy, "none")) {
+		*type = WAL_SYNC_NONE;
+		*param = 0;
+	} else if (!strncmp(policy, "interval:", sizeof("interval:") - 1)) {
+		*type = WAL_SYNC_INTERVAL;
+		*param = strtoull(policy + sizeof("interval:") - 1, NULL, 10);
+	} else if (!strncmp(policy, "every:", sizeof("every:") - 1)) {
+		*type = WAL_SYNC_EVERY_N;
+		*param = strtoull(policy + sizeof("every:") - 1, NULL, 10);
+		if (!*param)
+			return -1;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Cuts the optional TTL off a store request (`store "key" "value" <ttl>`)
+ * and returns it (0 if there is none).
+ */
+unsigned long long get_ttl(char *request) {
+	char *value_end = strrchr(request, '"');
+
+	if (!value_end || value_end[1] != ' ')
+		return 0;
+
+	unsigned long long ttl = strtoull(value_end + 1, NULL, 10);
+	value_end[1] = 0;
+	return ttl;
+}
+
+void apply_requests(FILE* input_file, load_balancer* main_server) {
 	char request[REQUEST_LENGTH] = {0};
 	char key[KEY_LENGTH] = {0};
 	char value[VALUE_LENGTH] = {0};
-	load_balancer* main_server = init_load_balancer();
 
 	while (fgets(request, REQUEST_LENGTH, input_file)) {
+		// time is counted in requests: keys stored with a TTL expire
+		// after that many requests (from the clock a replay left)
+		loader_tick(main_server, main_server->now + 1);
+
+#ifdef LB_LATENCY
+		if (dump_latency) {
+			dump_latency = 0;
+			lat_dump(stderr);
+		}
+#endif
 		request[strlen(request) - 1] = 0;
 		if (!strncmp(request, "store", sizeof("store") - 1)) {
+			PROF_BEGIN(prof_start);
+			unsigned long long ttl = get_ttl(request);
 			get_key_value(key, value, request);
+			PROF_END(PROF_PARSING, prof_start);
 
 			int index_server = 0;
-			loader_store(main_server, key, value, &index_server);
+			loader_store_ttl(main_server, key, value, ttl, &index_server);
 			printf("Stored %s on server %d.\n", value, index_server);
 
 			memset(key, 0, sizeof(key));
 			memset(value, 0, sizeof(value));
 		} else if (!strncmp(request, "retrieve", sizeof("retrieve") - 1)) {
+			PROF_BEGIN(prof_start);
 			get_key(key, request);
+			PROF_END(PROF_PARSING, prof_start);
 
 			int index_server = 0;
 			char *retrieved_value = loader_retrieve(main_server,
@@ -87,25 +171,224 @@ void apply_requests(FILE* input_file) {
 		} else {
 			DIE(1, "unknown function call");
 		}
+
+		loader_background_step(main_server);
 	}
+}
 
-	free_load_balancer(main_server);
+/*
+ * Replays the requests of a file against the simulated configurations and
+ * prints how each of them spread and moved the keys.
+ */
+int simulate_trace(char *path, sim_config *configs, int no_configs,
+				   int server_stats) {
+	sim_result results[SIM_MAX_CONFIGS];
+	FILE *input = fopen(path, "rt");
+	DIE(input == NULL, "missing input file");
+
+	sim_trace *trace = sim_trace_load(input);
+	fclose(input);
+	DIE(trace == NULL, "malformed request in the trace");
+
+	printf("%u requests, %u distinct keys\n", trace->no_events,
+		   trace->no_keys);
+	DIE(sim_run(trace, configs, no_configs, results, server_stats),
+		"sim_run() failed");
+	sim_print(configs, results, no_configs, stdout);
+
+	for (int i = 0; i < no_configs; i++)
+		sim_result_free(&results[i]);
+	sim_trace_free(trace);
+	return 0;
 }
 
 int main(int argc, char* argv[]) {
 	FILE *input;
+	char *load_path = NULL, *save_path = NULL, *wal_path = NULL;
+	char *value_log_dir = NULL;
+	wal_sync_policy wal_sync = WAL_SYNC_INTERVAL;
+	unsigned long long wal_sync_param = 100;
+	int lazy_migration = 0, server_stats = 0, dedup = 0, ring_stats = 0;
+	unsigned long long server_budget = 0;
+	int replication = 1;
+	int hot_keys = 0;
+	int zones = 0;
+	unsigned int compress_min = 0;
+	char *listen_addr = NULL;
+	sim_config sim_configs[SIM_MAX_CONFIGS];
+	int no_sim_configs = 0;
+	load_balancer *main_server;
+	int arg = 1;
+
+	// optional snapshot to start from, snapshot to write at exit,
+	// write-ahead log (with its fsync policy) and lazy migration
+	while (arg < argc && argv[arg][0] == '-') {
+		if (!strcmp(argv[arg], "--lazy-migration")) {
+			lazy_migration = 1;
+			arg++;
+			continue;
+		} else if (!strcmp(argv[arg], "--server-stats")) {
+			server_stats = 1;
+			arg++;
+			continue;
+		} else if (!strcmp(argv[arg], "--ring-report")) {
+			ring_stats = 1;
+			arg++;
+			continue;
+		} else if (!strcmp(argv[arg], "--dedup")) {
+			dedup = 1;
+			arg++;
+			continue;
+		} else if (!strcmp(argv[arg], "--load-snapshot")) {
+			load_path = argv[arg + 1];
+		} else if (!strcmp(argv[arg], "--save-snapshot")) {
+			save_path = argv[arg + 1];
+		} else if (!strcmp(argv[arg], "--server-budget")) {
+			server_budget = strtoull(argv[arg + 1], NULL, 10);
+		} else if (!strcmp(argv[arg], "--replication")) {
+			replication = atoi(argv[arg + 1]);
+		} else if (!strcmp(argv[arg], "--compress")) {
+			compress_min = strtoul(argv[arg + 1], NULL, 10);
+		} else if (!strcmp(argv[arg], "--value-log")) {
+			value_log_dir = argv[arg + 1];
+		} else if (!strcmp(argv[arg], "--hot-keys")) {
+			hot_keys = atoi(argv[arg + 1]);
+		} else if (!strcmp(argv[arg], "--zones")) {
+			zones = atoi(argv[arg + 1]);
+		} else if (!strcmp(argv[arg], "--simulate")) {
+			if (no_sim_configs == SIM_MAX_CONFIGS ||
+				sim_parse_config(argv[arg + 1],
+								 &sim_configs[no_sim_configs++]))
+				break;
+		} else if (!strcmp(argv[arg], "--listen")) {
+			listen_addr = argv[arg + 1];
+		} else if (!strcmp(argv[arg], "--wal")) {
+			wal_path = argv[arg + 1];
+		} else if (!strcmp(argv[arg], "--wal-sync")) {
+			if (parse_wal_sync(argv[arg + 1], &wal_sync, &wal_sync_param))
+				break;
+		} else {
+			break;
+		}
+		arg += 2;
+	}
 
-	if (argc != 2) {
-		printf("Usage:%s input_file \n", argv[0]);
+	// the requests come from a file, or from the network
+	if (arg != argc - (listen_addr ? 0 : 1) ||
+		(listen_addr && no_sim_configs)) {
+		printf("Usage:%s [--load-snapshot file] [--save-snapshot file] "
+			   "[--wal file] [--wal-sync none|interval:<ms>|every:<n>] "
+			   "[--lazy-migration] [--replication n] [--server-budget bytes] "
+			   "[--compress min_bytes] [--dedup] [--value-log dir] "
+			   "[--hot-keys k] [--zones n] [--server-stats] [--ring-report] "
+			   "input_file | --listen [host:]port\n"
+			   "       %s --simulate [replicas=n,][hash=djb2|fnv1a|murmur,]"
+			   "[zones=n] [--simulate ...] [--server-stats] input_file\n",
+			   argv[0], argv[0]);
 		return -1;
 	}
 
-	input = fopen(argv[1], "rt");
-	DIE(input == NULL, "missing input file");
+	// the what-if simulator only routes the keys, with no load balancer
+	if (no_sim_configs)
+		return simulate_trace(argv[arg], sim_configs, no_sim_configs,
+							  server_stats);
 
-	apply_requests(input);
+	if (load_path) {
+		main_server = loader_snapshot_load(load_path);
+		DIE(main_server == NULL, "invalid snapshot file");
+	} else {
+		main_server = init_load_balancer();
+	}
 
-	fclose(input);
+	main_server->lazy_migration = lazy_migration;
+	if (server_budget)
+		loader_set_server_budget(main_server, server_budget);
+	if (replication != 1)
+		loader_set_replication(main_server, replication);
+	if (compress_min)
+		loader_enable_compression(main_server, compress_min);
+	if (dedup)
+		loader_enable_dedup(main_server);
+	if (value_log_dir)
+		DIE(loader_enable_value_log(main_server, value_log_dir),
+			"--value-log: cannot create files in the directory");
+	if (hot_keys > 0)
+		loader_enable_hot_keys(main_server, hot_keys, HOT_KEY_MIN_ACCESSES);
+	// the snapshots hold the flat hashring only
+	if (zones)
+		DIE(load_path || save_path ||
+			loader_enable_zones(main_server, zones),
+			"--zones needs no snapshot, replication or lazy migration");
+
+	// bring the system up to date with the log, then keep logging to it
+	if (wal_path) {
+		DIE(wal_replay(wal_path, main_server) < 0, "wal_replay() failed");
+		main_server->wal = wal_open(wal_path, wal_sync, wal_sync_param,
+									main_server->wal_lsn + 1);
+		DIE(main_server->wal == NULL, "wal_open() failed");
+	}
+
+#ifdef LB_LATENCY
+	// `kill -USR1 <pid>` prints the histograms while the requests run
+	signal(SIGUSR1, request_latency_dump);
+#endif
+
+	if (listen_addr) {
+		struct sigaction action;
+		char *port = strrchr(listen_addr, ':');
+
+		// no SA_RESTART: the signal also wakes up epoll_wait()
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = request_stop;
+		sigaction(SIGINT, &action, NULL);
+		sigaction(SIGTERM, &action, NULL);
+
+		if (port)
+			*port++ = 0;
+		DIE(net_serve(main_server, port ? listen_addr : NULL,
+					  atoi(port ? port : listen_addr), &stop_serving),
+			"net_serve() failed");
+	} else {
+		input = fopen(argv[arg], "rt");
+		DIE(input == NULL, "missing input file");
+
+		apply_requests(input, main_server);
+
+		fclose(input);
+	}
+
+	if (server_stats)
+		loader_print_server_stats(main_server, stderr);
+	if (server_stats && hot_keys > 0)
+		loader_print_hot_keys(main_server, stderr);
+	if (server_stats && zones)
+		loader_print_zone_stats(main_server, stderr);
+	// the shares of the servers on the (flat) hashring
+	if (ring_stats && !zones) {
+		ring_report report = {0};
+
+		ring_analyze(main_server, &report);
+		ring_report_print(&report, stderr);
+		ring_report_free(&report);
+	}
+
+	// the snapshot also compacts the log, whose records it now contains
+	if (save_path)
+		DIE(loader_checkpoint(main_server, save_path),
+			"loader_checkpoint() failed");
+	DIE(wal_close(main_server->wal), "wal_close() failed");
+	main_server->wal = NULL;
+	free_load_balancer(main_server);
+
+#ifdef LB_LATENCY
+	// the latency report goes to stderr, so stdout keeps only the replies
+	lat_dump(stderr);
+	lat_free();
+#endif
+#ifdef LB_PROFILE
+	prof_dump(stderr);
+	prof_free();
+#endif
 
 	return 0;
 }
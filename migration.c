@@ -0,0 +1,203 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#include "utils.h"
+#include "migration.h"
+#include "profile.h"
+
+/* checks if a hash lies in the arc (start, end] of the hashring */
+static int migration_covers(migration *curr, unsigned int hash)
+{
+	return hashring_arc_contains(curr->arc_start, curr->arc_end, hash);
+}
+
+void migration_add(load_balancer *main, int source, int dest,
+				   unsigned int arc_start, unsigned int arc_end)
+{
+	migration *new_migration = calloc(1, sizeof(*new_migration));
+	DIE(!new_migration, "calloc() for *new_migration failed\n");
+
+	new_migration->source = source;
+	new_migration->dest = dest;
+	new_migration->arc_start = arc_start;
+	new_migration->arc_end = arc_end;
+
+	// newest last in the queue
+	if (main->migrations_tail)
+		main->migrations_tail->next = new_migration;
+	else
+		main->migrations = new_migration;
+	main->migrations_tail = new_migration;
+
+	// and in the list of its destination
+	migration **list = &main->servers[dest]->migrations_in;
+
+	new_migration->next_in = *list;
+	new_migration->pprev_in = list;
+	if (*list)
+		(*list)->pprev_in = &new_migration->next_in;
+	*list = new_migration;
+}
+
+/* removes a migration from the list of its destination */
+static void migration_unlink(migration *curr)
+{
+	*curr->pprev_in = curr->next_in;
+	if (curr->next_in)
+		curr->next_in->pprev_in = curr->pprev_in;
+}
+
+/*
+ * Follows the chain of migrations that moved a hash to its owner; returns
+ * the one whose source still holds the key, or NULL.
+ */
+static migration *migration_find(load_balancer *main, const void *key,
+								 size_t key_len, unsigned int hash, int owner)
+{
+	migration *curr = main->servers[owner]->migrations_in;
+
+	while (curr) {
+		if (!migration_covers(curr, hash)) {
+			curr = curr->next_in;
+			continue;
+		}
+
+		if (server_retrieve_len(main->servers[curr->source], key, key_len,
+								NULL))
+			return curr;
+
+		// a server only has migrations into it from when it was added,
+		// before the ones out of it, so the chain never loops
+		curr = main->servers[curr->source]->migrations_in;
+	}
+
+	return NULL;
+}
+
+char *migration_fetch(load_balancer *main, const void *key, size_t key_len,
+					  unsigned int hash, int owner, size_t *value_len)
+{
+	migration *curr = migration_find(main, key, key_len, hash, owner);
+
+	if (!curr)
+		return NULL;
+
+	PROF_BEGIN(prof_start);
+	server_move_len(main->servers[curr->source], main->servers[owner], key,
+					key_len);
+	PROF_END(PROF_MIGRATION, prof_start);
+	main->moved_on_access++;
+	return server_retrieve_len(main->servers[owner], key, key_len, value_len);
+}
+
+void migration_forget(load_balancer *main, const void *key, size_t key_len,
+					  unsigned int hash, int owner)
+{
+	// at most one stale copy exists along the chain
+	migration *curr = migration_find(main, key, key_len, hash, owner);
+
+	if (curr)
+		server_remove_len(main->servers[curr->source], key, key_len);
+}
+
+/* state of the scan of one source bucket */
+typedef struct migration_scan migration_scan;
+struct migration_scan {
+	load_balancer *main;
+	migration *curr;
+};
+
+/* where an entry of the scanned source goes (NULL: it stays) */
+static hashtable_t *migration_scan_dest(info *entry, void *ctx)
+{
+	migration_scan *scan = (migration_scan *)ctx;
+	unsigned int hash = entry->hash;
+
+	if (!migration_covers(scan->curr, hash))
+		return NULL;
+
+	// the arc may have been split again since, so the key goes
+	// to its current owner rather than to curr->dest
+	int owner = hashring_find_server(scan->main, hash);
+
+	scan->main->moved_in_background++;
+	return scan->main->servers[owner]->memory;
+}
+
+/*
+ * Scans the bucket of the source at the cursor, relinking the keys of the
+ * migrated arc, and advances the cursor (which stays valid if the source
+ * grows in between).
+ */
+static unsigned int migration_scan_bucket(load_balancer *main,
+										  migration *curr)
+{
+	PROF_BEGIN(prof_start);
+	migration_scan scan = {main, curr};
+	hashtable_t *source = main->servers[curr->source]->memory;
+	unsigned int examined = ht_move_bucket(source,
+										   curr->cursor & (source->hmax - 1),
+										   migration_scan_dest, &scan);
+
+	curr->cursor = ht_scan_next(source, curr->cursor);
+	PROF_END(PROF_MIGRATION, prof_start);
+	return examined;
+}
+
+int loader_migrate_step(load_balancer *main, unsigned int budget)
+{
+	unsigned int examined = 0;
+
+	while (main->migrations && examined < budget) {
+		// the oldest migration is at the head of the queue
+		migration *curr = main->migrations;
+		int done = 0;
+
+		while (!done && examined < budget) {
+			examined += migration_scan_bucket(main, curr) + 1;
+			done = !curr->cursor;
+		}
+
+		if (done) {
+			main->migrations = curr->next;
+			if (!main->migrations)
+				main->migrations_tail = NULL;
+			migration_unlink(curr);
+			free(curr);
+		}
+	}
+
+	return main->migrations != NULL;
+}
+
+void loader_migrate_all(load_balancer *main)
+{
+	while (loader_migrate_step(main, ~0u))
+		;
+}
+
+void loader_migration_status(load_balancer *main, migration_status *status)
+{
+	memset(status, 0, sizeof(*status));
+
+	for (migration *curr = main->migrations; curr; curr = curr->next) {
+		hashtable_t *source = main->servers[curr->source]->memory;
+
+		status->pending++;
+		status->buckets_left += source->hmax -
+								ht_scan_position(source, curr->cursor);
+	}
+
+	status->moved_on_access = main->moved_on_access;
+	status->moved_in_background = main->moved_in_background;
+}
+
+void migration_free(load_balancer *main)
+{
+	while (main->migrations) {
+		migration *next = main->migrations->next;
+
+		migration_unlink(main->migrations);
+		free(main->migrations);
+		main->migrations = next;
+	}
+	main->migrations_tail = NULL;
+}
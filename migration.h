@@ -0,0 +1,98 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#ifndef MIGRATION_H_
+#define MIGRATION_H_
+
+#include "load_balancer.h"
+
+/*
+ * Lazy (incremental) redistribution of the keys when a server is added.
+ *
+ * With main->lazy_migration set, loader_add_server() only inserts the new
+ * replicas in the hashring: the new server owns its arcs right away, and a
+ * pending migration is recorded for every arc it took over. The keys of an
+ * arc stay on the previous owner (the source) until they are moved:
+ *   - on access: a retrieve that misses on the owner falls back to the
+ *     source(s) and moves the key; a store drops the stale source copy;
+ *   - in the background: loader_migrate_step() moves a bounded number of
+ *     entries, and is meant to be called from the request loop.
+ *
+ * Migrations are queued oldest first (the background scan takes the head),
+ * and each server lists the pending migrations into it. A key has at most
+ * one copy along a chain of migrations (A -> B, then B -> C), and the copy
+ * found closest to the current owner is the valid one: the chain is
+ * followed from the owner through the lists of its servers, which hold one
+ * migration per replica at most, whatever the number pending.
+ */
+
+/* entries examined by each loader_migrate_step() called from main.c */
+#define MIGRATION_STEP_BUDGET 64
+
+typedef struct migration migration;
+struct migration {
+	int source;  /* server that still holds keys of the arc */
+	int dest;  /* server that owned the arc when it was added */
+	unsigned int arc_start;  /* the arc is (arc_start, arc_end] */
+	unsigned int arc_end;
+	unsigned int cursor;  /* background scan cursor in the source (ht_scan) */
+	migration *next;  /* the next newer one */
+	/* in the list of the migrations into dest */
+	migration *next_in;
+	migration **pprev_in;
+};
+
+typedef struct migration_status migration_status;
+struct migration_status {
+	int pending;  /* migrations not fully scanned yet */
+	unsigned int buckets_left;  /* source buckets left to scan */
+	unsigned long long moved_on_access;
+	unsigned long long moved_in_background;
+};
+
+/* migration_add() - Records that dest took over (start, end] from source. */
+void migration_add(load_balancer *main, int source, int dest,
+				   unsigned int arc_start, unsigned int arc_end);
+
+/**
+ * migration_fetch() - Looks for a key that has not been moved to its owner
+ *                     yet and moves it there.
+ *
+ * @arg1: Load balancer.
+ * @arg2: Key that was not found on its owner.
+ * @arg3: Length of the key, in bytes.
+ * @arg4: Hash of the key.
+ * @arg5: ID of the server that owns the key.
+ * @arg6: Returns the length of the value.
+ *
+ * Return: the value (now stored on the owner), or NULL.
+ */
+char *migration_fetch(load_balancer *main, const void *key, size_t key_len,
+					  unsigned int hash, int owner, size_t *value_len);
+
+/*
+ * migration_forget() - Removes the stale copies of a key that has just been
+ * stored on its owner from the sources of the pending migrations.
+ */
+void migration_forget(load_balancer *main, const void *key, size_t key_len,
+					  unsigned int hash, int owner);
+
+/**
+ * loader_migrate_step() - Moves pending keys in the background.
+ *
+ * Scans whole buckets of the oldest pending migration's source until at
+ * least `budget` entries were examined, so the pause it adds to a request
+ * stays bounded by the budget (plus one chain).
+ *
+ * Return: 1 if migrations are still pending, 0 otherwise.
+ */
+int loader_migrate_step(load_balancer *main, unsigned int budget);
+
+/* loader_migrate_all() - Completes every pending migration. */
+void loader_migrate_all(load_balancer *main);
+
+/* loader_migration_status() - Reports the progress of the migrations. */
+void loader_migration_status(load_balancer *main, migration_status *status);
+
+/* migration_free() - Drops the pending migrations (used on teardown). */
+void migration_free(load_balancer *main);
+
+#endif  // MIGRATION_H_
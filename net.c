@@ -0,0 +1,510 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#define _POSIX_C_SOURCE 200809L
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "utils.h"
+#include "net.h"
+#include "profile.h"
+
+/* a block of replies waiting to be sent */
+typedef struct net_block net_block;
+struct net_block {
+	net_block *next;
+	unsigned int len;
+	char data[NET_OUT_BLOCK];
+};
+
+typedef struct net_conn net_conn;
+struct net_conn {
+	int fd;
+
+	/* received bytes; the complete lines are parsed in place */
+	char *in;
+	unsigned int in_len;
+	unsigned int in_cap;
+
+	/* replies, sent from out_sent bytes into the first block */
+	net_block *out_head;
+	net_block *out_tail;
+	unsigned int out_sent;
+	unsigned long long out_pending;
+
+	unsigned int events;  /* registered with epoll */
+	int eof;  /* the peer sent all its requests */
+	int closing;  /* the peer is gone, or broke the protocol */
+
+	/* all the open connections, to close them when the server stops */
+	net_conn *prev;
+	net_conn *next;
+};
+
+static int net_set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+
+	return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static int net_listen(const char *host, int port)
+{
+	struct sockaddr_in addr;
+	int one = 1;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) ||
+		(host && inet_pton(AF_INET, host, &addr.sin_addr) != 1) ||
+		bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+		listen(fd, SOMAXCONN) || net_set_nonblocking(fd)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* appends bytes to the replies of a connection */
+static void net_out_append(net_conn *conn, const char *data, unsigned int len)
+{
+	conn->out_pending += len;
+
+	while (len) {
+		net_block *tail = conn->out_tail;
+
+		if (!tail || tail->len == NET_OUT_BLOCK) {
+			tail = malloc(sizeof(*tail));
+			DIE(!tail, "malloc() for *tail failed\n");
+			tail->next = NULL;
+			tail->len = 0;
+
+			if (conn->out_tail)
+				conn->out_tail->next = tail;
+			else
+				conn->out_head = tail;
+			conn->out_tail = tail;
+		}
+
+		unsigned int room = NET_OUT_BLOCK - tail->len;
+		unsigned int chunk = len < room ? len : room;
+
+		memcpy(tail->data + tail->len, data, chunk);
+		tail->len += chunk;
+		data += chunk;
+		len -= chunk;
+	}
+}
+
+static void net_out_string(net_conn *conn, const char *str)
+{
+	net_out_append(conn, str, strlen(str));
+}
+
+/* " on server <id>.\n", and the like */
+static void net_out_server(net_conn *conn, const char *prefix, int server_id)
+{
+	char buf[64];
+	int len = snprintf(buf, sizeof(buf), "%s%d.\n", prefix, server_id);
+
+	net_out_append(conn, buf, len);
+}
+
+/*
+ * Sends the pending replies with one writev() of their blocks (more while
+ * the socket takes them). Returns -1 if the connection broke.
+ */
+static int net_flush(net_conn *conn)
+{
+	while (conn->out_head) {
+		struct iovec iov[NET_MAX_IOV];
+		int no_iov = 0;
+
+		for (net_block *block = conn->out_head; block && no_iov < NET_MAX_IOV;
+			 block = block->next, no_iov++) {
+			unsigned int skip = no_iov ? 0 : conn->out_sent;
+
+			iov[no_iov].iov_base = block->data + skip;
+			iov[no_iov].iov_len = block->len - skip;
+		}
+
+		ssize_t sent = writev(conn->fd, iov, no_iov);
+		if (sent < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK ||
+				   errno == EINTR ? 0 : -1;
+
+		conn->out_pending -= sent;
+		while (sent > 0) {
+			net_block *head = conn->out_head;
+			unsigned int left = head->len - conn->out_sent;
+
+			if ((size_t)sent < left) {
+				conn->out_sent += sent;
+				break;
+			}
+
+			sent -= left;
+			conn->out_sent = 0;
+			conn->out_head = head->next;
+			if (!conn->out_head)
+				conn->out_tail = NULL;
+			free(head);
+		}
+	}
+
+	return 0;
+}
+
+/* the ID argument of add_server / remove_server */
+static int net_parse_server_id(const char *arg, int *server_id)
+{
+	char *end;
+	long id = strtol(arg, &end, 10);
+
+	if (end == arg || id < 0 || id >= MAX_SERVERS)
+		return -1;
+
+	*server_id = id;
+	return 0;
+}
+
+/*
+ * Splits `"key" "value" [ttl]` in place, as the batch mode does: the value
+ * runs up to the last quote of the line. Returns -1 on a malformed line.
+ */
+static int net_parse_store(char *args, char **key, char **value,
+						   unsigned long long *ttl)
+{
+	char *key_start = strchr(args, '"');
+	char *key_end = key_start ? strchr(key_start + 1, '"') : NULL;
+	char *value_start = key_end ? strchr(key_end + 1, '"') : NULL;
+	char *value_end = strrchr(args, '"');
+
+	if (!value_start || value_end == value_start)
+		return -1;
+
+	*key_end = 0;
+	*value_end = 0;
+	*key = key_start + 1;
+	*value = value_start + 1;
+	*ttl = strtoull(value_end + 1, NULL, 10);
+	return 0;
+}
+
+static int net_parse_key(char *args, char **key)
+{
+	char *key_start = strchr(args, '"');
+	char *key_end = key_start ? strchr(key_start + 1, '"') : NULL;
+
+	if (!key_end)
+		return -1;
+
+	*key_end = 0;
+	*key = key_start + 1;
+	return 0;
+}
+
+/* applies one request and queues its reply */
+static void net_handle_line(load_balancer *main, net_conn *conn, char *line)
+{
+	char *key, *value;
+	unsigned long long ttl;
+	int server_id;
+
+	loader_tick(main, main->now + 1);
+
+	if (!strncmp(line, "store ", sizeof("store ") - 1)) {
+		PROF_BEGIN(prof_start);
+		int malformed = net_parse_store(line + sizeof("store"), &key, &value,
+										&ttl);
+		PROF_END(PROF_PARSING, prof_start);
+
+		if (malformed) {
+			net_out_string(conn, "ERR malformed store\n");
+			return;
+		}
+		if (!main->no_servers) {
+			net_out_string(conn, "ERR no servers\n");
+			return;
+		}
+
+		loader_store_ttl(main, key, value, ttl, &server_id);
+		net_out_string(conn, "Stored ");
+		net_out_string(conn, value);
+		net_out_server(conn, " on server ", server_id);
+	} else if (!strncmp(line, "retrieve ", sizeof("retrieve ") - 1)) {
+		PROF_BEGIN(prof_start);
+		int malformed = net_parse_key(line + sizeof("retrieve"), &key);
+		PROF_END(PROF_PARSING, prof_start);
+
+		if (malformed) {
+			net_out_string(conn, "ERR malformed retrieve\n");
+			return;
+		}
+		if (!main->no_servers) {
+			net_out_string(conn, "ERR no servers\n");
+			return;
+		}
+
+		value = loader_retrieve(main, key, &server_id);
+		if (value) {
+			net_out_string(conn, "Retrieved ");
+			net_out_string(conn, value);
+			net_out_server(conn, " from server ", server_id);
+		} else {
+			net_out_string(conn, "Key ");
+			net_out_string(conn, key);
+			net_out_string(conn, " not present.\n");
+		}
+	} else if (!strncmp(line, "add_server ", sizeof("add_server ") - 1)) {
+		if (net_parse_server_id(line + sizeof("add_server"), &server_id) ||
+			main->servers[server_id]) {
+			net_out_string(conn, "ERR invalid server\n");
+			return;
+		}
+
+		loader_add_server(main, server_id);
+		net_out_string(conn, "OK\n");
+	} else if (!strncmp(line, "remove_server ",
+						sizeof("remove_server ") - 1)) {
+		// the last server has nowhere to hand its keys over to
+		if (net_parse_server_id(line + sizeof("remove_server"), &server_id) ||
+			!main->servers[server_id] || main->no_servers == 1) {
+			net_out_string(conn, "ERR invalid server\n");
+			return;
+		}
+
+		loader_remove_server(main, server_id);
+		net_out_string(conn, "OK\n");
+	} else {
+		net_out_string(conn, "ERR unknown command\n");
+	}
+
+	loader_background_step(main);
+}
+
+/*
+ * Answers the complete lines of the receive buffer, until too many replies
+ * are pending; the rest of the buffer moves to its start.
+ */
+static void net_handle_input(load_balancer *main, net_conn *conn)
+{
+	unsigned int pos = 0;
+
+	while (pos < conn->in_len && conn->out_pending < NET_OUT_LIMIT) {
+		char *line = conn->in + pos;
+		char *end = memchr(line, '\n', conn->in_len - pos);
+
+		if (!end)
+			break;
+
+		*end = 0;
+		if (end > line && end[-1] == '\r')
+			end[-1] = 0;
+		pos += end - line + 1;
+
+		net_handle_line(main, conn, line);
+	}
+
+	if (pos) {
+		memmove(conn->in, conn->in + pos, conn->in_len - pos);
+		conn->in_len -= pos;
+	}
+
+	if (conn->in_len >= NET_MAX_LINE &&
+		!memchr(conn->in, '\n', conn->in_len)) {
+		net_out_string(conn, "ERR line too long\n");
+		conn->closing = 1;
+	}
+}
+
+/* reads what the socket holds (up to a full buffer) */
+static void net_read(net_conn *conn)
+{
+	while (conn->in_len < NET_MAX_LINE + NET_READ_SIZE) {
+		if (conn->in_cap - conn->in_len < NET_READ_SIZE) {
+			conn->in_cap = conn->in_len + NET_READ_SIZE;
+			conn->in = realloc(conn->in, conn->in_cap);
+			DIE(!conn->in, "realloc() for conn->in failed\n");
+		}
+
+		ssize_t len = read(conn->fd, conn->in + conn->in_len, NET_READ_SIZE);
+		if (len > 0) {
+			conn->in_len += len;
+			continue;
+		}
+
+		// the requests received before the end are still answered
+		if (!len)
+			conn->eof = 1;
+		else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			conn->closing = 1;
+		return;
+	}
+}
+
+static void net_close(int epoll_fd, net_conn **conns, net_conn *conn)
+{
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+
+	if (conn->prev)
+		conn->prev->next = conn->next;
+	else
+		*conns = conn->next;
+	if (conn->next)
+		conn->next->prev = conn->prev;
+
+	while (conn->out_head) {
+		net_block *next = conn->out_head->next;
+
+		free(conn->out_head);
+		conn->out_head = next;
+	}
+	free(conn->in);
+	free(conn);
+}
+
+/* reads only while the replies keep up, waits for writability if needed */
+static void net_update_events(int epoll_fd, net_conn *conn)
+{
+	unsigned int events = 0;
+
+	if (!conn->eof && conn->out_pending < NET_OUT_LIMIT)
+		events |= EPOLLIN;
+	if (conn->out_head)
+		events |= EPOLLOUT;
+
+	if (events != conn->events) {
+		struct epoll_event event = {.events = events, .data.ptr = conn};
+
+		epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+		conn->events = events;
+	}
+}
+
+static void net_accept(int epoll_fd, int listen_fd, net_conn **conns)
+{
+	int fd;
+	int one = 1;
+
+	while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+		net_conn *conn = calloc(1, sizeof(*conn));
+		DIE(!conn, "calloc() for *conn failed\n");
+
+		conn->fd = fd;
+		conn->events = EPOLLIN;
+		net_set_nonblocking(fd);
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		struct epoll_event event = {.events = EPOLLIN, .data.ptr = conn};
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
+			close(fd);
+			free(conn);
+			continue;
+		}
+
+		conn->next = *conns;
+		if (*conns)
+			(*conns)->prev = conn;
+		*conns = conn;
+	}
+}
+
+/*
+ * Serves a connection that epoll reported: reads, then answers the lines
+ * received while the replies go out.
+ */
+static void net_serve_conn(load_balancer *main, net_conn *conn,
+						   unsigned int events)
+{
+	if (!conn->eof && (events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+		net_read(conn);
+
+	while (!conn->closing) {
+		net_handle_input(main, conn);
+		if (net_flush(conn)) {
+			conn->closing = 1;
+			break;
+		}
+
+		// lines left behind by a full output are served once it drains
+		if (conn->out_pending >= NET_OUT_LIMIT || !conn->in_len ||
+			!memchr(conn->in, '\n', conn->in_len))
+			break;
+	}
+
+	// done once the last replies are sent (an unfinished line is dropped)
+	if (conn->eof && !conn->out_head &&
+		(!conn->in_len || !memchr(conn->in, '\n', conn->in_len)))
+		conn->closing = 1;
+}
+
+int net_serve(load_balancer *main, const char *host, int port,
+			  volatile sig_atomic_t *stop)
+{
+	struct epoll_event events[NET_MAX_EVENTS];
+	net_conn *conns = NULL;
+	int listen_fd = net_listen(host, port);
+
+	if (listen_fd < 0)
+		return -1;
+
+	int epoll_fd = epoll_create1(0);
+	struct epoll_event listen_event = {.events = EPOLLIN, .data.ptr = NULL};
+
+	if (epoll_fd < 0 ||
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event)) {
+		close(listen_fd);
+		if (epoll_fd >= 0)
+			close(epoll_fd);
+		return -1;
+	}
+
+	// a client that leaves breaks the connection, not the server
+	signal(SIGPIPE, SIG_IGN);
+
+	while (!*stop) {
+		int ready = epoll_wait(epoll_fd, events, NET_MAX_EVENTS, NET_IDLE_MS);
+
+		if (ready <= 0) {
+			// idle: pending migrations, compactions and WAL commits go on
+			// in the background
+			loader_background_step(main);
+			continue;
+		}
+
+		for (int i = 0; i < ready; i++) {
+			net_conn *conn = events[i].data.ptr;
+
+			if (!conn) {
+				net_accept(epoll_fd, listen_fd, &conns);
+				continue;
+			}
+
+			net_serve_conn(main, conn, events[i].events);
+			if (conn->closing)
+				net_close(epoll_fd, &conns, conn);
+			else
+				net_update_events(epoll_fd, conn);
+		}
+	}
+
+	while (conns)
+		net_close(epoll_fd, &conns, conns);
+	close(epoll_fd);
+	close(listen_fd);
+	return 0;
+}
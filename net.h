@@ -0,0 +1,50 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#ifndef NET_H_
+#define NET_H_
+
+#include <signal.h>
+#include "load_balancer.h"
+
+/*
+ * Network mode: a single-threaded epoll reactor that serves the load
+ * balancer over TCP with the line protocol of the request files:
+ *
+ *   store "<key>" "<value>" [ttl]  ->  Stored <value> on server <id>.
+ *   retrieve "<key>"               ->  Retrieved <value> from server <id>.
+ *                                      or Key <key> not present.
+ *   add_server <id>                ->  OK
+ *   remove_server <id>             ->  OK
+ *
+ * and `ERR <reason>` for a request that cannot be served. Clients may
+ * pipeline requests: every complete line of the receive buffer is parsed in
+ * place and answered in order, and the replies of a batch are sent with one
+ * writev() of the output blocks. A connection whose replies pile up
+ * (NET_OUT_LIMIT) is not read until they are sent.
+ *
+ * As in the batch mode, the clock of the TTLs counts requests and pending
+ * lazy migrations advance after every request (and while idle).
+ */
+
+#define NET_MAX_EVENTS 64
+#define NET_READ_SIZE 65536
+#define NET_MAX_LINE (70 * 1024)  /* a store of the longest key and value */
+#define NET_OUT_BLOCK 16384
+#define NET_OUT_LIMIT (4 * 1024 * 1024)
+#define NET_MAX_IOV 64
+#define NET_IDLE_MS 100
+
+/**
+ * net_serve() - Serves the load balancer until *stop is set.
+ *
+ * @arg1: Load balancer.
+ * @arg2: Address to listen on (e.g. "127.0.0.1"; NULL: all interfaces).
+ * @arg3: TCP port.
+ * @arg4: Set (e.g. by a signal handler) to close the connections and
+ *        return.
+ *
+ * Return: 0 on a clean stop, -1 if the socket could not be set up.
+ */
+int net_serve(load_balancer *main, const char *host, int port,
+			  volatile sig_atomic_t *stop);
+
+#endif  // NET_H_
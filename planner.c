@@ -0,0 +1,367 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#include "utils.h"
+#include "planner.h"
+
+/* hashring built on the side: hashes are computed once, kept sorted */
+typedef struct plan_ring plan_ring;
+struct plan_ring {
+	int no_points;
+	unsigned int *hashes;
+	int *labels;
+};
+
+typedef struct plan_point plan_point;
+struct plan_point {
+	unsigned int hash;
+	int label;
+};
+
+/* arc (start, end] that a new point takes over */
+typedef struct plan_arc plan_arc;
+struct plan_arc {
+	unsigned int start;
+	unsigned int end;
+	int label;
+};
+
+static int compare_plan_points(const void *a, const void *b)
+{
+	const plan_point *point_a = a;
+	const plan_point *point_b = b;
+
+	if (point_a->hash != point_b->hash)
+		return point_a->hash < point_b->hash ? -1 : 1;
+	return point_a->label - point_b->label;
+}
+
+static int compare_migration_flows(const void *a, const void *b)
+{
+	const migration_flow *flow_a = a;
+	const migration_flow *flow_b = b;
+
+	if (flow_a->source != flow_b->source)
+		return flow_a->source - flow_b->source;
+	return flow_a->dest - flow_b->dest;
+}
+
+static void plan_ring_init(plan_ring *ring, int max_no_points)
+{
+	ring->no_points = 0;
+	ring->hashes = malloc((max_no_points + 1) * sizeof(*ring->hashes));
+	DIE(!ring->hashes, "malloc() for ring->hashes failed\n");
+	ring->labels = malloc((max_no_points + 1) * sizeof(*ring->labels));
+	DIE(!ring->labels, "malloc() for ring->labels failed\n");
+}
+
+static void plan_ring_push(plan_ring *ring, unsigned int hash, int label)
+{
+	ring->hashes[ring->no_points] = hash;
+	ring->labels[ring->no_points] = label;
+	ring->no_points++;
+}
+
+static void plan_ring_free(plan_ring *ring)
+{
+	free(ring->hashes);
+	free(ring->labels);
+}
+
+/* same routing as hashring_find_server(), over the virtual ring */
+static int plan_ring_find_server(plan_ring *ring, unsigned int hash)
+{
+	if (!ring->no_points)
+		return -1;
+
+	// first point with hash_point >= hash (binary search)
+	int start = 0;
+	int end = ring->no_points;
+
+	while (start < end) {
+		int mid = start + (end - start) / 2;  // avoid overflow
+
+		if (ring->hashes[mid] < hash)
+			start = mid + 1;
+		else
+			end = mid;
+	}
+
+	// past the last point: the first one (circular vector)
+	if (start == ring->no_points)
+		start = 0;
+
+	return ring->labels[start] % MAX_SERVERS;
+}
+
+static void plan_init(migration_plan *plan)
+{
+	memset(plan, 0, sizeof(*plan));
+}
+
+/* adds keys to the (source, dest) flow of the plan */
+static void plan_add_flow(migration_plan *plan, int source, int dest,
+						  unsigned long long bytes)
+{
+	// the flows of one server are few and scanned in a row,
+	// so the last matching flow is searched first
+	for (int i = plan->no_flows - 1; i >= 0; i--) {
+		migration_flow *flow = &plan->flows[i];
+
+		if (flow->source != source)
+			break;
+		if (flow->dest == dest) {
+			flow->keys++;
+			flow->bytes += bytes;
+			plan->total_keys++;
+			plan->total_bytes += bytes;
+			return;
+		}
+	}
+
+	if (plan->no_flows == plan->max_no_flows) {
+		plan->max_no_flows = plan->max_no_flows ? 2 * plan->max_no_flows : 8;
+		plan->flows = realloc(plan->flows,
+							  plan->max_no_flows * sizeof(*plan->flows));
+		DIE(!plan->flows, "realloc() for plan->flows failed\n");
+	}
+
+	migration_flow *flow = &plan->flows[plan->no_flows++];
+	flow->source = source;
+	flow->dest = dest;
+	flow->keys = 1;
+	flow->bytes = bytes;
+	plan->total_keys++;
+	plan->total_bytes += bytes;
+}
+
+/*
+ * Server that takes over a hash when servers are added: the label of the
+ * arc that holds it (the arcs are sorted by end), else the current owner.
+ */
+static int plan_arcs_find_server(const plan_arc *arcs, int no_arcs,
+								 unsigned int hash, int owner)
+{
+	int start = 0;
+	int end = no_arcs;
+
+	while (start < end) {
+		int mid = start + (end - start) / 2;  // avoid overflow
+
+		if (arcs[mid].end < hash)
+			start = mid + 1;
+		else
+			end = mid;
+	}
+
+	// past the last end, only the first arc may hold the hash (wrapping)
+	if (start == no_arcs)
+		start = 0;
+
+	if (hashring_arc_contains(arcs[start].start, arcs[start].end, hash))
+		return arcs[start].label % MAX_SERVERS;
+	return owner;
+}
+
+/* state of the scan of one server */
+typedef struct plan_scan plan_scan;
+struct plan_scan {
+	int server_id;
+	plan_ring *ring;
+	/* additions: the arcs of the new points (NULL: route through ring) */
+	const plan_arc *arcs;
+	int no_arcs;
+	migration_plan *plan;
+};
+
+static void plan_scan_entry(info *pair, void *ctx)
+{
+	plan_scan *scan = (plan_scan *)ctx;
+	int dest = scan->arcs ?
+			   plan_arcs_find_server(scan->arcs, scan->no_arcs, pair->hash,
+									 scan->server_id) :
+			   plan_ring_find_server(scan->ring, pair->hash);
+
+	if (dest != scan->server_id)
+		plan_add_flow(scan->plan, scan->server_id, dest,
+					  pair->key_size + pair->value_size);
+
+	scan->plan->scanned_keys++;
+}
+
+/* routes every entry of a server through the virtual ring (or arcs) */
+static void plan_scan_server(load_balancer *main, int server_id,
+							 plan_ring *ring, const plan_arc *arcs,
+							 int no_arcs, migration_plan *plan)
+{
+	plan_scan scan = {server_id, ring, arcs, no_arcs, plan};
+
+	// one slice: nothing changes the server while it is planned
+	ht_scan(main->servers[server_id]->memory, 0, ~0u, plan_scan_entry, &scan);
+}
+
+/* whether the planner covers the layout of the load balancer */
+static int plan_supported(load_balancer *main)
+{
+	return !main->zones && main->replication <= 1;
+}
+
+static void plan_finish(migration_plan *plan)
+{
+	if (plan->no_flows)
+		qsort(plan->flows, plan->no_flows, sizeof(*plan->flows),
+			  compare_migration_flows);
+}
+
+int loader_plan_add_servers(load_balancer *main, const int *server_ids,
+							int count, migration_plan *plan)
+{
+	plan_init(plan);
+	if (!plan_supported(main))
+		return -1;
+
+	char *marked = calloc(MAX_SERVERS, sizeof(*marked));
+	DIE(!marked, "calloc() for marked failed\n");
+	plan_point *points = malloc((REPLICAS * count + 1) * sizeof(*points));
+	DIE(!points, "malloc() for points failed\n");
+	int no_points = 0;
+
+	// replicas of the new servers (existing and repeated IDs are ignored)
+	for (int i = 0; i < count; i++) {
+		int server_id = server_ids[i] % MAX_SERVERS;
+
+		if (server_id < 0 || main->servers[server_id] || marked[server_id])
+			continue;
+		marked[server_id] = 1;
+
+		for (int r = 0; r < REPLICAS; r++) {
+			points[no_points].label = MAX_SERVERS * r + server_id;
+			points[no_points].hash =
+				hash_function_servers(&points[no_points].label);
+			no_points++;
+		}
+	}
+	qsort(points, no_points, sizeof(*points), compare_plan_points);
+
+	// merge the (sorted) current ring with the new points
+	plan_ring ring;
+	plan_ring_init(&ring, main->ring.no_points + no_points);
+
+	hashring_pos old = hashring_begin(&main->ring);
+	int new = 0;
+	while (old.leaf || new < no_points) {
+		unsigned int old_hash = 0;
+
+		if (old.leaf)
+			old_hash = hashring_pos_hash(old);
+
+		if (new == no_points ||
+			(old.leaf && old_hash <= points[new].hash)) {
+			plan_ring_push(&ring, old_hash, hashring_pos_label(old));
+			hashring_step(&old);
+		} else {
+			plan_ring_push(&ring, points[new].hash, points[new].label);
+			new++;
+		}
+	}
+
+	// the arcs taken by the new points, in ring order: only the entries
+	// in them move, so the others are not routed through the whole ring
+	plan_arc *arcs = malloc((no_points + 1) * sizeof(*arcs));
+	DIE(!arcs, "malloc() for arcs failed\n");
+	int no_arcs = 0;
+
+	for (int i = 0; i < ring.no_points; i++) {
+		if (!marked[ring.labels[i] % MAX_SERVERS])
+			continue;
+
+		arcs[no_arcs].start = ring.hashes[i ? i - 1 : ring.no_points - 1];
+		arcs[no_arcs].end = ring.hashes[i];
+		arcs[no_arcs].label = ring.labels[i];
+		no_arcs++;
+	}
+
+	// only the current owners of the arcs taken by new points lose keys
+	memset(marked, 0, MAX_SERVERS * sizeof(*marked));
+	for (int i = 0; i < no_points && main->ring.no_points; i++) {
+		int source = hashring_find_server(main, points[i].hash);
+
+		if (!marked[source] && main->servers[source]) {
+			marked[source] = 1;
+			plan_scan_server(main, source, &ring, arcs, no_arcs, plan);
+		}
+	}
+
+	plan_finish(plan);
+	plan_ring_free(&ring);
+	free(arcs);
+	free(points);
+	free(marked);
+	return 0;
+}
+
+int loader_plan_remove_servers(load_balancer *main, const int *server_ids,
+							   int count, migration_plan *plan)
+{
+	plan_init(plan);
+	if (!plan_supported(main))
+		return -1;
+
+	char *removed = calloc(MAX_SERVERS, sizeof(*removed));
+	DIE(!removed, "calloc() for removed failed\n");
+
+	for (int i = 0; i < count; i++) {
+		int server_id = server_ids[i] % MAX_SERVERS;
+
+		if (server_id >= 0 && main->servers[server_id])
+			removed[server_id] = 1;
+	}
+
+	// the current ring without the replicas of the removed servers
+	plan_ring ring;
+	plan_ring_init(&ring, main->ring.no_points);
+
+	for (hashring_pos pos = hashring_begin(&main->ring); pos.leaf;
+		 hashring_step(&pos)) {
+		int label = hashring_pos_label(pos);
+
+		if (!removed[label % MAX_SERVERS])
+			plan_ring_push(&ring, hashring_pos_hash(pos), label);
+	}
+
+	// the removed servers hand over all their keys
+	for (int i = 0; i < count; i++) {
+		int server_id = server_ids[i] % MAX_SERVERS;
+
+		if (server_id >= 0 && removed[server_id]) {
+			removed[server_id] = 0;  // scan each server once
+			plan_scan_server(main, server_id, &ring, NULL, 0, plan);
+		}
+	}
+
+	plan_finish(plan);
+	plan_ring_free(&ring);
+	free(removed);
+	return 0;
+}
+
+void migration_plan_free(migration_plan *plan)
+{
+	if (!plan)
+		return;
+
+	free(plan->flows);
+	plan_init(plan);
+}
+
+void migration_plan_print(const migration_plan *plan, FILE *out)
+{
+	fprintf(out, "%8s %8s %12s %14s\n", "source", "dest", "keys", "bytes");
+	for (int i = 0; i < plan->no_flows; i++) {
+		migration_flow *flow = &plan->flows[i];
+
+		fprintf(out, "%8d %8d %12llu %14llu\n", flow->source, flow->dest,
+				flow->keys, flow->bytes);
+	}
+
+	fprintf(out, "total: %llu keys, %llu bytes (%llu keys scanned)\n",
+			plan->total_keys, plan->total_bytes, plan->scanned_keys);
+}
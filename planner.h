@@ -0,0 +1,80 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#ifndef PLANNER_H_
+#define PLANNER_H_
+
+#include <stdio.h>
+#include "load_balancer.h"
+
+/*
+ * Dry-run of topology changes: the new hashring is built on the side and
+ * the entries of the servers that would lose keys are routed through it,
+ * without changing anything in the load balancer.
+ *
+ * Only the flat ring with one copy per key is planned: in the zoned mode
+ * the servers are not on main->ring, and with replication the copies that
+ * would be re-placed are not counted, so both are refused.
+ */
+
+typedef struct migration_flow migration_flow;
+struct migration_flow {
+	int source;  /* server the keys would leave */
+	int dest;  /* server the keys would go to (-1: no server left) */
+	unsigned long long keys;
+	unsigned long long bytes;  /* key and value bytes, terminators included */
+};
+
+typedef struct migration_plan migration_plan;
+struct migration_plan {
+	int no_flows;
+	int max_no_flows;
+	migration_flow *flows;  /* sorted by source, then destination */
+
+	unsigned long long total_keys;
+	unsigned long long total_bytes;
+	/* entries examined to build the plan */
+	unsigned long long scanned_keys;
+};
+
+/**
+ * loader_plan_add_servers() - Computes which keys would move, and where,
+ *                             if the given servers were added.
+ *
+ * Only the servers that own the arcs where the new replicas would land are
+ * scanned. IDs of servers that already exist are ignored. Keys that still
+ * wait on a lazy migration (see migration.h) are not counted.
+ *
+ * @arg1: Load balancer (left unchanged).
+ * @arg2: IDs of the servers to be added.
+ * @arg3: Number of IDs.
+ * @arg4: Plan to fill; release it with migration_plan_free().
+ *
+ * Return: 0, or -1 (and an empty plan) in the zoned mode or with
+ * replication.
+ */
+int loader_plan_add_servers(load_balancer *main, const int *server_ids,
+							int count, migration_plan *plan);
+
+/**
+ * loader_plan_remove_servers() - Computes where the keys of the given
+ *                                servers would go if they were removed.
+ *
+ * Only the removed servers are scanned. IDs of servers that do not exist
+ * are ignored.
+ *
+ * @arg1: Load balancer (left unchanged).
+ * @arg2: IDs of the servers to be removed.
+ * @arg3: Number of IDs.
+ * @arg4: Plan to fill; release it with migration_plan_free().
+ *
+ * Return: 0, or -1 (and an empty plan) in the zoned mode or with
+ * replication.
+ */
+int loader_plan_remove_servers(load_balancer *main, const int *server_ids,
+							   int count, migration_plan *plan);
+
+void migration_plan_free(migration_plan *plan);
+
+/* migration_plan_print() - Prints one line per source -> dest pair. */
+void migration_plan_print(const migration_plan *plan, FILE *out);
+
+#endif  // PLANNER_H_
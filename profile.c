@@ -0,0 +1,251 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "utils.h"
+#include "latency.h"
+#include "profile.h"
+
+static const char *prof_region_names[PROF_REGIONS] = {
+	"routing", "ht_get", "ht_put", "migration", "parsing"
+};
+
+static const struct {
+	unsigned int type;
+	unsigned long long config;
+} prof_events[PROF_COUNTERS] = {
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+						 PERF_COUNT_HW_CACHE_OP_READ << 8 |
+						 PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+typedef struct prof_thread prof_thread;
+struct prof_thread {
+	int fds[PROF_COUNTERS];  /* -1: the counter could not be opened */
+	int leader;  /* first open counter, read for the group (-1: none) */
+	/* position of the value of each counter in a read of the group */
+	int slots[PROF_COUNTERS];
+	/* time the group was enabled / on the PMU, at the last read (ns) */
+	unsigned long long enabled, running;
+	prof_totals regions[PROF_REGIONS];
+};
+
+/* state of every profiled thread, merged on demand by prof_collect() */
+static prof_thread *prof_threads[PROF_MAX_THREADS];
+static unsigned int prof_no_threads;
+static __thread prof_thread *prof_local;
+
+static int prof_open_counter(prof_counter counter, int group_fd)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = prof_events[counter].type;
+	attr.config = prof_events[counter].config;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+					   PERF_FORMAT_TOTAL_TIME_RUNNING;
+	// the members follow their leader, which starts once they are all open
+	attr.disabled = group_fd < 0;
+	// user space only: also allowed with perf_event_paranoid = 2
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	// the calling thread, on any CPU
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+/* opens the counters of the calling thread and registers its totals */
+static prof_thread *prof_open(void)
+{
+	unsigned int slot = __atomic_fetch_add(&prof_no_threads, 1,
+										   __ATOMIC_RELAXED);
+	DIE(slot >= PROF_MAX_THREADS, "too many threads profiled");
+
+	prof_thread *thread = calloc(1, sizeof(*thread));
+	DIE(!thread, "calloc() for thread failed\n");
+
+	int no_slots = 0;
+
+	thread->leader = -1;
+	for (int c = 0; c < PROF_COUNTERS; c++) {
+		thread->fds[c] = prof_open_counter(c, thread->leader);
+		thread->slots[c] = thread->fds[c] < 0 ? -1 : no_slots++;
+		if (thread->leader < 0)
+			thread->leader = thread->fds[c];
+	}
+
+	if (thread->leader >= 0) {
+		ioctl(thread->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(thread->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+
+	prof_local = thread;
+	__atomic_store_n(&prof_threads[slot], thread, __ATOMIC_RELEASE);
+	return thread;
+}
+
+void prof_read(prof_sample *sample)
+{
+	prof_thread *thread = prof_local ? prof_local : prof_open();
+	// number of counters, time enabled, time running, then their values
+	unsigned long long values[3 + PROF_COUNTERS];
+
+	memset(sample->counts, 0, sizeof(sample->counts));
+	if (thread->leader >= 0 &&
+		read(thread->leader, values, sizeof(values)) > 0) {
+		thread->enabled = values[1];
+		thread->running = values[2];
+		for (int c = 0; c < PROF_COUNTERS; c++)
+			if (thread->slots[c] >= 0)
+				sample->counts[c] = values[3 + thread->slots[c]];
+	}
+
+	sample->ns = lat_now_ns();
+}
+
+void prof_record(prof_region region, const prof_sample *start)
+{
+	prof_sample end;
+
+	prof_read(&end);
+
+	prof_totals *totals = &prof_local->regions[region];
+	totals->calls++;
+	totals->sum.ns += end.ns - start->ns;
+	for (int c = 0; c < PROF_COUNTERS; c++)
+		totals->sum.counts[c] += end.counts[c] - start->counts[c];
+}
+
+unsigned int prof_collect(prof_totals *out)
+{
+	unsigned int mask = 0;
+	int first = 1;
+
+	memset(out, 0, PROF_REGIONS * sizeof(*out));
+
+	// the totals are read without stopping the writers, so a snapshot
+	// taken while other threads record may be off by a few calls
+	unsigned int no_threads = __atomic_load_n(&prof_no_threads,
+											  __ATOMIC_RELAXED);
+	for (unsigned int i = 0; i < no_threads && i < PROF_MAX_THREADS; i++) {
+		prof_thread *thread = __atomic_load_n(&prof_threads[i],
+											  __ATOMIC_ACQUIRE);
+		if (!thread)
+			continue;
+
+		// a group that never got on the PMU counted nothing
+		unsigned int thread_mask = 0;
+		for (int c = 0; c < PROF_COUNTERS; c++)
+			if (thread->slots[c] >= 0 && thread->running)
+				thread_mask |= 1u << c;
+		mask = first ? thread_mask : mask & thread_mask;
+		first = 0;
+
+		for (int r = 0; r < PROF_REGIONS; r++) {
+			out[r].calls += thread->regions[r].calls;
+			out[r].sum.ns += thread->regions[r].sum.ns;
+			for (int c = 0; c < PROF_COUNTERS; c++)
+				out[r].sum.counts[c] += thread->regions[r].sum.counts[c];
+		}
+	}
+
+	return mask;
+}
+
+/* share of the time the counters of all threads were on the PMU */
+static double prof_running_share(void)
+{
+	unsigned long long enabled = 0, running = 0;
+	unsigned int no_threads = __atomic_load_n(&prof_no_threads,
+											  __ATOMIC_RELAXED);
+
+	for (unsigned int i = 0; i < no_threads && i < PROF_MAX_THREADS; i++) {
+		prof_thread *thread = __atomic_load_n(&prof_threads[i],
+											  __ATOMIC_ACQUIRE);
+		if (thread) {
+			enabled += thread->enabled;
+			running += thread->running;
+		}
+	}
+
+	return enabled ? (double)running / enabled : 1.0;
+}
+
+/* prints the mean of a counter per call, or "-" if it was not counted */
+static void prof_print_mean(FILE *out, const prof_totals *totals,
+							unsigned int mask, prof_counter counter)
+{
+	if (mask & 1u << counter)
+		fprintf(out, " %10.1f",
+				(double)totals->sum.counts[counter] / totals->calls);
+	else
+		fprintf(out, " %10s", "-");
+}
+
+void prof_dump(FILE *out)
+{
+	prof_totals totals[PROF_REGIONS];
+	unsigned int mask = prof_collect(totals);
+	unsigned int ipc_mask = 1u << PROF_CYCLES | 1u << PROF_INSTRUCTIONS;
+
+	fprintf(out, "%-10s %10s %10s %10s %10s %6s %10s %10s %10s\n",
+			"per call", "calls", "ns", "cycles", "instr", "IPC",
+			"L1d-miss", "LLC-miss", "br-miss");
+	for (int r = 0; r < PROF_REGIONS; r++) {
+		prof_totals *region = &totals[r];
+		if (!region->calls)
+			continue;
+
+		fprintf(out, "%-10s %10llu %10.1f", prof_region_names[r],
+				region->calls, (double)region->sum.ns / region->calls);
+		prof_print_mean(out, region, mask, PROF_CYCLES);
+		prof_print_mean(out, region, mask, PROF_INSTRUCTIONS);
+		if ((mask & ipc_mask) == ipc_mask && region->sum.counts[PROF_CYCLES])
+			fprintf(out, " %6.2f",
+					(double)region->sum.counts[PROF_INSTRUCTIONS] /
+					region->sum.counts[PROF_CYCLES]);
+		else
+			fprintf(out, " %6s", "-");
+		prof_print_mean(out, region, mask, PROF_L1D_MISSES);
+		prof_print_mean(out, region, mask, PROF_LLC_MISSES);
+		prof_print_mean(out, region, mask, PROF_BRANCH_MISSES);
+		fprintf(out, "\n");
+	}
+
+	if (!mask) {
+		fprintf(out, "hardware counters unavailable: wall-clock time only\n");
+	} else {
+		// the kernel time-shares the PMU between more counters than it has
+		double share = prof_running_share();
+		if (share < 1.0)
+			fprintf(out, "counters on the PMU %.0f%% of the time "
+					"(the values are not scaled)\n", share * 100);
+	}
+}
+
+void prof_free(void)
+{
+	unsigned int no_threads = __atomic_load_n(&prof_no_threads,
+											  __ATOMIC_RELAXED);
+	for (unsigned int i = 0; i < no_threads && i < PROF_MAX_THREADS; i++) {
+		prof_thread *thread = prof_threads[i];
+		if (!thread)
+			continue;
+
+		for (int c = 0; c < PROF_COUNTERS; c++)
+			if (thread->fds[c] >= 0)
+				close(thread->fds[c]);
+		free(thread);
+		prof_threads[i] = NULL;
+	}
+
+	prof_no_threads = 0;
+	prof_local = NULL;
+}
@@ -0,0 +1,99 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdio.h>
+
+/*
+ * Hardware counters per named region of the hot paths: the cycles,
+ * instructions, L1 data cache read misses, last-level cache misses and
+ * branch misses spent in the region, with its wall-clock time.
+ *
+ * Every thread opens its own group of perf_event_open() counters (user
+ * space only) on its first sample, and a sample is one read() of the whole
+ * group. Counters the kernel refuses (containers, perf_event_paranoid,
+ * virtual machines without a PMU) are left out of the report, and with none
+ * at all only the wall-clock time is kept.
+ *
+ * A region nested in another one (ht_put in migration, for instance) is
+ * counted in both. Reading the counters costs a system call at both ends of
+ * a region, which shows in the wall-clock time of the shortest ones, but
+ * not in their counters.
+ *
+ * Sampling is compiled in only when LB_PROFILE is defined
+ * (`make PROFILE=1`); otherwise PROF_BEGIN()/PROF_END() expand to nothing.
+ */
+
+/* maximum number of threads that can be profiled at the same time */
+#define PROF_MAX_THREADS 64
+
+typedef enum prof_region {
+	PROF_ROUTING,  /* finding the server of a hash (ring or zones) */
+	PROF_HT_GET,  /* lookups in the table of a server */
+	PROF_HT_PUT,  /* insertions in the table of a server */
+	PROF_MIGRATION,  /* keys moved between servers, eagerly or lazily */
+	PROF_PARSING,  /* parsing the requests (batch and network mode) */
+	PROF_REGIONS
+} prof_region;
+
+typedef enum prof_counter {
+	PROF_CYCLES,
+	PROF_INSTRUCTIONS,
+	PROF_L1D_MISSES,
+	PROF_LLC_MISSES,
+	PROF_BRANCH_MISSES,
+	PROF_COUNTERS
+} prof_counter;
+
+typedef struct prof_sample prof_sample;
+struct prof_sample {
+	unsigned long long ns;
+	unsigned long long counts[PROF_COUNTERS];
+};
+
+typedef struct prof_totals prof_totals;
+struct prof_totals {
+	unsigned long long calls;
+	prof_sample sum;  /* summed over the calls */
+};
+
+/*
+ * prof_read() - Reads the wall clock and the counters of the calling thread
+ * (opened on its first call).
+ */
+void prof_read(prof_sample *sample);
+
+/*
+ * prof_record() - Adds the time and the counters elapsed since a sample to
+ * the totals of a region, for the calling thread.
+ */
+void prof_record(prof_region region, const prof_sample *start);
+
+/**
+ * prof_collect() - Sums the totals of every profiled thread.
+ *
+ * @arg1: Totals of each region (PROF_REGIONS of them).
+ *
+ * Return: mask of the counters (1 << prof_counter) that every profiled
+ *         thread could open.
+ */
+unsigned int prof_collect(prof_totals *out);
+
+/*
+ * prof_dump() - Prints, for every region entered, its calls and the mean
+ * time, counters and instructions per cycle of a call.
+ */
+void prof_dump(FILE *out);
+
+/* prof_free() - Closes the counters and frees the totals of all threads. */
+void prof_free(void);
+
+#ifdef LB_PROFILE
+#define PROF_BEGIN(start) prof_sample start; prof_read(&start)
+#define PROF_END(region, start) prof_record((region), &(start))
+#else
+#define PROF_BEGIN(start)
+#define PROF_END(region, start)
+#endif
+
+#endif  // PROFILE_H_
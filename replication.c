@@ -0,0 +1,226 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#include "utils.h"
+#include "replication.h"
+#include "migration.h"
+#include "profile.h"
+
+/* state of the re-replication of one server */
+typedef struct replica_repair replica_repair;
+struct replica_repair {
+	load_balancer *main;
+	int server_id;  /* server whose entries are checked */
+};
+
+/* number of copies of each key, within the supported range */
+static int replication_count(load_balancer *main)
+{
+	if (main->replication < 1)
+		return 1;
+	if (main->replication > MAX_REPLICATION)
+		return MAX_REPLICATION;
+	return main->replication;
+}
+
+/* adds a server ID to a small set, if it is not in it yet */
+static int replica_set_add(int *server_ids, int count, int server_id)
+{
+	for (int i = 0; i < count; i++)
+		if (server_ids[i] == server_id)
+			return count;
+
+	server_ids[count] = server_id;
+	return count + 1;
+}
+
+int hashring_preference_list(load_balancer *main, unsigned int hash,
+							 int *server_ids, int count)
+{
+	hashring_pos pos = hashring_seek(&main->ring, hash);
+	int found = 0;
+
+	// walk clockwise from the owner, skipping the servers already found
+	for (int i = 0; i < main->ring.no_points && found < count; i++) {
+		found = replica_set_add(server_ids, found,
+								hashring_pos_label(pos) % MAX_SERVERS);
+		hashring_next(&main->ring, &pos);
+	}
+
+	return found;
+}
+
+int replication_store(load_balancer *main, const void *key, size_t key_len,
+					  unsigned int hash, const void *value, size_t value_len,
+					  unsigned long long expires)
+{
+	int server_ids[MAX_REPLICATION];
+	int count = hashring_preference_list(main, hash, server_ids,
+										 replication_count(main));
+
+	for (int i = 0; i < count; i++) {
+		server_memory *server = main->servers[server_ids[i]];
+
+		ht_set_clock(server->memory, main->now);
+		server_store_len(server, key, key_len, value, value_len, expires);
+	}
+
+	return count ? server_ids[0] : 0;
+}
+
+char *replication_retrieve(load_balancer *main, const void *key,
+						   size_t key_len, unsigned int hash,
+						   size_t *value_len, int *server_id)
+{
+	int server_ids[MAX_REPLICATION];
+	int count = hashring_preference_list(main, hash, server_ids,
+										 replication_count(main));
+
+	*server_id = count ? server_ids[0] : 0;
+	if (!count)
+		return NULL;
+
+	// the reads of a key go to its servers in turn; a copy lost to an
+	// eviction is looked for on the others
+	int first = main->next_read++ % count;
+
+	for (int i = 0; i < count; i++) {
+		int curr_id = server_ids[(first + i) % count];
+		server_memory *server = main->servers[curr_id];
+
+		ht_set_clock(server->memory, main->now);
+		char *value = server_retrieve_len(server, key, key_len, value_len);
+		if (value) {
+			*server_id = curr_id;
+			server->hits++;
+			return value;
+		}
+	}
+
+	main->servers[server_ids[first]]->misses++;
+	return NULL;
+}
+
+/*
+ * Makes the copies of an entry that are missing from its preference list.
+ * Returns where the entry itself goes: NULL if the repaired server is
+ * still in the list, else a server that missed it (relinked there) or one
+ * that already has it (the entry is dropped by the move).
+ */
+static hashtable_t *replica_repair_dest(info *entry, void *ctx)
+{
+	replica_repair *repair = (replica_repair *)ctx;
+	load_balancer *main = repair->main;
+	int server_ids[MAX_REPLICATION];
+	int count = hashring_preference_list(main, entry->hash, server_ids,
+										 replication_count(main));
+	// the stored key ends with its terminator
+	size_t key_len = entry->key_size - 1;
+	server_memory *relink = NULL;
+	char *value = NULL;
+	size_t value_len = 0;
+	int keep = 0;
+
+	if (!count)
+		return NULL;
+
+	for (int i = 0; i < count; i++)
+		if (server_ids[i] == repair->server_id)
+			keep = 1;
+
+	for (int i = 0; i < count; i++) {
+		server_memory *server = main->servers[server_ids[i]];
+
+		if (server_ids[i] == repair->server_id ||
+			ht_has_key_len(server->memory, entry->key, key_len) == 1)
+			continue;
+
+		// the entry itself goes to the first server that misses it
+		if (!keep && !relink) {
+			relink = server;
+			continue;
+		}
+
+		// a compressed value is copied as the clients stored it
+		if (!value)
+			value = server_entry_value(main->servers[repair->server_id],
+									   entry, &value_len);
+		server_store_len(server, entry->key, key_len, value, value_len,
+						 entry->timer ? entry->timer->expires : 0);
+	}
+
+	if (keep)
+		return NULL;
+	return relink ? relink->memory : main->servers[server_ids[0]]->memory;
+}
+
+static void replica_repair_server(load_balancer *main, int server_id)
+{
+	PROF_BEGIN(prof_start);
+	replica_repair repair = {main, server_id};
+
+	ht_move_entries(main->servers[server_id]->memory, replica_repair_dest,
+					&repair);
+	PROF_END(PROF_MIGRATION, prof_start);
+}
+
+void replication_add_server(load_balancer *main, int server_id)
+{
+	int count = replication_count(main);
+	int candidates[2 * REPLICAS * MAX_REPLICATION];
+	int no_candidates = 0;
+
+	// the keys that gain a copy on the new server, or lose one because of
+	// it, are held by the `count` distinct servers on each side of its
+	// replicas
+	for (int r = 0; r < REPLICAS; r++) {
+		unsigned int label = MAX_SERVERS * r + server_id;
+		hashring_pos start = hashring_seek(&main->ring,
+										   hash_function_servers(&label));
+
+		for (int dir = -1; dir <= 1; dir += 2) {
+			hashring_pos pos = start;
+			int seen[MAX_REPLICATION];
+			int no_seen = 0;
+
+			for (int step = 1; step < main->ring.no_points &&
+				 no_seen < count; step++) {
+				if (dir < 0)
+					hashring_prev(&main->ring, &pos);
+				else
+					hashring_next(&main->ring, &pos);
+				int curr_id = hashring_pos_label(pos) % MAX_SERVERS;
+
+				if (curr_id == server_id)
+					continue;
+
+				no_seen = replica_set_add(seen, no_seen, curr_id);
+				no_candidates = replica_set_add(candidates, no_candidates,
+												curr_id);
+			}
+		}
+	}
+
+	for (int i = 0; i < no_candidates; i++)
+		replica_repair_server(main, candidates[i]);
+
+	server_fit_budget(main->servers[server_id]);
+}
+
+void replication_remove_server(load_balancer *main, int server_id)
+{
+	// the server is off the hashring, so none of its entries stays
+	if (main->ring.no_points)
+		replica_repair_server(main, server_id);
+}
+
+void loader_set_replication(load_balancer *main, int replication)
+{
+	// the copies are placed by the hashring, not by pending migrations
+	loader_migrate_all(main);
+
+	main->replication = replication;
+	main->replication = replication_count(main);
+
+	for (int i = 0; i < MAX_SERVERS; i++)
+		if (main->servers[i])
+			replica_repair_server(main, i);
+}
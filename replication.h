@@ -0,0 +1,78 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#ifndef REPLICATION_H_
+#define REPLICATION_H_
+
+#include "load_balancer.h"
+
+/*
+ * Replication factor N (main->replication, 1 by default): every key is
+ * stored on the first N distinct servers found clockwise from its hash (its
+ * preference list), and the reads are spread over them round-robin.
+ *
+ * When a server is added or removed, only the servers that can share keys
+ * with it (the N distinct servers on each side of its replicas) are
+ * re-replicated: missing copies are made, and the copies of the servers
+ * that left a preference list are moved or dropped. With N > 1 the keys
+ * are always redistributed eagerly (main->lazy_migration is ignored).
+ */
+
+#define MAX_REPLICATION 16
+
+/**
+ * hashring_preference_list() - Finds the servers that hold a hash.
+ *
+ * @arg1: Load balancer.
+ * @arg2: Hash of a key.
+ * @arg3: Array that receives the server IDs, owner first.
+ * @arg4: Number of servers wanted (at most MAX_REPLICATION).
+ *
+ * Return: the number of servers found (less than asked if the system has
+ *         fewer servers).
+ */
+int hashring_preference_list(load_balancer *main, unsigned int hash,
+							 int *server_ids, int count);
+
+/*
+ * replication_store() - Stores a pair (see loader_store_len()), whose key
+ * has the given hash, on all its servers; returns the owner.
+ */
+int replication_store(load_balancer *main, const void *key, size_t key_len,
+					  unsigned int hash, const void *value, size_t value_len,
+					  unsigned long long expires);
+
+/**
+ * replication_retrieve() - Reads a key from one of its servers, chosen
+ *                          round-robin (the others are tried on a miss).
+ *
+ * @arg1: Load balancer.
+ * @arg2: Key.
+ * @arg3: Length of the key, in bytes.
+ * @arg4: Hash of the key.
+ * @arg5: Returns the length of the value.
+ * @arg6: Returns the ID of the server that was read (or the owner).
+ *
+ * Return: the value, or NULL.
+ */
+char *replication_retrieve(load_balancer *main, const void *key,
+						   size_t key_len, unsigned int hash,
+						   size_t *value_len, int *server_id);
+
+/* replication_add_server() - Re-replicates after a server was added. */
+void replication_add_server(load_balancer *main, int server_id);
+
+/*
+ * replication_remove_server() - Hands the keys of a server (already taken
+ * off the hashring) over to the servers that replace it.
+ */
+void replication_remove_server(load_balancer *main, int server_id);
+
+/**
+ * loader_set_replication() - Changes the replication factor and
+ *                            re-replicates every server.
+ *
+ * @arg1: Load balancer.
+ * @arg2: Number of copies of each key (1 to MAX_REPLICATION).
+ */
+void loader_set_replication(load_balancer *main, int replication);
+
+#endif  // REPLICATION_H_
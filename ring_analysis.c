@@ -0,0 +1,263 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#include <math.h>
+#include "utils.h"
+#include "ring_analysis.h"
+
+/*
+ * Size of the arc owned by the point at the given position: the hashes in
+ * (hash of the previous point, hash of the point], wrapping around for the
+ * first point of the ring.
+ */
+static unsigned long long point_arc(load_balancer *main, hashring_pos pos)
+{
+	int n = main->ring.no_points;
+	hashring_pos prev_pos = pos;
+
+	hashring_prev(&main->ring, &prev_pos);
+	unsigned long long curr = hashring_pos_hash(pos);
+	unsigned long long prev = hashring_pos_hash(prev_pos);
+
+	if (n == 1)
+		return RING_SPACE;
+
+	return (curr - prev + RING_SPACE) % RING_SPACE;
+}
+
+/* clockwise distance from hash a to hash b */
+static unsigned long long ring_distance(unsigned int a, unsigned int b)
+{
+	return (unsigned int)(b - a);
+}
+
+/* LSD radix sort for values < 2^33, 11 bits per pass (aux: n values) */
+static void radix_sort(unsigned long long *values, unsigned long long *aux,
+					   int n)
+{
+	for (int shift = 0; shift < 33; shift += 11) {
+		int count[2049] = {0};
+
+		for (int i = 0; i < n; i++)
+			count[((values[i] >> shift) & 2047) + 1]++;
+		for (int i = 1; i < 2049; i++)
+			count[i] += count[i - 1];
+		for (int i = 0; i < n; i++)
+			aux[count[(values[i] >> shift) & 2047]++] = values[i];
+
+		memcpy(values, aux, n * sizeof(*aux));
+	}
+}
+
+/* clears the statistics of a report, keeping (and growing) its buffers */
+static void ring_report_reset(ring_report *report, int no_servers)
+{
+	ring_report buffers = *report;
+
+	memset(report, 0, sizeof(*report));
+	report->max_servers = buffers.max_servers;
+	report->servers = buffers.servers;
+	report->slots = buffers.slots;
+	report->arcs = buffers.arcs;
+
+	if (!report->slots) {
+		report->slots = malloc(MAX_SERVERS * sizeof(*report->slots));
+		DIE(!report->slots, "malloc() for report->slots failed\n");
+	}
+
+	if (report->max_servers < no_servers) {
+		free(report->servers);
+		free(report->arcs);
+		report->max_servers = no_servers;
+		report->servers = malloc(no_servers * sizeof(*report->servers));
+		report->arcs = malloc(2 * no_servers * sizeof(*report->arcs));
+		DIE(!report->servers || !report->arcs, "malloc() failed\n");
+	}
+	memset(report->servers, 0, no_servers * sizeof(*report->servers));
+}
+
+void ring_analyze(load_balancer *main, ring_report *report)
+{
+	if (!main->ring.no_points) {
+		ring_report_free(report);
+		return;
+	}
+
+	// slot of each server in report->servers, indexed by server ID
+	ring_report_reset(report, main->no_servers);
+	int *slot = report->slots;
+
+	// mark the servers as unseen by walking the ring once
+	for (hashring_pos pos = hashring_begin(&main->ring); pos.leaf;
+		 hashring_step(&pos))
+		slot[hashring_pos_label(pos) % MAX_SERVERS] = -1;
+
+	for (hashring_pos pos = hashring_begin(&main->ring); pos.leaf;
+		 hashring_step(&pos)) {
+		int server_id = hashring_pos_label(pos) % MAX_SERVERS;
+
+		if (slot[server_id] == -1) {
+			ring_server_stats *stats = &report->servers[report->no_servers];
+			server_memory *server = main->servers[server_id];
+
+			stats->server_id = server_id;
+			stats->keys = server ? ht_get_size(server->memory) : 0;
+			report->total_keys += stats->keys;
+			slot[server_id] = report->no_servers++;
+		}
+
+		report->servers[slot[server_id]].arc += point_arc(main, pos);
+	}
+
+	int n = report->no_servers;
+	double mean_share = 1.0 / n;
+	double mean_keys = (double)report->total_keys / n;
+	double var_share = 0, var_keys = 0;
+	unsigned long long *arcs = report->arcs;
+
+	report->min_share = 1;
+	report->min_keys = report->servers[0].keys;
+	for (int i = 0; i < n; i++) {
+		ring_server_stats *stats = &report->servers[i];
+
+		stats->share = (double)stats->arc / RING_SPACE;
+		stats->key_share = report->total_keys ?
+			(double)stats->keys / report->total_keys : 0;
+
+		if (stats->share < report->min_share)
+			report->min_share = stats->share;
+		if (stats->share > report->max_share)
+			report->max_share = stats->share;
+		if (stats->keys < report->min_keys)
+			report->min_keys = stats->keys;
+		if (stats->keys > report->max_keys)
+			report->max_keys = stats->keys;
+		if (report->total_keys &&
+			fabs(stats->key_share - stats->share) > report->max_key_skew)
+			report->max_key_skew = fabs(stats->key_share - stats->share);
+
+		var_share += (stats->share - mean_share) *
+					 (stats->share - mean_share);
+		var_keys += (stats->keys - mean_keys) * (stats->keys - mean_keys);
+		arcs[i] = stats->arc;
+	}
+	report->stddev_share = sqrt(var_share / n);
+	report->stddev_keys = sqrt(var_keys / n);
+
+	// Gini coefficient over the ascending shares:
+	// G = 2 * sum(i * x_i) / (n * sum(x_i)) - (n + 1) / n
+	radix_sort(arcs, arcs + n, n);
+	double weighted = 0;
+	for (int i = 0; i < n; i++)
+		weighted += (double)(i + 1) * arcs[i];
+	report->gini = 2 * weighted / ((double)n * RING_SPACE) -
+				   (double)(n + 1) / n;
+}
+
+void ring_report_free(ring_report *report)
+{
+	if (!report)
+		return;
+
+	free(report->servers);
+	free(report->slots);
+	free(report->arcs);
+	memset(report, 0, sizeof(*report));
+}
+
+void ring_report_print(const ring_report *report, FILE *out)
+{
+	fprintf(out, "%8s %10s %10s %10s\n", "server", "share", "keys",
+			"key_share");
+	for (int i = 0; i < report->no_servers; i++) {
+		ring_server_stats *stats = &report->servers[i];
+
+		fprintf(out, "%8d %9.4f%% %10u %9.4f%%\n", stats->server_id,
+				100 * stats->share, stats->keys, 100 * stats->key_share);
+	}
+
+	fprintf(out, "servers: %d, keys: %llu\n", report->no_servers,
+			report->total_keys);
+	fprintf(out, "share: min %.4f%% max %.4f%% stddev %.4f%% gini %.4f\n",
+			100 * report->min_share, 100 * report->max_share,
+			100 * report->stddev_share, report->gini);
+	fprintf(out, "keys: min %u max %u stddev %.2f max skew %.4f%%\n",
+			report->min_keys, report->max_keys, report->stddev_keys,
+			100 * report->max_key_skew);
+}
+
+/* hash space owned by every point of a server (sum of its arcs) */
+static unsigned long long server_arc(load_balancer *main, int server_id)
+{
+	unsigned long long arc = 0;
+
+	for (int i = 0; i < REPLICAS; i++) {
+		unsigned int label = MAX_SERVERS * i + server_id;
+		hashring_pos pos = hashring_seek(&main->ring,
+										 hash_function_servers(&label));
+
+		if (pos.leaf && hashring_pos_label(pos) == (int)label)
+			arc += point_arc(main, pos);
+	}
+
+	return arc;
+}
+
+double ring_predict_add(load_balancer *main, int server_id,
+						unsigned long long *keys_moved)
+{
+	unsigned int hashes[REPLICAS];
+	unsigned long long moved_arc = 0;
+	double moved_keys = 0;
+
+	for (int i = 0; i < REPLICAS; i++) {
+		unsigned int label = MAX_SERVERS * i + server_id;
+		hashes[i] = hash_function_servers(&label);
+	}
+
+	if (!main->ring.no_points) {
+		if (keys_moved)
+			*keys_moved = 0;
+		return 1.0;
+	}
+
+	for (int i = 0; i < REPLICAS; i++) {
+		// the new point takes over (predecessor, point] from its successor
+		hashring_pos next = hashring_seek(&main->ring, hashes[i]);
+		hashring_pos prev_pos = next;
+
+		hashring_prev(&main->ring, &prev_pos);
+		unsigned int prev = hashring_pos_hash(prev_pos);
+		unsigned long long arc = ring_distance(prev, hashes[i]);
+
+		// another new point placed inside the same arc becomes the
+		// predecessor, so the arcs are never counted twice
+		for (int j = 0; j < REPLICAS; j++) {
+			unsigned long long dist = ring_distance(hashes[j], hashes[i]);
+			if (j != i && dist && dist < arc)
+				arc = dist;
+		}
+		moved_arc += arc;
+
+		// keys are assumed to be spread uniformly over the owner's arcs
+		int owner = hashring_pos_label(next) % MAX_SERVERS;
+		unsigned long long owner_arc = server_arc(main, owner);
+		if (owner_arc && main->servers[owner])
+			moved_keys += (double)ht_get_size(main->servers[owner]->memory) *
+						  arc / owner_arc;
+	}
+
+	if (keys_moved)
+		*keys_moved = (unsigned long long)(moved_keys + 0.5);
+	return (double)moved_arc / RING_SPACE;
+}
+
+double ring_predict_remove(load_balancer *main, int server_id,
+						   unsigned long long *keys_moved)
+{
+	server_memory *server = main->servers[server_id % MAX_SERVERS];
+
+	// everything the server owns (and stores) goes to its successors
+	if (keys_moved)
+		*keys_moved = server ? ht_get_size(server->memory) : 0;
+
+	return (double)server_arc(main, server_id % MAX_SERVERS) / RING_SPACE;
+}
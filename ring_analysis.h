@@ -0,0 +1,93 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#ifndef RING_ANALYSIS_H_
+#define RING_ANALYSIS_H_
+
+#include <stdio.h>
+#include "load_balancer.h"
+
+/* size of the hash space covered by the hashring (2^32) */
+#define RING_SPACE 4294967296ull
+
+typedef struct ring_server_stats ring_server_stats;
+struct ring_server_stats {
+	int server_id;
+	unsigned long long arc;  /* hashes owned by the server, out of 2^32 */
+	double share;  /* arc / 2^32 */
+	unsigned int keys;  /* keys actually stored on the server */
+	double key_share;  /* keys / total keys */
+};
+
+typedef struct ring_report ring_report;
+struct ring_report {
+	int no_servers;
+	/* one entry per server, in the order they first appear on the ring */
+	ring_server_stats *servers;
+
+	/* statistics over the hash space shares */
+	double min_share;
+	double max_share;
+	double stddev_share;
+	double gini;  /* 0 = perfectly even split, 1 = one server owns all */
+
+	/* statistics over the stored keys */
+	unsigned long long total_keys;
+	unsigned int min_keys;
+	unsigned int max_keys;
+	double stddev_keys;
+	/* largest |key_share - share| over the servers */
+	double max_key_skew;
+
+	/* buffers kept from one ring_analyze() to the next */
+	int max_servers;  /* room in servers and arcs */
+	int *slots;  /* slot of each server in servers, by ID */
+	unsigned long long *arcs;  /* the arcs to sort, then scratch space */
+};
+
+/**
+ * ring_analyze() - Computes how the hashring splits the 32-bit hash space
+ *                  between the servers and how many keys each one holds.
+ *
+ * Runs in O(points) (the shares are sorted with a radix sort for the Gini
+ * coefficient), so it can be called on rings of MAX_SERVERS servers. The
+ * buffers of the report are reused by the next calls, so a report that is
+ * refreshed allocates nothing once the number of servers stops growing.
+ *
+ * @arg1: Load balancer to analyze.
+ * @arg2: Report to fill, zeroed before its first use; release it with
+ *        ring_report_free().
+ */
+void ring_analyze(load_balancer *main, ring_report *report);
+
+void ring_report_free(ring_report *report);
+
+/* ring_report_print() - Prints the per-server table and the summary. */
+void ring_report_print(const ring_report *report, FILE *out);
+
+/**
+ * ring_predict_add() - Predicts the effect of adding a server.
+ *
+ * @arg1: Load balancer that would receive the server.
+ * @arg2: ID of the proposed server.
+ * @arg3: This function will RETURN via this parameter the estimated
+ *        number of keys that would move (may be NULL). The estimate
+ *        assumes keys are spread uniformly inside each server's arcs.
+ *
+ * Return: fraction of the hash space that would change owner.
+ */
+double ring_predict_add(load_balancer *main, int server_id,
+						unsigned long long *keys_moved);
+
+/**
+ * ring_predict_remove() - Predicts the effect of removing a server.
+ *
+ * @arg1: Load balancer that holds the server.
+ * @arg2: ID of the server to be removed.
+ * @arg3: This function will RETURN via this parameter the number of keys
+ *        that would move (may be NULL).
+ *
+ * Return: fraction of the hash space that would change owner.
+ */
+double ring_predict_remove(load_balancer *main, int server_id,
+						   unsigned long long *keys_moved);
+
+#endif  // RING_ANALYSIS_H_
@@ -1,53 +1,257 @@
 /* Copyright 2023 Munteanu Eugen 315CA */
 #include "hashtable.h"
 #include "server.h"
+#include "profile.h"
 
 server_memory *init_server_memory()
+{
+	return init_server_memory_sized(HMAX);
+}
+
+server_memory *init_server_memory_sized(unsigned int hmax)
 {
 	// allocate new server
 	server_memory *new_server = calloc(1, sizeof(server_memory));
 	DIE(!new_server, "calloc() for *new_server failed\n");
 
 	// create its hashtable, according to the structure
-	new_server->memory = ht_create(HMAX, hash_function_string,
+	new_server->memory = ht_create(hmax, hash_function_string,
 								compare_function_strings, key_val_free_function);
 	return new_server;
 }
 
+/* whether the server compresses a value of the given size */
+static int server_compresses(server_memory *server, unsigned int value_size) {
+	return server->codec && server->compress_min &&
+		   value_size >= server->compress_min;
+}
+
 void server_store(server_memory *server, char *key, char *value) {
+	server_store_ttl(server, key, value, 0);
+}
+
+void server_store_ttl(server_memory *server, char *key, char *value,
+					  unsigned long long expires) {
+	if (!server || !key || !value)
+		return;
+
+	// the value keeps its null terminator
+	server_store_len(server, key, strlen(key), value, strlen(value) + 1,
+					 expires);
+}
+
+void server_store_len(server_memory *server, const void *key, size_t key_len,
+					  const void *value, size_t value_len,
+					  unsigned long long expires) {
 	if (!server || !(server->memory) || !key || !value)
 		return;
 
 	// put key-value pair in server (hashtable)
-	// +1 for null terminator
-	ht_put(server->memory, key, strlen(key) + 1, value, strlen(value) + 1);
+	unsigned int value_size = value_len;
+	const unsigned char *blob;
+	unsigned int blob_size = 0;
+	info *entry;
+
+	// large values are compressed, when it makes them smaller
+	if (server_compresses(server, value_size)) {
+		codec_add_sample(server->codec, value, value_size);
+		blob_size = codec_compress(server->codec, value, value_size, &blob);
+	}
+
+	PROF_BEGIN(prof_start);
+	if (blob_size)
+		entry = ht_put_encoded_len(server->memory, key, key_len, blob,
+								   blob_size, expires,
+								   SERVER_VALUE_COMPRESSED);
+	else
+		entry = ht_put_encoded_len(server->memory, key, key_len, value,
+								   value_size, expires, 0);
+	PROF_END(PROF_HT_PUT, prof_start);
+
+	// make room, without evicting the new pair
+	if (server->budget)
+		server->evicted += ht_evict(server->memory, server->budget, entry);
+}
+
+void server_store_bulk(server_memory *server, const void **keys,
+					   const size_t *key_lens, const void **values,
+					   const unsigned int *value_sizes,
+					   unsigned int no_pairs) {
+	if (!server || !(server->memory) || !keys || !key_lens || !values ||
+		!value_sizes || !no_pairs)
+		return;
+
+	hashtable_t *ht = server->memory;
+	unsigned long long slab_size = 0;
+
+	// size the table and the slab for all the pairs, in a first pass
+	ht_reserve(ht, ht->size + no_pairs);
+	for (unsigned int i = 0; i < no_pairs; i++) {
+		int packed = !ht->values && !ht->log &&
+					 !server_compresses(server, value_sizes[i]);
+
+		slab_size += ht_slab_entry_size(key_lens[i] + 1,
+										packed ? value_sizes[i] : 0);
+	}
+
+	ht_slab *slab = ht_slab_create(slab_size);
+
+	for (unsigned int i = 0; i < no_pairs; i++) {
+		const unsigned char *blob;
+		unsigned int blob_size = 0;
+
+		if (server_compresses(server, value_sizes[i])) {
+			codec_add_sample(server->codec, values[i], value_sizes[i]);
+			blob_size = codec_compress(server->codec, values[i],
+									   value_sizes[i], &blob);
+		}
+
+		if (blob_size)
+			ht_put_packed(ht, slab, keys[i], key_lens[i], blob, blob_size,
+						  SERVER_VALUE_COMPRESSED);
+		else
+			ht_put_packed(ht, slab, keys[i], key_lens[i], values[i],
+						  value_sizes[i], 0);
+	}
+
+	// the slab now belongs to its entries
+	ht_slab_release(slab);
+	server_fit_budget(server);
+}
+
+void server_set_budget(server_memory *server, unsigned long long budget) {
+	if (!server)
+		return;
+
+	server->budget = budget;
+	server_fit_budget(server);
+}
+
+void server_fit_budget(server_memory *server) {
+	if (!server || !(server->memory) || !(server->budget))
+		return;
+
+	server->evicted += ht_evict(server->memory, server->budget, NULL);
+}
+
+void server_set_compression(server_memory *server, value_codec *codec,
+							unsigned int min_size) {
+	if (!server)
+		return;
+
+	server->codec = codec;
+	server->compress_min = codec ? min_size : 0;
+}
+
+char *server_entry_value(server_memory *server, info *entry,
+						 size_t *value_len) {
+	unsigned int value_size = entry->value_size;
+	char *value = entry->value;
+
+	if (entry->encoding == SERVER_VALUE_COMPRESSED) {
+		DIE(!server->codec, "compressed value without a codec\n");
+		value = codec_decompress(server->codec, entry->value,
+								 entry->value_size, &value_size);
+	}
+
+	if (value_len)
+		*value_len = value_size;
+	return value;
+}
+
+/* state of server_scan(), passed through ht_scan() */
+typedef struct server_scan_state server_scan_state;
+struct server_scan_state {
+	server_memory *server;
+	void (*callback)(char *key, size_t key_len, char *value,
+					 size_t value_len, unsigned long long expires,
+					 void *ctx);
+	void *ctx;
+};
+
+static void server_scan_entry(info *entry, void *ctx) {
+	server_scan_state *state = (server_scan_state *)ctx;
+	size_t value_len;
+	char *value = server_entry_value(state->server, entry, &value_len);
+
+	// the stored key ends with its terminator
+	state->callback(entry->key, entry->key_size - 1, value, value_len,
+					entry->timer ? entry->timer->expires : 0, state->ctx);
+}
+
+unsigned int server_scan(server_memory *server, unsigned int cursor,
+						 unsigned int count,
+						 void (*callback)(char *key, size_t key_len,
+										  char *value, size_t value_len,
+										  unsigned long long expires,
+										  void *ctx),
+						 void *ctx) {
+	if (!server || !(server->memory) || !callback)
+		return 0;
+
+	server_scan_state state = {server, callback, ctx};
+
+	return ht_scan(server->memory, cursor, count, server_scan_entry, &state);
 }
 
 char *server_retrieve(server_memory *server, char *key) {
+	if (!key)
+		return NULL;
+
+	return server_retrieve_len(server, key, strlen(key), NULL);
+}
+
+char *server_retrieve_len(server_memory *server, const void *key,
+						  size_t key_len, size_t *value_len) {
 	if (!server || !(server->memory) || !key)
 		return NULL;
 
 	// find the value associated with the key in the server and return it
-	char *value = ht_get(server->memory, key);
+	PROF_BEGIN(prof_start);
+	info *entry = ht_get_entry_len(server->memory, key, key_len);
+	PROF_END(PROF_HT_GET, prof_start);
 
-    return value;
+	return entry ? server_entry_value(server, entry, value_len) : NULL;
 }
 
 void server_remove(server_memory *server, char *key) {
+	if (key)
+		server_remove_len(server, key, strlen(key));
+}
+
+void server_remove_len(server_memory *server, const void *key,
+					   size_t key_len) {
 	if (!server || !(server->memory) || !key)
 		return;
 
 	// remove key-value pair from the given server
-	ht_remove_entry(server->memory, key);
+	ht_remove_entry_len(server->memory, key, key_len);
+}
+
+int server_move(server_memory *src, server_memory *dst, char *key) {
+	return key ? server_move_len(src, dst, key, strlen(key)) : 0;
+}
+
+int server_move_len(server_memory *src, server_memory *dst, const void *key,
+					size_t key_len) {
+	if (!src || !(src->memory) || !dst || !(dst->memory) || !key)
+		return 0;
+
+	// relink the entry into the other server's hashtable
+	return ht_move_entry_len(src->memory, dst->memory, key, key_len);
 }
 
 void free_server_memory(server_memory *server) {
 	if (!server || !(server->memory))
 		return;
 
-	// free server memory
+	// free server memory; its log goes once the entries moved away from it
+	// released their values too
+	value_log *log = server->memory->log;
+
 	ht_free(server->memory);
 	server->memory = NULL;
+	value_log_retire(log);
 	free(server);
 	server = NULL;
 }
@@ -4,11 +4,37 @@
 
 #include "utils.h"
 #include "hashtable.h"
+#include "codec.h"
+
+/* encoding of the entries whose value was compressed by the server's codec */
+#define SERVER_VALUE_COMPRESSED 1
 
 struct server_memory;
 typedef struct server_memory server_memory;
 struct server_memory {
 	hashtable_t *memory;
+
+	/*
+	 * Optional memory budget, in bytes (0: unlimited); entries are evicted
+	 * with ht_evict() when a store goes over it.
+	 */
+	unsigned long long budget;
+	unsigned long long evicted;
+
+	/* lookups of the clients (counted by loader_retrieve()) */
+	unsigned long long hits;
+	unsigned long long misses;
+
+	/*
+	 * Optional value compression (see server_set_compression()); the codec
+	 * is shared by the servers of a load balancer, so that entries moved
+	 * between them stay readable.
+	 */
+	value_codec *codec;
+	unsigned int compress_min;
+
+	/* pending lazy migrations into the server (see migration.h) */
+	struct migration *migrations_in;
 };
 
 /** init_server_memory() -  Initializes the memory for a new server struct.
@@ -19,6 +45,17 @@ struct server_memory {
  */
 server_memory *init_server_memory();
 
+/**
+ * init_server_memory_sized() - Same as init_server_memory(), with a given
+ *                              number of buckets (used when the number of
+ *                              entries is known in advance).
+ *
+ * @arg1: Number of buckets of the server's hashtable.
+ *
+ * Return: pointer to the allocated server_memory struct.
+ */
+server_memory *init_server_memory_sized(unsigned int hmax);
+
 /** free_server_memory() - Free the memory used by the server.
  * 						   Make sure to also free the pointer to the server struct.
  * 						   You can use the server_remove() function for this.
@@ -36,6 +73,56 @@ void free_server_memory(server_memory *server);
  */
 void server_store(server_memory *server, char *key, char *value);
 
+/**
+ * server_store_ttl() - Same as server_store(), for a pair that expires.
+ *
+ * @arg1: Server which performs the task.
+ * @arg2: Key represented as a string.
+ * @arg3: Value represented as a string.
+ * @arg4: Tick at which the pair expires (0: never).
+ */
+void server_store_ttl(server_memory *server, char *key, char *value,
+					  unsigned long long expires);
+
+/**
+ * server_store_len() - Stores a pair of length-explicit key and value (any
+ *                      bytes, '\0' included); the string functions call it
+ *                      with the characters of the key and the whole string
+ *                      of the value, terminator included.
+ *
+ * The entries' hash (info->hash) is the one of hash_function_key_len().
+ *
+ * @arg1: Server which performs the task.
+ * @arg2: Key.
+ * @arg3: Length of the key, in bytes.
+ * @arg4: Value.
+ * @arg5: Length of the value, in bytes.
+ * @arg6: Tick at which the pair expires (0: never).
+ */
+void server_store_len(server_memory *server, const void *key, size_t key_len,
+					  const void *value, size_t value_len,
+					  unsigned long long expires);
+
+/**
+ * server_store_bulk() - Stores many pairs at once (see loader_bulk_load()).
+ *
+ * The server's hashtable is sized once for all of them, and their entries
+ * are carved from one slab (see ht_slab) instead of being allocated one by
+ * one. Compression, deduplication and the budget apply as with
+ * server_store(); a key given twice keeps its last value.
+ *
+ * @arg1: Server which performs the task.
+ * @arg2: Keys (any bytes).
+ * @arg3: Lengths of the keys, in bytes.
+ * @arg4: Values (same order as the keys).
+ * @arg5: Lengths of the values, in bytes.
+ * @arg6: Number of pairs.
+ */
+void server_store_bulk(server_memory *server, const void **keys,
+					   const size_t *key_lens, const void **values,
+					   const unsigned int *value_sizes,
+					   unsigned int no_pairs);
+
 /**
  * server_remove() - Removes a key-pair value from the server.
  *					 Make sure to free the memory of everything that is
@@ -46,14 +133,110 @@ void server_store(server_memory *server, char *key, char *value);
  */
 void server_remove(server_memory *server, char *key);
 
+/* server_remove_len() - server_remove() of a length-explicit key. */
+void server_remove_len(server_memory *server, const void *key,
+					   size_t key_len);
+
+/**
+ * server_move() - Moves a key-value pair to another server, reusing its
+ *                 memory (nothing is copied). If the destination already
+ *                 holds the key, its own value is kept.
+ *
+ * @arg1: Server which holds the entry.
+ * @arg2: Server which receives the entry.
+ * @arg3: Key represented as a string.
+ *
+ * Return: 1 if the entry was moved, 0 otherwise.
+ */
+int server_move(server_memory *src, server_memory *dst, char *key);
+
+/* server_move_len() - server_move() of a length-explicit key. */
+int server_move_len(server_memory *src, server_memory *dst, const void *key,
+					size_t key_len);
+
+/**
+ * server_set_budget() - Sets the memory budget of the server (0: unlimited)
+ *                       and evicts entries until it is met.
+ *
+ * @arg1: Server.
+ * @arg2: Budget in bytes (keys, values and HT_ENTRY_OVERHEAD per entry).
+ */
+void server_set_budget(server_memory *server, unsigned long long budget);
+
+/*
+ * server_fit_budget() - Evicts entries until the server is within its
+ * budget (used after entries were moved to it).
+ */
+void server_fit_budget(server_memory *server);
+
+/**
+ * server_set_compression() - Sets the codec of the server and the size from
+ *                            which the values it stores are compressed.
+ *
+ * @arg1: Server.
+ * @arg2: Codec, which decompresses the values of the server.
+ * @arg3: Values of at least this many bytes are compressed (0: none).
+ */
+void server_set_compression(server_memory *server, value_codec *codec,
+							unsigned int min_size);
+
+/*
+ * server_entry_value() - The value of an entry of the server, decompressed
+ * into the scratch buffer of its codec if needed (valid until the next
+ * lookup); its length goes to *value_len (if not NULL).
+ */
+char *server_entry_value(server_memory *server, info *entry,
+						 size_t *value_len);
+
+/**
+ * server_scan() - Visits the pairs of the server a slice at a time.
+ *
+ * A cursor-based scan (see ht_scan()): every call visits about `count`
+ * pairs and returns the cursor of the next call, 0 once the whole server
+ * was visited. A pair stored during the whole scan
+ * is visited at least once, however the server's table grows in between;
+ * pairs may be visited twice. The callback must not change the server.
+ *
+ * @arg1: Server.
+ * @arg2: Cursor (0 to start a scan).
+ * @arg3: Number of pairs to visit.
+ * @arg4: Called with the key, the value (decompressed, valid during the
+ *        call), their lengths and the expiry tick (0: never) of every
+ *        pair; the key is also followed by a '\0'.
+ * @arg5: Passed to the callback.
+ *
+ * Return: the cursor of the next slice, or 0.
+ */
+unsigned int server_scan(server_memory *server, unsigned int cursor,
+						 unsigned int count,
+						 void (*callback)(char *key, size_t key_len,
+										  char *value, size_t value_len,
+										  unsigned long long expires,
+										  void *ctx),
+						 void *ctx);
+
 /**
  * server_retrieve() - Gets the value associated with the key.
  * @arg1: Server which performs the task.
  * @arg2: Key represented as a string.
  *
  * Return: String value associated with the key
- *         or NULL (in case the key does not exist).
+ *         or NULL (in case the key does not exist). A compressed value is
+ *         returned from the scratch buffer of the codec.
  */
 char *server_retrieve(server_memory *server, char *key);
 
+/**
+ * server_retrieve_len() - server_retrieve() of a length-explicit key.
+ *
+ * @arg1: Server which performs the task.
+ * @arg2: Key.
+ * @arg3: Length of the key, in bytes.
+ * @arg4: Returns the length of the value (may be NULL).
+ *
+ * Return: the value, or NULL (in case the key does not exist).
+ */
+char *server_retrieve_len(server_memory *server, const void *key,
+						  size_t key_len, size_t *value_len);
+
 #endif /* SERVER_H_ */
@@ -0,0 +1,839 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#define _POSIX_C_SOURCE 200809L
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include "utils.h"
+#include "simulator.h"
+#include "load_balancer.h"
+#include "hashtable.h"
+#include "hashring.h"
+#include "latency.h"
+#include "zones.h"
+
+static const char *sim_hash_names[SIM_HASHES] = {"djb2", "fnv1a", "murmur"};
+
+/* parses the number of a setting, which has to end at `end` */
+static int sim_parse_int(const char *str, const char *end, int min, int max,
+						 int *out)
+{
+	char *stop;
+	long value = strtol(str, &stop, 10);
+
+	if (stop == str || stop != end || value < min || value > max)
+		return -1;
+
+	*out = value;
+	return 0;
+}
+
+int sim_parse_config(const char *spec, sim_config *config)
+{
+	const char *setting = spec;
+
+	// the settings that are not given are the load balancer's
+	config->name = spec;
+	config->replicas = REPLICAS;
+	config->hash = SIM_HASH_DJB2;
+	config->zones = 0;
+
+	while (*setting) {
+		const char *end = setting + strcspn(setting, ",");
+		const char *value = memchr(setting, '=', end - setting);
+		size_t name_len = value ? (size_t)(value - setting) : 0;
+		int hash = 0;
+
+		if (!value)
+			return -1;
+		value++;
+
+		if (!strncmp(setting, "replicas", name_len) &&
+			name_len == sizeof("replicas") - 1) {
+			if (sim_parse_int(value, end, 1, SIM_MAX_REPLICAS,
+							  &config->replicas))
+				return -1;
+		} else if (!strncmp(setting, "zones", name_len) &&
+				   name_len == sizeof("zones") - 1) {
+			if (sim_parse_int(value, end, 0, MAX_ZONES, &config->zones))
+				return -1;
+		} else if (!strncmp(setting, "hash", name_len) &&
+				   name_len == sizeof("hash") - 1) {
+			while (hash < SIM_HASHES &&
+				   (strncmp(value, sim_hash_names[hash], end - value) ||
+					sim_hash_names[hash][end - value]))
+				hash++;
+			if (hash == SIM_HASHES)
+				return -1;
+			config->hash = hash;
+		} else {
+			return -1;
+		}
+
+		setting = *end ? end + 1 : end;
+	}
+
+	return 0;
+}
+
+static unsigned int sim_hash_fnv1a(const char *key, size_t key_len)
+{
+	unsigned int hash = 2166136261u;
+
+	for (size_t i = 0; i < key_len; i++) {
+		hash ^= (unsigned char)key[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/* the key of a request: the bytes between its first two quotes */
+static int sim_parse_key(char *request, char **key, size_t *key_len)
+{
+	char *start = strchr(request, '"');
+	char *end = start ? strchr(start + 1, '"') : NULL;
+
+	if (!end)
+		return -1;
+
+	*key = start + 1;
+	*key_len = end - start - 1;
+	return 0;
+}
+
+static int sim_parse_server(const char *arg, int *server_id)
+{
+	char *end;
+	long id = strtol(arg, &end, 10);
+
+	if (end == arg || id < 0 || id >= MAX_SERVERS)
+		return -1;
+
+	*server_id = id;
+	return 0;
+}
+
+/*
+ * The ID of a key (-1 for a retrieved key that was never stored); a stored
+ * key gets the next ID the first time it is seen, and its hashes.
+ */
+static int sim_key_id(sim_trace *trace, hashtable_t *ids, char *key,
+					  size_t key_len, int store, unsigned int *hashes_cap)
+{
+	info *entry = ht_get_entry_len(ids, key, key_len);
+
+	if (entry)
+		return *(int *)entry->value;
+	if (!store)
+		return -1;
+
+	int id = trace->no_keys++;
+	entry = ht_put_encoded_len(ids, key, key_len, &id, sizeof(id), 0, 0);
+
+	if (trace->no_keys > *hashes_cap) {
+		*hashes_cap = *hashes_cap ? 2 * *hashes_cap : HMAX;
+		trace->hashes = realloc(trace->hashes, *hashes_cap * SIM_HASHES *
+								sizeof(*trace->hashes));
+		DIE(!trace->hashes, "realloc() for trace->hashes failed\n");
+	}
+
+	// the table hashes the keys with djb2, as the load balancer does
+	unsigned int *hashes = trace->hashes + (size_t)id * SIM_HASHES;
+	hashes[SIM_HASH_DJB2] = entry->hash;
+	hashes[SIM_HASH_FNV1A] = sim_hash_fnv1a(key, key_len);
+	hashes[SIM_HASH_MURMUR] = zones_key_hash(entry->hash);
+
+	return id;
+}
+
+/* turns a request into an event; returns -1 if it is malformed */
+static int sim_parse_request(sim_trace *trace, hashtable_t *ids,
+							 char *request, sim_event *event,
+							 unsigned int *hashes_cap)
+{
+	char *key;
+	size_t key_len;
+
+	if (!strncmp(request, "store", sizeof("store") - 1)) {
+		event->type = SIM_STORE;
+		if (sim_parse_key(request, &key, &key_len))
+			return -1;
+		event->arg = sim_key_id(trace, ids, key, key_len, 1, hashes_cap);
+	} else if (!strncmp(request, "retrieve", sizeof("retrieve") - 1)) {
+		event->type = SIM_RETRIEVE;
+		if (sim_parse_key(request, &key, &key_len))
+			return -1;
+		event->arg = sim_key_id(trace, ids, key, key_len, 0, hashes_cap);
+	} else if (!strncmp(request, "add_server", sizeof("add_server") - 1)) {
+		event->type = SIM_ADD_SERVER;
+		return sim_parse_server(request + sizeof("add_server") - 1,
+								&event->arg);
+	} else if (!strncmp(request, "remove_server",
+						sizeof("remove_server") - 1)) {
+		event->type = SIM_REMOVE_SERVER;
+		return sim_parse_server(request + sizeof("remove_server") - 1,
+								&event->arg);
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+sim_trace *sim_trace_load(FILE *input)
+{
+	sim_trace *trace = calloc(1, sizeof(*trace));
+	DIE(!trace, "calloc() for *trace failed\n");
+
+	// ID of every distinct key, dropped once the trace is read
+	hashtable_t *ids = ht_create(HMAX, hash_function_string,
+								 compare_function_strings,
+								 key_val_free_function);
+	unsigned int events_cap = 0, hashes_cap = 0;
+	char *request = NULL;
+	size_t request_cap = 0;
+	ssize_t len;
+	int malformed = 0;
+
+	while (!malformed && (len = getline(&request, &request_cap, input)) > 0) {
+		if (request[len - 1] == '\n')
+			request[--len] = 0;
+
+		if (trace->no_events == events_cap) {
+			events_cap = events_cap ? 2 * events_cap : HMAX;
+			trace->events = realloc(trace->events,
+									events_cap * sizeof(*trace->events));
+			DIE(!trace->events, "realloc() for trace->events failed\n");
+		}
+
+		malformed = sim_parse_request(trace, ids, request,
+									  &trace->events[trace->no_events++],
+									  &hashes_cap);
+	}
+
+	free(request);
+	ht_free(ids);
+
+	if (malformed) {
+		sim_trace_free(trace);
+		return NULL;
+	}
+	return trace;
+}
+
+void sim_trace_free(sim_trace *trace)
+{
+	if (!trace)
+		return;
+
+	free(trace->events);
+	free(trace->hashes);
+	free(trace);
+}
+
+/* the keys of a trace sorted by one of their hashes: an arc is a range */
+typedef struct sim_sorted_key sim_sorted_key;
+struct sim_sorted_key {
+	unsigned int hash;
+	unsigned int key;
+};
+
+typedef struct sim_server sim_server;
+struct sim_server {
+	unsigned int *keys;  /* IDs of the keys it holds */
+	unsigned int no_keys;
+	unsigned int cap;
+	int position;  /* in the list of the present servers (-1: absent) */
+	unsigned int mark;  /* last round it was marked as a donor in */
+};
+
+/* a configuration being replayed (by a thread of its own) */
+typedef struct sim_state sim_state;
+struct sim_state {
+	const sim_trace *trace;
+	const sim_config *config;
+	sim_result *result;
+	int keep_server_keys;
+	/* flat only: the keys sorted by the hash of the configuration */
+	const sim_sorted_key *sorted;
+
+	/* flat: points of the servers; zoned: points of the zones */
+	hashring ring;
+	hashring *zone_rings;  /* zoned only: points of the servers of a zone */
+	int *zone_servers;  /* zoned only: servers of each zone */
+	unsigned int *zone_marks;  /* zoned only: last round marked as donor */
+
+	sim_server *servers;  /* indexed by server ID */
+	int *present;  /* IDs of the present servers */
+	int no_present;
+	int *donors;  /* servers that may hand keys over to a new one */
+	int no_donors;
+	unsigned int round;  /* of donor marks */
+
+	int *owners;  /* server of each key (-1: not stored) */
+	unsigned int *slots;  /* position of each key in its server's list */
+	unsigned long long no_keys;
+	unsigned int max_keys;  /* keys of the most loaded server */
+};
+
+static unsigned int sim_key_hash(const sim_state *state, int key)
+{
+	return state->trace->hashes[(size_t)key * SIM_HASHES +
+								state->config->hash];
+}
+
+/* server responsible for a hash (-1: no server) */
+static int sim_route(const sim_state *state, unsigned int hash)
+{
+	int label = hashring_owner(&state->ring, hash);
+
+	if (label < 0 || !state->config->zones)
+		return label < 0 ? -1 : label % MAX_SERVERS;
+
+	// the zone is found first, then its server (see zones.h)
+	const hashring *zone = &state->zone_rings[label % MAX_ZONES];
+	return hashring_owner(zone, zones_key_hash(hash)) % MAX_SERVERS;
+}
+
+static void sim_place(sim_state *state, int key, int server_id)
+{
+	sim_server *server = &state->servers[server_id];
+
+	if (server->no_keys == server->cap) {
+		server->cap = server->cap ? 2 * server->cap : HMAX;
+		server->keys = realloc(server->keys,
+							   server->cap * sizeof(*server->keys));
+		DIE(!server->keys, "realloc() for server->keys failed\n");
+	}
+
+	state->owners[key] = server_id;
+	state->slots[key] = server->no_keys;
+	server->keys[server->no_keys++] = key;
+	if (server->no_keys > state->max_keys)
+		state->max_keys = server->no_keys;
+}
+
+/* takes a key out of its server's list (the last key takes its slot) */
+static void sim_unplace(sim_state *state, int key)
+{
+	sim_server *server = &state->servers[state->owners[key]];
+	unsigned int slot = state->slots[key];
+	int last = server->keys[--server->no_keys];
+
+	server->keys[slot] = last;
+	state->slots[last] = slot;
+	state->owners[key] = -1;
+}
+
+/* moves the keys of a server that the rings now place elsewhere */
+static void sim_reroute(sim_state *state, int server_id)
+{
+	sim_server *server = &state->servers[server_id];
+
+	// backwards: the key that fills a freed slot was already seen
+	for (unsigned int i = server->no_keys; i-- > 0;) {
+		int key = server->keys[i];
+		int owner = sim_route(state, sim_key_hash(state, key));
+
+		if (owner == server_id)
+			continue;
+
+		sim_unplace(state, key);
+		if (owner < 0) {
+			state->result->lost++;
+			state->no_keys--;
+		} else {
+			sim_place(state, key, owner);
+			state->result->moved++;
+		}
+	}
+}
+
+/* first sorted key whose hash is > the given one */
+static unsigned int sim_upper_bound(const sim_state *state, unsigned int hash)
+{
+	unsigned int start = 0;
+	unsigned int end = state->trace->no_keys;
+
+	while (start < end) {
+		unsigned int mid = start + (end - start) / 2;
+
+		if (state->sorted[mid].hash <= hash)
+			start = mid + 1;
+		else
+			end = mid;
+	}
+
+	return start;
+}
+
+/*
+ * Moves the stored keys of the sorted ones from `first` up to those with
+ * the hash `last` to the servers the ring now places them on.
+ */
+static void sim_claim_range(sim_state *state, unsigned int first,
+							unsigned int last)
+{
+	unsigned int no_keys = state->trace->no_keys;
+
+	for (unsigned int i = first;
+		 i < no_keys && state->sorted[i].hash <= last; i++) {
+		int key = state->sorted[i].key;
+		int owner;
+
+		if (state->owners[key] < 0)
+			continue;
+
+		owner = sim_route(state, state->sorted[i].hash);
+		if (owner != state->owners[key]) {
+			sim_unplace(state, key);
+			sim_place(state, key, owner);
+			state->result->moved++;
+		}
+	}
+}
+
+/*
+ * Puts the points of a server on the flat ring; each point takes the keys
+ * of its arc (hash of the previous point, its hash], found in the sorted
+ * keys, so only the keys that move are looked at.
+ */
+static void sim_insert_flat(sim_state *state, int server_id)
+{
+	for (int i = 0; i < state->config->replicas; i++) {
+		unsigned int label = MAX_SERVERS * i + server_id;
+		unsigned int hash = hash_function_servers(&label);
+		int index = hashring_insert(&state->ring, label, hash);
+
+		// with no point before, no key was stored
+		if (state->ring.no_points == 1)
+			continue;
+
+		hashring_pos prev = hashring_at(&state->ring, index);
+		hashring_prev(&state->ring, &prev);
+		unsigned int arc_start = hashring_pos_hash(prev);
+
+		if (arc_start < hash) {
+			sim_claim_range(state, sim_upper_bound(state, arc_start), hash);
+		} else if (arc_start > hash) {
+			// the arc wraps around the end of the ring
+			sim_claim_range(state, sim_upper_bound(state, arc_start),
+							UINT_MAX);
+			sim_claim_range(state, 0, hash);
+		}
+	}
+}
+
+static void sim_mark_donor(sim_state *state, int server_id)
+{
+	if (state->servers[server_id].mark == state->round)
+		return;
+
+	state->servers[server_id].mark = state->round;
+	state->donors[state->no_donors++] = server_id;
+}
+
+/*
+ * Puts the points of a server on the ring of its zone; the servers whose
+ * arcs they take over are marked as donors.
+ */
+static void sim_insert_points(sim_state *state, hashring *ring, int server_id)
+{
+	for (int i = 0; i < state->config->replicas; i++) {
+		unsigned int label = MAX_SERVERS * i + server_id;
+		unsigned int hash = hash_function_servers(&label);
+		int owner = hashring_owner(ring, hash);
+
+		if (owner >= 0 && owner % MAX_SERVERS != server_id)
+			sim_mark_donor(state, owner % MAX_SERVERS);
+		hashring_insert(ring, label, hash);
+	}
+}
+
+static void sim_erase_points(sim_state *state, hashring *ring, int server_id)
+{
+	for (int i = 0; i < state->config->replicas; i++) {
+		unsigned int label = MAX_SERVERS * i + server_id;
+
+		hashring_erase(ring, hash_function_servers(&label));
+	}
+}
+
+/*
+ * Brings a zone onto the top-level ring; the servers of the zones whose
+ * arcs it takes over are marked as donors.
+ */
+static void sim_insert_zone(sim_state *state, int zone_id)
+{
+	int no_marked = 0;
+
+	for (int i = 0; i < ZONE_POINTS; i++) {
+		unsigned int hash = zones_point_hash(zone_id, i);
+		int owner = hashring_owner(&state->ring, hash);
+
+		if (owner >= 0 && owner % MAX_ZONES != zone_id &&
+			state->zone_marks[owner % MAX_ZONES] != state->round) {
+			state->zone_marks[owner % MAX_ZONES] = state->round;
+			no_marked++;
+		}
+		hashring_insert(&state->ring, MAX_ZONES * i + zone_id, hash);
+	}
+
+	for (int i = 0; i < state->no_present && no_marked; i++) {
+		int server_id = state->present[i];
+
+		if (state->zone_marks[server_id % state->config->zones] ==
+			state->round)
+			sim_mark_donor(state, server_id);
+	}
+}
+
+static void sim_add_server(sim_state *state, int server_id)
+{
+	sim_server *server = &state->servers[server_id];
+	int zones = state->config->zones;
+
+	if (server->position >= 0) {
+		state->result->ignored++;
+		return;
+	}
+
+	state->round++;
+	state->no_donors = 0;
+
+	if (!zones) {
+		sim_insert_flat(state, server_id);
+	} else {
+		int zone_id = server_id % zones;
+
+		// the first server of a zone brings the zone onto the top ring
+		sim_insert_points(state, &state->zone_rings[zone_id], server_id);
+		if (!state->zone_servers[zone_id]++)
+			sim_insert_zone(state, zone_id);
+	}
+
+	server->position = state->no_present;
+	state->present[state->no_present++] = server_id;
+
+	for (int i = 0; i < state->no_donors; i++)
+		sim_reroute(state, state->donors[i]);
+}
+
+static void sim_remove_server(sim_state *state, int server_id)
+{
+	sim_server *server = &state->servers[server_id];
+	int zones = state->config->zones;
+
+	if (server->position < 0) {
+		state->result->ignored++;
+		return;
+	}
+
+	if (!zones) {
+		sim_erase_points(state, &state->ring, server_id);
+	} else {
+		int zone_id = server_id % zones;
+
+		// the last server of a zone takes the zone off the top ring
+		sim_erase_points(state, &state->zone_rings[zone_id], server_id);
+		if (!--state->zone_servers[zone_id])
+			for (int i = 0; i < ZONE_POINTS; i++)
+				hashring_erase(&state->ring, zones_point_hash(zone_id, i));
+	}
+
+	int last = state->present[--state->no_present];
+	state->present[server->position] = last;
+	state->servers[last].position = server->position;
+	server->position = -1;
+
+	// every key of the server goes to its new owner (or is lost with it)
+	sim_reroute(state, server_id);
+}
+
+/* keys of the most loaded server over the mean */
+static double sim_imbalance(sim_state *state)
+{
+	if (!state->no_present || !state->no_keys)
+		return 0;
+
+	return state->max_keys / ((double)state->no_keys / state->no_present);
+}
+
+/* recomputes the largest load after keys moved, and the peak imbalance */
+static void sim_measure(sim_state *state)
+{
+	double imbalance;
+
+	state->max_keys = 0;
+	for (int i = 0; i < state->no_present; i++) {
+		sim_server *server = &state->servers[state->present[i]];
+
+		if (server->no_keys > state->max_keys)
+			state->max_keys = server->no_keys;
+	}
+
+	imbalance = sim_imbalance(state);
+	if (imbalance > state->result->peak_imbalance)
+		state->result->peak_imbalance = imbalance;
+}
+
+static void sim_store(sim_state *state, int key)
+{
+	// an update leaves the key where it is
+	if (state->owners[key] >= 0)
+		return;
+
+	int owner = sim_route(state, sim_key_hash(state, key));
+	if (owner < 0) {
+		state->result->dropped++;
+		return;
+	}
+
+	sim_place(state, key, owner);
+	state->no_keys++;
+}
+
+static void sim_state_init(sim_state *state)
+{
+	unsigned int no_keys = state->trace->no_keys;
+
+	hashring_init(&state->ring);
+	if (state->config->zones) {
+		state->zone_rings = calloc(MAX_ZONES, sizeof(*state->zone_rings));
+		DIE(!state->zone_rings, "calloc() for state->zone_rings failed\n");
+		state->zone_servers = calloc(MAX_ZONES,
+									 sizeof(*state->zone_servers));
+		DIE(!state->zone_servers,
+			"calloc() for state->zone_servers failed\n");
+		state->zone_marks = calloc(MAX_ZONES, sizeof(*state->zone_marks));
+		DIE(!state->zone_marks, "calloc() for state->zone_marks failed\n");
+	}
+
+	state->servers = calloc(MAX_SERVERS, sizeof(*state->servers));
+	DIE(!state->servers, "calloc() for state->servers failed\n");
+	for (int i = 0; i < MAX_SERVERS; i++)
+		state->servers[i].position = -1;
+	state->present = malloc(MAX_SERVERS * sizeof(*state->present));
+	DIE(!state->present, "malloc() for state->present failed\n");
+	state->donors = malloc(MAX_SERVERS * sizeof(*state->donors));
+	DIE(!state->donors, "malloc() for state->donors failed\n");
+
+	state->owners = malloc((no_keys + 1) * sizeof(*state->owners));
+	DIE(!state->owners, "malloc() for state->owners failed\n");
+	// every byte set: -1 for every key
+	memset(state->owners, 0xFF, (no_keys + 1) * sizeof(*state->owners));
+	state->slots = malloc((no_keys + 1) * sizeof(*state->slots));
+	DIE(!state->slots, "malloc() for state->slots failed\n");
+}
+
+static void sim_state_free(sim_state *state)
+{
+	hashring_free(&state->ring);
+	for (int i = 0; state->zone_rings && i < MAX_ZONES; i++)
+		hashring_free(&state->zone_rings[i]);
+	free(state->zone_rings);
+	free(state->zone_servers);
+	free(state->zone_marks);
+
+	for (int i = 0; i < MAX_SERVERS; i++)
+		free(state->servers[i].keys);
+	free(state->servers);
+	free(state->present);
+	free(state->donors);
+	free(state->owners);
+	free(state->slots);
+}
+
+/* fills the distribution of the keys at the end of the trace */
+static void sim_finish(sim_state *state)
+{
+	sim_result *result = state->result;
+	double mean = state->no_present ?
+				  (double)state->no_keys / state->no_present : 0;
+	double variance = 0;
+
+	sim_measure(state);
+	result->no_servers = state->no_present;
+	result->no_keys = state->no_keys;
+	result->max_keys = state->max_keys;
+	result->min_keys = state->no_present ? state->max_keys : 0;
+	result->imbalance = sim_imbalance(state);
+
+	for (int i = 0; i < state->no_present; i++) {
+		unsigned int keys = state->servers[state->present[i]].no_keys;
+
+		if (keys < result->min_keys)
+			result->min_keys = keys;
+		variance += (keys - mean) * (keys - mean);
+	}
+	if (state->no_present)
+		result->stddev_keys = sqrt(variance / state->no_present);
+
+	if (!state->keep_server_keys)
+		return;
+
+	result->server_ids = malloc((state->no_present + 1) *
+								sizeof(*result->server_ids));
+	DIE(!result->server_ids, "malloc() for result->server_ids failed\n");
+	result->server_keys = malloc((state->no_present + 1) *
+								 sizeof(*result->server_keys));
+	DIE(!result->server_keys, "malloc() for result->server_keys failed\n");
+
+	for (int id = 0, i = 0; id < MAX_SERVERS; id++) {
+		if (state->servers[id].position < 0)
+			continue;
+
+		result->server_ids[i] = id;
+		result->server_keys[i++] = state->servers[id].no_keys;
+	}
+}
+
+static void *sim_replay(void *arg)
+{
+	sim_state *state = (sim_state *)arg;
+	const sim_trace *trace = state->trace;
+	unsigned long long start = lat_now_ns();
+
+	sim_state_init(state);
+
+	for (unsigned int i = 0; i < trace->no_events; i++) {
+		const sim_event *event = &trace->events[i];
+
+		switch (event->type) {
+		case SIM_STORE:
+			sim_store(state, event->arg);
+			break;
+		case SIM_RETRIEVE:
+			break;
+		case SIM_ADD_SERVER:
+			sim_add_server(state, event->arg);
+			sim_measure(state);
+			break;
+		case SIM_REMOVE_SERVER:
+			sim_remove_server(state, event->arg);
+			sim_measure(state);
+			break;
+		}
+	}
+
+	sim_finish(state);
+	sim_state_free(state);
+
+	state->result->ns = lat_now_ns() - start;
+	return NULL;
+}
+
+static int sim_compare_sorted(const void *a, const void *b)
+{
+	const sim_sorted_key *key_a = (const sim_sorted_key *)a;
+	const sim_sorted_key *key_b = (const sim_sorted_key *)b;
+
+	if (key_a->hash != key_b->hash)
+		return key_a->hash < key_b->hash ? -1 : 1;
+	return key_a->key < key_b->key ? -1 : key_a->key > key_b->key;
+}
+
+static sim_sorted_key *sim_sort_keys(const sim_trace *trace, sim_hash hash)
+{
+	sim_sorted_key *sorted = malloc((trace->no_keys + 1) * sizeof(*sorted));
+	DIE(!sorted, "malloc() for sorted failed\n");
+
+	for (unsigned int i = 0; i < trace->no_keys; i++) {
+		sorted[i].hash = trace->hashes[(size_t)i * SIM_HASHES + hash];
+		sorted[i].key = i;
+	}
+	qsort(sorted, trace->no_keys, sizeof(*sorted), sim_compare_sorted);
+
+	return sorted;
+}
+
+int sim_run(const sim_trace *trace, const sim_config *configs, int count,
+			sim_result *results, int server_keys)
+{
+	sim_state states[SIM_MAX_CONFIGS];
+	pthread_t threads[SIM_MAX_CONFIGS];
+	sim_sorted_key *sorted[SIM_HASHES] = {NULL};
+	int started = 0;
+	int ret = 0;
+
+	if (count > SIM_MAX_CONFIGS)
+		return -1;
+
+	memset(states, 0, count * sizeof(*states));
+	memset(results, 0, count * sizeof(*results));
+
+	// the flat configurations of a hash share its sorted keys
+	for (int i = 0; i < count; i++) {
+		sim_hash hash = configs[i].hash;
+
+		if (configs[i].zones)
+			continue;
+		if (!sorted[hash])
+			sorted[hash] = sim_sort_keys(trace, hash);
+		states[i].sorted = sorted[hash];
+	}
+
+	// one thread per configuration: they only share the (read-only) trace
+	for (; started < count; started++) {
+		states[started].trace = trace;
+		states[started].config = &configs[started];
+		states[started].result = &results[started];
+		states[started].keep_server_keys = server_keys;
+
+		if (pthread_create(&threads[started], NULL, sim_replay,
+						   &states[started])) {
+			ret = -1;
+			break;
+		}
+	}
+
+	for (int i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	for (int hash = 0; hash < SIM_HASHES; hash++)
+		free(sorted[hash]);
+
+	return ret;
+}
+
+void sim_result_free(sim_result *result)
+{
+	free(result->server_ids);
+	free(result->server_keys);
+	result->server_ids = NULL;
+	result->server_keys = NULL;
+}
+
+void sim_print(const sim_config *configs, const sim_result *results,
+			   int count, FILE *out)
+{
+	fprintf(out, "%-28s %7s %10s %9s %9s %10s %9s %7s %10s %7s %8s\n",
+			"config", "servers", "keys", "min", "max", "stddev", "imbalance",
+			"peak", "moved", "lost", "ms");
+	for (int i = 0; i < count; i++) {
+		const sim_result *result = &results[i];
+
+		fprintf(out, "%-28s %7d %10llu %9u %9u %10.1f %9.3f %7.3f %10llu "
+				"%7llu %8.1f\n", configs[i].name, result->no_servers,
+				result->no_keys, result->min_keys, result->max_keys,
+				result->stddev_keys, result->imbalance,
+				result->peak_imbalance, result->moved, result->lost,
+				result->ns / 1e6);
+		if (result->dropped || result->ignored)
+			fprintf(out, "%-28s %llu stores with no server, %llu server "
+					"changes ignored\n", "", result->dropped,
+					result->ignored);
+	}
+
+	for (int i = 0; i < count; i++) {
+		const sim_result *result = &results[i];
+
+		if (!result->server_keys)
+			continue;
+
+		fprintf(out, "== %s\n", configs[i].name);
+		for (int s = 0; s < result->no_servers; s++)
+			fprintf(out, "server %d: %u keys\n", result->server_ids[s],
+					result->server_keys[s]);
+	}
+}
@@ -0,0 +1,135 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#ifndef SIMULATOR_H_
+#define SIMULATOR_H_
+
+#include <stdio.h>
+
+/*
+ * What-if simulator: replays a request trace (the input format of tema2)
+ * against several hashring configurations at once, to compare how they
+ * spread the keys and how many keys they move when servers join or leave.
+ *
+ * The trace is read once: every distinct key gets an ID and its hashes,
+ * and the requests become a list of events shared by all configurations.
+ * Each configuration is then replayed by a thread of its own, which routes
+ * the key hashes only (no value is stored) and keeps, for every key, the
+ * server that holds it.
+ *
+ * As in the load balancer, a new server takes its keys from the servers
+ * whose arcs its points take over, and a removed server hands all its keys
+ * over; the keys of the last server are lost with it. Retrievals do not
+ * change the placement and are only counted, and keys stored with a TTL
+ * are simulated as if they never expired.
+ */
+
+/* configurations replayed at the same time */
+#define SIM_MAX_CONFIGS 64
+/* points of a server on its ring */
+#define SIM_MAX_REPLICAS 1024
+
+typedef enum sim_hash {
+	SIM_HASH_DJB2,  /* hash of the load balancer (hash_function_key()) */
+	SIM_HASH_FNV1A,  /* 32-bit FNV-1a over the key bytes */
+	SIM_HASH_MURMUR,  /* djb2, then the finalizer of MurmurHash3 */
+	SIM_HASHES
+} sim_hash;
+
+typedef struct sim_config sim_config;
+struct sim_config {
+	const char *name;  /* specification the configuration was parsed from */
+	int replicas;  /* points of each server */
+	sim_hash hash;  /* hash of the keys */
+	/* 0: flat hashring; else zones a server goes to (server_id % zones) */
+	int zones;
+};
+
+typedef enum sim_event_type {
+	SIM_STORE,
+	SIM_RETRIEVE,
+	SIM_ADD_SERVER,
+	SIM_REMOVE_SERVER
+} sim_event_type;
+
+typedef struct sim_event sim_event;
+struct sim_event {
+	sim_event_type type;
+	int arg;  /* key ID, or server ID */
+};
+
+typedef struct sim_trace sim_trace;
+struct sim_trace {
+	sim_event *events;
+	unsigned int no_events;
+	unsigned int no_keys;  /* distinct keys */
+	/* hashes of every key, SIM_HASHES per key ID */
+	unsigned int *hashes;
+};
+
+typedef struct sim_result sim_result;
+struct sim_result {
+	/* at the end of the trace */
+	int no_servers;
+	unsigned long long no_keys;
+	unsigned int min_keys, max_keys;  /* keys of a server */
+	double stddev_keys;
+	double imbalance;  /* keys of the most loaded server over the mean */
+	/* largest imbalance after a server change or at the end */
+	double peak_imbalance;
+	unsigned long long moved;  /* keys moved by the server changes */
+	unsigned long long lost;  /* keys lost with the last server */
+	unsigned long long dropped;  /* stores with no server to take them */
+	unsigned long long ignored;  /* adds of present / removes of absent */
+	unsigned long long ns;  /* replay time */
+	/* final servers (by increasing ID) and their keys, when asked for */
+	int *server_ids;
+	unsigned int *server_keys;
+};
+
+/**
+ * sim_parse_config() - Parses a configuration: comma-separated settings
+ *                      among `replicas=<n>`, `hash=djb2|fnv1a|murmur` and
+ *                      `zones=<n>` (the default is the load balancer's:
+ *                      REPLICAS points, djb2, flat hashring).
+ *
+ * @arg1: Specification (kept as the name of the configuration).
+ * @arg2: Configuration to fill.
+ *
+ * Return: 0 on success, -1 if the specification is invalid.
+ */
+int sim_parse_config(const char *spec, sim_config *config);
+
+/**
+ * sim_trace_load() - Reads a request trace.
+ *
+ * Return: the trace (release it with sim_trace_free()), or NULL if a
+ *         request is malformed.
+ */
+sim_trace *sim_trace_load(FILE *input);
+
+void sim_trace_free(sim_trace *trace);
+
+/**
+ * sim_run() - Replays a trace against configurations, in parallel.
+ *
+ * @arg1: Trace.
+ * @arg2: Configurations.
+ * @arg3: Number of configurations (at most SIM_MAX_CONFIGS).
+ * @arg4: Results, one per configuration; free them with sim_result_free().
+ * @arg5: Keep the final keys of every server (sim_result.server_ids and
+ *        sim_result.server_keys).
+ *
+ * Return: 0 on success, -1 if a thread could not be started.
+ */
+int sim_run(const sim_trace *trace, const sim_config *configs, int count,
+			sim_result *results, int server_keys);
+
+void sim_result_free(sim_result *result);
+
+/*
+ * sim_print() - Prints a line per configuration and, if they were kept,
+ * the final keys of every server under each configuration.
+ */
+void sim_print(const sim_config *configs, const sim_result *results,
+			   int count, FILE *out);
+
+#endif  // SIMULATOR_H_
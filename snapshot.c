@@ -0,0 +1,333 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "utils.h"
+#include "checksum.h"
+#include "snapshot.h"
+#include "wal.h"
+#include "migration.h"
+
+/* pairs written per slice of the scan of a server */
+#define SNAPSHOT_SCAN_COUNT 256
+
+/* writes a block to the snapshot and adds it to a running checksum */
+static int snapshot_write(FILE *file, const void *buf, size_t len,
+						  unsigned int *crc)
+{
+	if (crc)
+		*crc = crc32(*crc, buf, len);
+
+	return fwrite(buf, 1, len, file) == len ? 0 : -1;
+}
+
+/* state of the scan that writes the pairs of one server */
+typedef struct snapshot_scan snapshot_scan;
+struct snapshot_scan {
+	FILE *file;
+	snapshot_server *entry;
+	int error;
+};
+
+static void snapshot_write_pair(char *key, size_t key_len, char *value,
+								size_t value_len, unsigned long long expires,
+								void *ctx)
+{
+	snapshot_scan *scan = (snapshot_scan *)ctx;
+	snapshot_server *entry = scan->entry;
+	unsigned int sizes[2];
+
+	// keys with a TTL are volatile
+	if (expires || scan->error)
+		return;
+
+	// the key is followed by its terminator
+	sizes[0] = key_len + 1;
+	sizes[1] = value_len;
+
+	if (snapshot_write(scan->file, sizes, sizeof(sizes), &entry->crc) ||
+		snapshot_write(scan->file, key, sizes[0], &entry->crc) ||
+		snapshot_write(scan->file, value, sizes[1], &entry->crc)) {
+		scan->error = 1;
+		return;
+	}
+
+	entry->data_size += sizeof(sizes) + sizes[0] + sizes[1];
+	entry->entry_count++;
+}
+
+static int snapshot_write_server(FILE *file, server_memory *server,
+								 snapshot_server *entry)
+{
+	snapshot_scan scan = {file, entry, 0};
+	unsigned int cursor = 0;
+
+	entry->entry_count = 0;
+	entry->data_offset = ftell(file);
+	entry->data_size = 0;
+	entry->crc = 0;
+
+	// compressed values are written as stored by the clients
+	do {
+		cursor = server_scan(server, cursor, SNAPSHOT_SCAN_COUNT,
+							 snapshot_write_pair, &scan);
+	} while (cursor && !scan.error);
+
+	return scan.error ? -1 : 0;
+}
+
+int loader_snapshot_save(load_balancer *main, const char *path)
+{
+	snapshot_header header;
+	snapshot_server *registry;
+	char *tmp_path;
+	FILE *file;
+	int ret = -1;
+
+	// the snapshot is written to "<path>.tmp", then renamed over <path>
+	tmp_path = malloc(strlen(path) + sizeof(".tmp"));
+	DIE(!tmp_path, "malloc() for tmp_path failed\n");
+	sprintf(tmp_path, "%s.tmp", path);
+
+	// the snapshot has no record of pending migrations, so every key must
+	// be on its owner
+	loader_migrate_all(main);
+
+	file = fopen(tmp_path, "wb");
+	if (!file) {
+		free(tmp_path);
+		return -1;
+	}
+
+	registry = calloc(main->no_servers ? main->no_servers : 1,
+					  sizeof(*registry));
+	DIE(!registry, "calloc() for registry failed\n");
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.header_size = sizeof(header);
+	header.no_points = main->ring.no_points;
+	header.wal_lsn = main->wal_lsn;
+
+	// the header is rewritten at the end, once every offset is known
+	if (snapshot_write(file, &header, sizeof(header), NULL))
+		goto out;
+
+	// ring section: the labels of every leaf of the ring, in order
+	header.ring_offset = ftell(file);
+	for (hashring_leaf *leaf = main->ring.first; leaf; leaf = leaf->next)
+		if (snapshot_write(file, leaf->node.values,
+						   leaf->node.no_entries * sizeof(int),
+						   &header.ring_crc))
+			goto out;
+
+	// registry section (placeholder, rewritten once the data is written)
+	for (int i = 0; i < MAX_SERVERS; i++)
+		if (main->servers[i])
+			registry[header.no_servers++].server_id = i;
+
+	header.registry_offset = ftell(file);
+	if (snapshot_write(file, registry, header.no_servers * sizeof(*registry),
+					   NULL))
+		goto out;
+
+	// data section, one contiguous block per server
+	for (unsigned int i = 0; i < header.no_servers; i++) {
+		server_memory *server = main->servers[registry[i].server_id];
+
+		if (snapshot_write_server(file, server, &registry[i]))
+			goto out;
+	}
+	header.file_size = ftell(file);
+
+	// go back and write the final registry and header
+	header.registry_crc = crc32(0, registry,
+								header.no_servers * sizeof(*registry));
+	header.header_crc = crc32(0, &header, sizeof(header));
+
+	if (fseek(file, header.registry_offset, SEEK_SET) ||
+		snapshot_write(file, registry, header.no_servers * sizeof(*registry),
+					   NULL) ||
+		fseek(file, 0, SEEK_SET) ||
+		snapshot_write(file, &header, sizeof(header), NULL))
+		goto out;
+
+	ret = 0;
+out:
+	if (fclose(file))
+		ret = -1;
+	if (!ret)
+		ret = rename(tmp_path, path) ? -1 : 0;
+	else
+		remove(tmp_path);
+
+	free(registry);
+	free(tmp_path);
+	return ret;
+}
+
+/* checks that [offset, offset + size) lies inside the mapped file */
+static int snapshot_in_bounds(unsigned long long offset,
+							  unsigned long long size,
+							  unsigned long long file_size)
+{
+	return offset <= file_size && size <= file_size - offset;
+}
+
+static int snapshot_validate(const unsigned char *map, size_t map_size)
+{
+	snapshot_header header;
+
+	if (map_size < sizeof(header))
+		return -1;
+	memcpy(&header, map, sizeof(header));
+
+	unsigned int header_crc = header.header_crc;
+	header.header_crc = 0;
+
+	if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) ||
+		header.version != SNAPSHOT_VERSION ||
+		header.header_size != sizeof(header) ||
+		crc32(0, &header, sizeof(header)) != header_crc ||
+		header.file_size != map_size ||
+		header.no_servers > MAX_SERVERS ||
+		header.no_points > REPLICAS * MAX_SERVERS ||
+		!snapshot_in_bounds(header.ring_offset,
+							header.no_points * sizeof(int), map_size) ||
+		!snapshot_in_bounds(header.registry_offset,
+							header.no_servers * sizeof(snapshot_server),
+							map_size))
+		return -1;
+
+	if (crc32(0, map + header.ring_offset,
+			  header.no_points * sizeof(int)) != header.ring_crc ||
+		crc32(0, map + header.registry_offset,
+			  header.no_servers * sizeof(snapshot_server)) !=
+		header.registry_crc)
+		return -1;
+
+	const unsigned char *registry = map + header.registry_offset;
+	for (unsigned int i = 0; i < header.no_servers; i++) {
+		snapshot_server entry;
+
+		memcpy(&entry, registry + i * sizeof(entry), sizeof(entry));
+		if (entry.server_id >= MAX_SERVERS ||
+			!snapshot_in_bounds(entry.data_offset, entry.data_size,
+								map_size) ||
+			crc32(0, map + entry.data_offset, entry.data_size) != entry.crc)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* fills a server from its data block; returns -1 if the block is corrupt */
+static int snapshot_load_server(server_memory *server,
+								const unsigned char *data,
+								const snapshot_server *entry)
+{
+	unsigned long long pos = 0;
+
+	for (unsigned int i = 0; i < entry->entry_count; i++) {
+		unsigned int sizes[2];
+
+		if (!snapshot_in_bounds(pos, sizeof(sizes), entry->data_size))
+			return -1;
+		memcpy(sizes, data + pos, sizeof(sizes));
+		pos += sizeof(sizes);
+
+		if (!sizes[0] ||
+			!snapshot_in_bounds(pos, (unsigned long long)sizes[0] + sizes[1],
+								entry->data_size) ||
+			data[pos + sizes[0] - 1])
+			return -1;
+
+		// the keys of a server are unique, so no lookup is needed
+		ht_insert_new_len(server->memory, data + pos, sizes[0] - 1,
+						  data + pos + sizes[0], sizes[1]);
+		pos += sizes[0] + sizes[1];
+	}
+
+	return pos == entry->data_size ? 0 : -1;
+}
+
+load_balancer *loader_snapshot_load(const char *path)
+{
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return NULL;
+	}
+
+	size_t map_size = st.st_size;
+	unsigned char *map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	// the data is read front to back exactly once
+	posix_madvise(map, map_size, POSIX_MADV_SEQUENTIAL);
+
+	if (snapshot_validate(map, map_size)) {
+		munmap(map, map_size);
+		return NULL;
+	}
+
+	snapshot_header header;
+	memcpy(&header, map, sizeof(header));
+
+	load_balancer *main = init_load_balancer();
+	main->wal_lsn = header.wal_lsn;
+
+	// the ring is restored from the saved labels; the hashes of the points
+	// are not saved, only recomputed
+	for (unsigned int i = 0; i < header.no_points; i++) {
+		int label;
+
+		memcpy(&label, map + header.ring_offset + i * sizeof(label),
+			   sizeof(label));
+		hashring_insert(&main->ring, label, hash_function_servers(&label));
+	}
+
+	for (unsigned int i = 0; i < header.no_servers; i++) {
+		snapshot_server entry;
+
+		memcpy(&entry, map + header.registry_offset + i * sizeof(entry),
+			   sizeof(entry));
+
+		// one bucket per entry, so the chains stay short
+		unsigned int hmax = entry.entry_count > HMAX ? entry.entry_count
+													 : HMAX;
+		server_memory *server = init_server_memory_sized(hmax);
+
+		server->memory->expiry = &main->expiring;
+		main->servers[entry.server_id] = server;
+		main->no_servers++;
+
+		if (snapshot_load_server(server, map + entry.data_offset, &entry)) {
+			free_load_balancer(main);
+			munmap(map, map_size);
+			return NULL;
+		}
+	}
+
+	munmap(map, map_size);
+	return main;
+}
+
+int loader_checkpoint(load_balancer *main, const char *path)
+{
+	// every logged operation must be in the file before it is truncated
+	if (wal_flush(main->wal) || loader_snapshot_save(main, path))
+		return -1;
+
+	return main->wal ? wal_truncate(main->wal) : 0;
+}
@@ -0,0 +1,95 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include "load_balancer.h"
+
+/*
+ * Snapshot file layout (version 2, host byte order, no pointers; every
+ * position is an offset from the start of the file):
+ *
+ *   snapshot_header                        (crc over the header itself)
+ *   ring: no_points x u32 replica labels   (header.ring_crc)
+ *   registry: no_servers x snapshot_server (header.registry_crc)
+ *   per server, entry_count x entry:       (snapshot_server.crc)
+ *       u32 key_size, u32 value_size, key bytes, value bytes
+ *
+ * Sizes are those of the stored entries: a key has a NUL terminator after
+ * its bytes, and a value is kept as stored (string values keep theirs).
+ */
+
+#define SNAPSHOT_MAGIC "LBSNAP\r\n"
+#define SNAPSHOT_VERSION 2
+
+typedef struct snapshot_header snapshot_header;
+struct snapshot_header {
+	char magic[8];
+	unsigned int version;
+	unsigned int header_size;
+	unsigned int no_servers;
+	unsigned int no_points;
+	unsigned long long ring_offset;
+	unsigned long long registry_offset;
+	unsigned long long file_size;
+	unsigned int ring_crc;
+	unsigned int registry_crc;
+	unsigned int header_crc;  /* computed with this field set to 0 */
+	unsigned int reserved;
+	/* last write-ahead log record contained in the snapshot */
+	unsigned long long wal_lsn;
+};
+
+typedef struct snapshot_server snapshot_server;
+struct snapshot_server {
+	unsigned int server_id;
+	unsigned int entry_count;
+	unsigned long long data_offset;
+	unsigned long long data_size;
+	unsigned int crc;
+	unsigned int reserved;
+};
+
+/**
+ * loader_snapshot_save() - Writes the hashring, the server registry and
+ *                          every stored entry to a snapshot file.
+ *
+ * The file is written next to the destination and renamed over it, so an
+ * interrupted save never leaves a truncated snapshot behind.
+ *
+ * @arg1: Load balancer to save.
+ * @arg2: Path of the snapshot file.
+ *
+ * Return: 0 on success, -1 on I/O errors.
+ */
+int loader_snapshot_save(load_balancer *main, const char *path);
+
+/**
+ * loader_snapshot_load() - Rebuilds a load balancer from a snapshot file.
+ *
+ * The file is mapped in memory and validated (magic, version, bounds and
+ * every checksum) before anything is built. Each server's hashtable is
+ * created with one bucket per entry and filled without key lookups, so the
+ * load time depends on the size of the file, not on per-key insert costs.
+ *
+ * @arg1: Path of the snapshot file.
+ *
+ * Return: the new load balancer, or NULL if the file is missing or corrupt.
+ */
+load_balancer *loader_snapshot_load(const char *path);
+
+/**
+ * loader_checkpoint() - Saves a snapshot, then empties the write-ahead log
+ *                       of the load balancer (if it has one), whose records
+ *                       are all contained in the snapshot.
+ *
+ * A crash between the two steps is harmless: the snapshot remembers the
+ * last log record it contains and wal_replay() skips everything up to it.
+ *
+ * @arg1: Load balancer to save.
+ * @arg2: Path of the snapshot file.
+ *
+ * Return: 0 on success, -1 on I/O errors.
+ */
+int loader_checkpoint(load_balancer *main, const char *path);
+
+#endif  // SNAPSHOT_H_
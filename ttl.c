@@ -0,0 +1,146 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#include "utils.h"
+#include "ttl.h"
+
+#define TTL_SLOT_MASK (TTL_WHEEL_SLOTS - 1)
+
+/* number of ticks covered by one slot of the given level */
+static unsigned long long ttl_level_span(int level)
+{
+	return 1ull << (TTL_WHEEL_BITS * level);
+}
+
+ttl_wheel *ttl_wheel_create(unsigned long long now)
+{
+	ttl_wheel *wheel = calloc(1, sizeof(*wheel));
+	DIE(!wheel, "calloc() for *wheel failed\n");
+
+	wheel->now = now;
+	return wheel;
+}
+
+void ttl_wheel_free(ttl_wheel *wheel)
+{
+	// the timers belong to the entries, which free them
+	free(wheel);
+}
+
+void ttl_wheel_add(ttl_wheel *wheel, ttl_timer *timer)
+{
+	// an expired timer fires on the next tick
+	unsigned long long expires = timer->expires;
+	if (expires <= wheel->now)
+		expires = wheel->now + 1;
+
+	// too far away: wait on the last level, then cascade again
+	if (expires - wheel->now >= TTL_WHEEL_SPAN)
+		expires = wheel->now + TTL_WHEEL_SPAN - 1;
+
+	// lowest level whose slots still cover the expiry
+	unsigned long long delta = expires - wheel->now;
+	int level = 0;
+
+	while (level < TTL_WHEEL_LEVELS - 1 && delta >= ttl_level_span(level + 1))
+		level++;
+
+	ttl_timer **slot = &wheel->slots[level][(expires >>
+						(TTL_WHEEL_BITS * level)) & TTL_SLOT_MASK];
+
+	// link at the head of the slot
+	timer->next = *slot;
+	if (*slot)
+		(*slot)->pprev = &timer->next;
+	*slot = timer;
+	timer->pprev = slot;
+	timer->level = level;
+
+	wheel->pending++;
+	wheel->level_pending[level]++;
+}
+
+void ttl_wheel_cancel(ttl_wheel *wheel, ttl_timer *timer)
+{
+	if (!timer->pprev)
+		return;
+
+	*timer->pprev = timer->next;
+	if (timer->next)
+		timer->next->pprev = timer->pprev;
+	timer->next = NULL;
+	timer->pprev = NULL;
+
+	wheel->pending--;
+	wheel->level_pending[timer->level]--;
+}
+
+/*
+ * Empties a slot that comes up on the given tick: the timers that expired
+ * are fired, the others are added again (to a lower level).
+ */
+static unsigned int ttl_slot_run(ttl_wheel *wheel, int level,
+								 unsigned long long tick,
+								 void (*fire)(ttl_timer *timer, void *ctx),
+								 void *ctx)
+{
+	unsigned int index = (tick >> (TTL_WHEEL_BITS * level)) & TTL_SLOT_MASK;
+	ttl_timer *curr = wheel->slots[level][index];
+	unsigned int fired = 0;
+
+	wheel->slots[level][index] = NULL;
+	while (curr) {
+		ttl_timer *next = curr->next;
+
+		curr->next = NULL;
+		curr->pprev = NULL;
+		wheel->pending--;
+		wheel->level_pending[level]--;
+
+		if (curr->expires <= tick) {
+			fire(curr, ctx);
+			fired++;
+		} else {
+			ttl_wheel_add(wheel, curr);
+		}
+		curr = next;
+	}
+
+	return fired;
+}
+
+unsigned int ttl_wheel_advance(ttl_wheel *wheel, unsigned long long now,
+							   void (*fire)(ttl_timer *timer, void *ctx),
+							   void *ctx)
+{
+	unsigned int fired = 0;
+
+	while (wheel->now < now) {
+		if (!wheel->pending) {
+			wheel->now = now;
+			break;
+		}
+
+		// nothing can fire before the next slot of the lowest
+		// non-empty level, so the empty ticks are skipped
+		int lowest = 0;
+		while (!wheel->level_pending[lowest])
+			lowest++;
+		if (lowest) {
+			unsigned long long skip = wheel->now |
+									  (ttl_level_span(lowest) - 1);
+
+			wheel->now = skip < now ? skip : now;
+			if (wheel->now == now)
+				break;
+		}
+
+		unsigned long long tick = ++wheel->now;
+
+		// cascade the slots that come up on this tick (highest level
+		// first), then fire the timers of the level 0 slot
+		for (int level = TTL_WHEEL_LEVELS - 1; level >= 0; level--)
+			if (!(tick & (ttl_level_span(level) - 1)))
+				fired += ttl_slot_run(wheel, level, tick, fire, ctx);
+	}
+
+	return fired;
+}
@@ -0,0 +1,66 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#ifndef TTL_H_
+#define TTL_H_
+
+/*
+ * Hierarchical timer wheel for the expiry of entries with a time to live.
+ *
+ * Time is counted in ticks (the unit is chosen by the caller: milliseconds,
+ * or requests in tema2). Level l of the wheel has TTL_WHEEL_SLOTS slots of
+ * 64^l ticks each; a timer is put on the lowest level that covers its
+ * expiry and moves down one level (cascades) when the slot it is in comes
+ * up, so adding, cancelling and firing a timer all cost O(1) (amortized
+ * over at most TTL_WHEEL_LEVELS cascades).
+ */
+
+#define TTL_WHEEL_BITS 6
+#define TTL_WHEEL_SLOTS (1 << TTL_WHEEL_BITS)
+#define TTL_WHEEL_LEVELS 4
+/* timers further away wait on the last level and cascade again */
+#define TTL_WHEEL_SPAN (1ull << (TTL_WHEEL_BITS * TTL_WHEEL_LEVELS))
+
+typedef struct ttl_timer ttl_timer;
+struct ttl_timer {
+	unsigned long long expires;  /* tick at which the entry expires */
+	void *entry;  /* entry to expire (an info structure of a hashtable) */
+	ttl_timer *next;
+	ttl_timer **pprev;  /* link that points to this timer (NULL: idle) */
+	int level;  /* level of the wheel the timer is on */
+};
+
+typedef struct ttl_wheel ttl_wheel;
+struct ttl_wheel {
+	unsigned long long now;  /* the wheel was advanced up to this tick */
+	unsigned int pending;  /* timers in the wheel */
+	unsigned int level_pending[TTL_WHEEL_LEVELS];
+	ttl_timer *slots[TTL_WHEEL_LEVELS][TTL_WHEEL_SLOTS];
+};
+
+ttl_wheel *ttl_wheel_create(unsigned long long now);
+void ttl_wheel_free(ttl_wheel *wheel);
+
+/* ttl_wheel_add() - Schedules an idle timer (expired ones fire next tick). */
+void ttl_wheel_add(ttl_wheel *wheel, ttl_timer *timer);
+
+/* ttl_wheel_cancel() - Takes a timer out of the wheel (no-op if idle). */
+void ttl_wheel_cancel(ttl_wheel *wheel, ttl_timer *timer);
+
+/**
+ * ttl_wheel_advance() - Moves the wheel forward to a given tick, firing the
+ *                       timers that expire on the way.
+ *
+ * The timers are taken out of the wheel before fire() is called, so fire()
+ * may free them.
+ *
+ * @arg1: Timer wheel.
+ * @arg2: Current tick (ticks before wheel->now are ignored).
+ * @arg3: Called for every expired timer.
+ * @arg4: Passed to fire().
+ *
+ * Return: the number of fired timers.
+ */
+unsigned int ttl_wheel_advance(ttl_wheel *wheel, unsigned long long now,
+							   void (*fire)(ttl_timer *timer, void *ctx),
+							   void *ctx);
+
+#endif  // TTL_H_
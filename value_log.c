@@ -0,0 +1,289 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "utils.h"
+#include "value_log.h"
+
+/* bytes a value takes in a segment, header included */
+static unsigned long long value_record_size(unsigned int size)
+{
+	return (sizeof(value_record) + size + 7) & ~7ull;
+}
+
+static value_record *value_log_record(void *value)
+{
+	return (value_record *)((unsigned char *)value -
+							offsetof(value_record, data));
+}
+
+/* creates, maps and unlinks a segment file; returns its descriptor or -1 */
+static int value_log_open_file(value_log_group *group, unsigned long long size)
+{
+	char path[strlen(group->path_template) + 1];
+
+	strcpy(path, group->path_template);
+	int fd = mkstemp(path);
+	if (fd < 0)
+		return -1;
+	unlink(path);
+
+	// the blocks are allocated now, so that a full disk is an error here
+	// instead of a SIGBUS on the first write to the mapping
+	if (posix_fallocate(fd, 0, size)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+value_log_group *value_log_group_create(const char *dir)
+{
+	static const char name[] = "/values-XXXXXX";
+
+	value_log_group *group = calloc(1, sizeof(*group));
+	DIE(!group, "calloc() for group failed\n");
+
+	group->path_template = malloc(strlen(dir) + sizeof(name));
+	DIE(!group->path_template, "malloc() for group->path_template failed\n");
+	strcpy(group->path_template, dir);
+	strcat(group->path_template, name);
+
+	// a directory where no segment can be created is refused now
+	int fd = value_log_open_file(group, 1);
+	if (fd < 0) {
+		value_log_group_free(group);
+		return NULL;
+	}
+	close(fd);
+
+	return group;
+}
+
+void value_log_group_free(value_log_group *group)
+{
+	if (!group)
+		return;
+
+	free(group->path_template);
+	free(group);
+}
+
+static void value_log_enqueue(value_log_group *group, value_segment *segment)
+{
+	segment->queued = 1;
+	segment->prev_queued = group->queue_tail;
+	segment->next_queued = NULL;
+	if (group->queue_tail)
+		group->queue_tail->next_queued = segment;
+	else
+		group->queue = segment;
+	group->queue_tail = segment;
+}
+
+static void value_log_dequeue(value_log_group *group, value_segment *segment)
+{
+	if (segment->prev_queued)
+		segment->prev_queued->next_queued = segment->next_queued;
+	else
+		group->queue = segment->next_queued;
+	if (segment->next_queued)
+		segment->next_queued->prev_queued = segment->prev_queued;
+	else
+		group->queue_tail = segment->prev_queued;
+	segment->queued = 0;
+}
+
+static value_segment *value_segment_create(value_log *log,
+										   unsigned long long size)
+{
+	value_log_group *group = log->group;
+	int fd = value_log_open_file(group, size);
+	DIE(fd < 0, "creating a value log segment failed");
+
+	value_segment *segment = calloc(1, sizeof(*segment));
+	DIE(!segment, "calloc() for segment failed\n");
+
+	segment->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+						 0);
+	DIE(segment->base == MAP_FAILED, "mmap() of a value log segment failed");
+	// the mapping keeps the file alive
+	close(fd);
+
+	segment->log = log;
+	segment->size = size;
+	segment->next = log->segments;
+	if (log->segments)
+		log->segments->prev = segment;
+	log->segments = segment;
+
+	group->no_segments++;
+	group->mapped_bytes += size;
+	return segment;
+}
+
+static void value_segment_free(value_segment *segment)
+{
+	value_log *log = segment->log;
+	value_log_group *group = log->group;
+
+	if (segment->queued)
+		value_log_dequeue(group, segment);
+
+	if (segment->prev)
+		segment->prev->next = segment->next;
+	else
+		log->segments = segment->next;
+	if (segment->next)
+		segment->next->prev = segment->prev;
+	if (log->head == segment)
+		log->head = NULL;
+
+	group->no_segments--;
+	group->mapped_bytes -= segment->size;
+	munmap(segment->base, segment->size);
+	free(segment);
+}
+
+/* queues a full segment once enough of it is dead */
+static void value_log_check_dead(value_segment *segment)
+{
+	if (segment->queued || segment == segment->log->head)
+		return;
+
+	unsigned long long dead = segment->used - segment->live;
+	if (dead * 100 >= segment->used * VALUE_LOG_COMPACT_PERCENT)
+		value_log_enqueue(segment->log->group, segment);
+}
+
+value_log *value_log_create(value_log_group *group)
+{
+	value_log *log = calloc(1, sizeof(*log));
+	DIE(!log, "calloc() for log failed\n");
+
+	log->group = group;
+	log->segment_size = VALUE_LOG_MIN_SEGMENT_SIZE;
+	group->no_logs++;
+	return log;
+}
+
+static void value_log_free(value_log *log)
+{
+	while (log->segments)
+		value_segment_free(log->segments);
+
+	log->group->no_logs--;
+	free(log);
+}
+
+void value_log_retire(value_log *log)
+{
+	if (!log)
+		return;
+
+	log->retired = 1;
+	if (!log->live_records)
+		value_log_free(log);
+}
+
+void *value_log_append(value_log *log, const void *value, unsigned int size,
+					   void **owner)
+{
+	unsigned long long record_size = value_record_size(size);
+	value_segment *segment = log->head;
+
+	if (record_size > VALUE_LOG_SEGMENT_SIZE) {
+		// a value larger than a segment gets one of its own, never appended
+		// to (nor compacted: it is all dead when it is freed)
+		long page = sysconf(_SC_PAGESIZE);
+		segment = value_segment_create(log, (record_size + page - 1) /
+											page * page);
+	} else if (!segment || segment->used + record_size > segment->size) {
+		value_segment *full = segment;
+
+		while (log->segment_size < record_size)
+			log->segment_size *= 2;
+		segment = value_segment_create(log, log->segment_size);
+		log->head = segment;
+		if (log->segment_size < VALUE_LOG_SEGMENT_SIZE)
+			log->segment_size *= 2;
+		// an empty head (rewound) that is too small goes at once
+		if (full && !full->live_records)
+			value_segment_free(full);
+		else if (full)
+			value_log_check_dead(full);
+	}
+
+	value_record *record = (value_record *)(segment->base + segment->used);
+	record->segment = segment;
+	record->owner = owner;
+	record->size = size;
+	memcpy(record->data, value, size);
+
+	segment->used += record_size;
+	segment->live += record_size;
+	segment->live_records++;
+	log->live_records++;
+	log->group->live_bytes += record_size;
+	return record->data;
+}
+
+void value_log_release(void *value)
+{
+	value_record *record = value_log_record(value);
+	value_segment *segment = record->segment;
+	value_log *log = segment->log;
+	unsigned long long record_size = value_record_size(record->size);
+
+	record->owner = NULL;
+	segment->live -= record_size;
+	segment->live_records--;
+	log->live_records--;
+	log->group->live_bytes -= record_size;
+
+	if (!log->live_records && log->retired) {
+		value_log_free(log);
+	} else if (!segment->live_records) {
+		// an empty head is rewound, any other empty segment is unmapped
+		if (segment == log->head)
+			segment->used = 0;
+		else
+			value_segment_free(segment);
+	} else {
+		value_log_check_dead(segment);
+	}
+}
+
+unsigned long long value_log_compact(value_log_group *group,
+									 unsigned long long budget)
+{
+	unsigned long long seen = 0, moved = 0;
+
+	// the segment at the head of the queue is freed with its last live
+	// record, so the loop never runs past its end
+	while (group->queue && seen < budget) {
+		value_segment *segment = group->queue;
+		value_record *record = (value_record *)(segment->base +
+												segment->cursor);
+		unsigned long long record_size = value_record_size(record->size);
+
+		segment->cursor += record_size;
+		seen += record_size;
+		if (!record->owner)
+			continue;
+
+		void **owner = record->owner;
+		*owner = value_log_append(segment->log, record->data, record->size,
+								  owner);
+		moved += record->size;
+		group->relocated_bytes += record->size;
+
+		if (segment->live_records == 1)
+			group->compacted++;
+		value_log_release(record->data);
+	}
+
+	return moved;
+}
@@ -0,0 +1,143 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#ifndef VALUE_LOG_H_
+#define VALUE_LOG_H_
+
+#include <stddef.h>
+
+/*
+ * Off-heap, log-structured storage for the values of a table: each value is
+ * appended to the head segment of its log, a file of a directory mapped
+ * into memory, and the table keeps a pointer into the mapping (the segment
+ * and the offset of the value), with its size. The heap only holds the
+ * keys and the entries, and the pages of the values are left to the page
+ * cache, which keeps the hot ones and writes the cold ones back to the file.
+ *
+ * The segment files are unlinked as soon as they are mapped: they only live
+ * as long as their mapping, and a crash leaves nothing behind.
+ *
+ * Every record knows where its value is referenced from (the value field
+ * of its entry), so that it can be moved. Overwritten and removed values
+ * become dead space: a segment with no live value left is unmapped at once,
+ * and a segment whose dead space reaches VALUE_LOG_COMPACT_PERCENT of it
+ * is queued for compaction, which copies its live values to the head of its
+ * log, a few at a time (value_log_compact()), between the requests, when
+ * no pointer to a value is held by a caller.
+ *
+ * The logs of a load balancer share a value_log_group: the directory, the
+ * queue of segments to compact and the statistics.
+ */
+
+/*
+ * Bytes of a segment: the segments of a log double from the smallest size
+ * to the largest one, so that the logs of the servers with few values stay
+ * small (a value that does not fit in the largest gets a segment of its
+ * own).
+ */
+#define VALUE_LOG_MIN_SEGMENT_SIZE (64u << 10)
+#define VALUE_LOG_SEGMENT_SIZE (4u << 20)
+/* share of dead bytes from which a full segment is compacted */
+#define VALUE_LOG_COMPACT_PERCENT 50
+/* bytes of records a compaction step may go through */
+#define VALUE_LOG_STEP_BUDGET (64u << 10)
+
+typedef struct value_log_group value_log_group;
+typedef struct value_log value_log;
+typedef struct value_segment value_segment;
+
+typedef struct value_record value_record;
+struct value_record {
+	value_segment *segment;  /* so that a value can be released on its own */
+	void **owner;  /* where the value is referenced from (NULL: dead) */
+	unsigned int size;
+	unsigned int pad;  /* the values stay 8-byte aligned */
+	unsigned char data[];
+};
+
+struct value_segment {
+	value_log *log;
+	unsigned char *base;  /* mapping of the file */
+	unsigned long long size;
+	unsigned long long used;  /* bytes of the records appended */
+	unsigned long long live;  /* bytes of the records still referenced */
+	unsigned int live_records;
+	/* compaction: offset of the next record to move, queued or not */
+	unsigned long long cursor;
+	int queued;
+	value_segment *prev, *next;  /* in the segments of its log */
+	value_segment *prev_queued, *next_queued;  /* in the compaction queue */
+};
+
+struct value_log {
+	value_log_group *group;
+	value_segment *head;  /* where the values are appended */
+	value_segment *segments;
+	unsigned long long segment_size;  /* of the next head */
+	unsigned long long live_records;
+	/* its table is gone: the log goes with its last value (moved entries) */
+	int retired;
+};
+
+struct value_log_group {
+	char *path_template;  /* of the segment files, for mkstemp() */
+	/* segments to compact, oldest first */
+	value_segment *queue, *queue_tail;
+
+	unsigned int no_logs;
+	unsigned int no_segments;
+	unsigned long long mapped_bytes;
+	unsigned long long live_bytes;  /* of the records still referenced */
+	unsigned long long compacted;  /* segments emptied by the compaction */
+	unsigned long long relocated_bytes;  /* copied by the compaction */
+};
+
+/*
+ * value_log_group_create() - Returns a group whose segments are created in
+ * a directory, or NULL if no file can be created there.
+ */
+value_log_group *value_log_group_create(const char *dir);
+
+/*
+ * value_log_group_free() - Frees the group; it goes after the tables, which
+ * release their values (and with them, their logs).
+ */
+void value_log_group_free(value_log_group *group);
+
+value_log *value_log_create(value_log_group *group);
+
+/*
+ * value_log_retire() - Called when the table of a log is freed: the log is
+ * freed right away if none of its values is referenced anymore, else with
+ * the last of them (entries moved to other tables keep their values).
+ */
+void value_log_retire(value_log *log);
+
+/**
+ * value_log_append() - Copies a value to the head of a log.
+ *
+ * @arg1: Log.
+ * @arg2: Value.
+ * @arg3: Size of the value, in bytes.
+ * @arg4: Where the returned pointer is kept, updated when the value moves.
+ *
+ * Return: the copy of the value (to be released with value_log_release()).
+ */
+void *value_log_append(value_log *log, const void *value, unsigned int size,
+					   void **owner);
+
+/* value_log_release() - Marks a value appended to a log as dead. */
+void value_log_release(void *value);
+
+/**
+ * value_log_compact() - Moves the live values of the segments queued for
+ *                       compaction to the heads of their logs, in order,
+ *                       unmapping the segments emptied.
+ *
+ * @arg1: Group.
+ * @arg2: Bytes of records to go through, at most (about).
+ *
+ * Return: bytes of values moved.
+ */
+unsigned long long value_log_compact(value_log_group *group,
+									 unsigned long long budget);
+
+#endif  // VALUE_LOG_H_
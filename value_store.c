@@ -0,0 +1,138 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#include "utils.h"
+#include "value_store.h"
+
+/* FNV-1a */
+static unsigned int value_store_hash(const unsigned char *value,
+									 unsigned int size)
+{
+	unsigned int hash = 2166136261u;
+
+	for (unsigned int i = 0; i < size; i++) {
+		hash ^= value[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static value_ref *value_store_ref(void *value)
+{
+	return (value_ref *)((unsigned char *)value - offsetof(value_ref, data));
+}
+
+value_store *value_store_create(void)
+{
+	value_store *store = calloc(1, sizeof(*store));
+	DIE(!store, "calloc() for *store failed\n");
+
+	store->no_buckets = VALUE_STORE_MIN_BUCKETS;
+	store->buckets = calloc(store->no_buckets, sizeof(*store->buckets));
+	DIE(!store->buckets, "calloc() for store->buckets failed\n");
+
+	return store;
+}
+
+void value_store_free(value_store *store)
+{
+	if (!store)
+		return;
+
+	for (unsigned int i = 0; i < store->no_buckets; i++) {
+		value_ref *curr = store->buckets[i];
+
+		while (curr) {
+			value_ref *next = curr->next;
+
+			free(curr);
+			curr = next;
+		}
+	}
+
+	free(store->buckets);
+	free(store);
+}
+
+/* doubles the number of buckets; the values keep their hashes */
+static void value_store_grow(value_store *store)
+{
+	unsigned int no_buckets = store->no_buckets * 2;
+	value_ref **buckets = calloc(no_buckets, sizeof(*buckets));
+	DIE(!buckets, "calloc() for buckets failed\n");
+
+	for (unsigned int i = 0; i < store->no_buckets; i++) {
+		value_ref *curr = store->buckets[i];
+
+		while (curr) {
+			value_ref *next = curr->next;
+			unsigned int index = curr->hash & (no_buckets - 1);
+
+			curr->next = buckets[index];
+			buckets[index] = curr;
+			curr = next;
+		}
+	}
+
+	free(store->buckets);
+	store->buckets = buckets;
+	store->no_buckets = no_buckets;
+}
+
+void *value_store_intern(value_store *store, const void *value,
+						 unsigned int size)
+{
+	unsigned int hash = value_store_hash(value, size);
+	value_ref **bucket = &store->buckets[hash & (store->no_buckets - 1)];
+
+	store->refs++;
+	for (value_ref *curr = *bucket; curr; curr = curr->next)
+		if (curr->hash == hash && curr->size == size &&
+			!memcmp(curr->data, value, size)) {
+			curr->refs++;
+			store->shared_bytes += size;
+			return curr->data;
+		}
+
+	value_ref *ref = malloc(sizeof(*ref) + size);
+	DIE(!ref, "malloc() for *ref failed\n");
+
+	ref->store = store;
+	ref->hash = hash;
+	ref->refs = 1;
+	ref->size = size;
+	memcpy(ref->data, value, size);
+
+	ref->next = *bucket;
+	*bucket = ref;
+	store->no_values++;
+	store->bytes += size;
+
+	if (store->no_values > store->no_buckets)
+		value_store_grow(store);
+
+	return ref->data;
+}
+
+void value_store_release(void *value)
+{
+	if (!value)
+		return;
+
+	value_ref *ref = value_store_ref(value);
+	value_store *store = ref->store;
+
+	store->refs--;
+	if (--ref->refs) {
+		store->shared_bytes -= ref->size;
+		return;
+	}
+
+	value_ref **link = &store->buckets[ref->hash & (store->no_buckets - 1)];
+	while (*link != ref)
+		link = &(*link)->next;
+	*link = ref->next;
+
+	store->no_values--;
+	store->bytes -= ref->size;
+	free(ref);
+}
@@ -0,0 +1,66 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#ifndef VALUE_STORE_H_
+#define VALUE_STORE_H_
+
+#include <stddef.h>
+
+/*
+ * Content-addressed, reference-counted values: every distinct value is kept
+ * once, and the entries that store it share it. Interning a value that is
+ * already in the store is a lookup and a reference count increment; a value
+ * is freed when its last reference is released.
+ *
+ * The values are indexed by a chained hash table whose number of buckets
+ * (a power of two) doubles when it holds as many values as buckets.
+ */
+
+#define VALUE_STORE_MIN_BUCKETS 64
+
+typedef struct value_store value_store;
+
+typedef struct value_ref value_ref;
+struct value_ref {
+	value_store *store;  /* so that a value can be released on its own */
+	value_ref *next;  /* in its bucket */
+	unsigned int hash;
+	unsigned int refs;
+	unsigned int size;
+	unsigned char data[];
+};
+
+struct value_store {
+	value_ref **buckets;
+	unsigned int no_buckets;
+	unsigned int no_values;  /* distinct values */
+
+	unsigned long long refs;  /* references to all the values */
+	unsigned long long bytes;  /* of the distinct values */
+	unsigned long long shared_bytes;  /* bytes not copied thanks to sharing */
+};
+
+value_store *value_store_create(void);
+
+/*
+ * value_store_free() - Frees the store; the values still referenced are
+ * freed too, so it goes after the tables that use it.
+ */
+void value_store_free(value_store *store);
+
+/**
+ * value_store_intern() - Takes a reference to a value, adding it to the
+ *                        store if it is not there yet.
+ *
+ * @arg1: Store.
+ * @arg2: Value.
+ * @arg3: Size of the value, in bytes.
+ *
+ * Return: the shared copy of the value (to be released with
+ *         value_store_release()).
+ */
+void *value_store_intern(value_store *store, const void *value,
+						 unsigned int size);
+
+/* value_store_release() - Drops a reference taken by value_store_intern(). */
+void value_store_release(void *value);
+
+#endif  // VALUE_STORE_H_
@@ -0,0 +1,352 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "utils.h"
+#include "checksum.h"
+#include "latency.h"
+#include "load_balancer.h"
+#include "wal.h"
+
+/* larger payloads can only come from a corrupt length field */
+#define WAL_MAX_PAYLOAD (1u << 30)
+
+typedef struct wal_record_header wal_record_header;
+struct wal_record_header {
+	unsigned int crc;
+	unsigned int type;
+	unsigned long long lsn;
+	unsigned int len1;
+	unsigned int len2;
+};
+
+wal *wal_open(const char *path, wal_sync_policy policy,
+			  unsigned long long sync_param, unsigned long long next_lsn)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0)
+		return NULL;
+
+	wal *log = calloc(1, sizeof(*log));
+	DIE(!log, "calloc() for *log failed\n");
+
+	log->fd = fd;
+	log->buf_cap = WAL_BUFFER_SIZE;
+	log->buf = malloc(log->buf_cap);
+	DIE(!log->buf, "malloc() for log->buf failed\n");
+
+	log->policy = policy;
+	log->sync_param = sync_param;
+	log->last_sync_ns = lat_now_ns();
+	log->next_lsn = next_lsn;
+
+	return log;
+}
+
+/* writes the whole buffer, retrying on short writes */
+static int wal_write_buffer(wal *log)
+{
+	size_t done = 0;
+
+	while (done < log->buf_len) {
+		ssize_t ret = write(log->fd, log->buf + done, log->buf_len - done);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		done += ret;
+	}
+
+	if (log->buf_len)
+		log->writes++;
+	log->buf_len = 0;
+	return 0;
+}
+
+int wal_flush(wal *log)
+{
+	if (!log)
+		return 0;
+
+	if (wal_write_buffer(log))
+		return -1;
+
+	if (log->policy != WAL_SYNC_NONE && log->unsynced) {
+		if (fsync(log->fd))
+			return -1;
+		log->syncs++;
+	}
+
+	log->unsynced = 0;
+	log->last_sync_ns = lat_now_ns();
+	return 0;
+}
+
+int wal_tick(wal *log, unsigned long long now)
+{
+	if (!log)
+		return 0;
+
+	if (log->policy == WAL_SYNC_INTERVAL) {
+		if (log->unsynced &&
+			now >= log->last_sync_ns + log->sync_param * 1000000)
+			return wal_flush(log);
+		return 0;
+	}
+
+	// the other policies sync by count (or never), but the records still
+	// reach the file in bounded time
+	if (log->buf_len &&
+		now >= log->buffered_ns + WAL_WRITE_DELAY_MS * 1000000ull)
+		return wal_write_buffer(log);
+	return 0;
+}
+
+/* commits the current group if the sync policy says it is time to */
+static void wal_maybe_commit(wal *log)
+{
+	if (log->policy == WAL_SYNC_EVERY_N && log->unsynced >= log->sync_param)
+		DIE(wal_flush(log), "wal_flush() failed");
+	else
+		// clock_gettime() goes through the vDSO, it is not a syscall
+		DIE(wal_tick(log, lat_now_ns()), "wal_tick() failed");
+}
+
+/* size of the payload of a record (its lengths were validated or set) */
+static size_t wal_payload_len(wal_record_header *header)
+{
+	switch (header->type) {
+	case WAL_STORE:
+		return (size_t)header->len1 + header->len2;
+	case WAL_STORE_TTL:
+		return WAL_TTL_PREFIX + header->len1 + header->len2;
+	default:
+		return 0;
+	}
+}
+
+/* the payload is prefix (WAL_TTL_PREFIX bytes, if any), key, value */
+static unsigned long long wal_append(wal *log, wal_record_type type,
+									 unsigned int len1, unsigned int len2,
+									 const void *prefix,
+									 const void *payload1,
+									 const void *payload2)
+{
+	wal_record_header header;
+	size_t prefix_len = prefix ? WAL_TTL_PREFIX : 0;
+	size_t payload_len = prefix_len + (payload1 ? len1 : 0) +
+						 (payload2 ? len2 : 0);
+	size_t record_len = sizeof(header) + payload_len;
+
+	// make room for the record, growing the buffer for huge records
+	if (log->buf_len + record_len > log->buf_cap) {
+		DIE(wal_write_buffer(log), "write() to the log failed");
+
+		if (record_len > log->buf_cap) {
+			log->buf_cap = record_len;
+			log->buf = realloc(log->buf, log->buf_cap);
+			DIE(!log->buf, "realloc() for log->buf failed\n");
+		}
+	}
+
+	header.type = type;
+	header.lsn = log->next_lsn++;
+	header.len1 = len1;
+	header.len2 = len2;
+
+	if (!log->buf_len)
+		log->buffered_ns = lat_now_ns();
+
+	char *record = log->buf + log->buf_len;
+	char *payload = record + sizeof(header) + prefix_len;
+	memcpy(record, &header, sizeof(header));
+	if (prefix)
+		memcpy(record + sizeof(header), prefix, prefix_len);
+	// payload1 is followed by a null terminator, counted in len1
+	if (payload1) {
+		memcpy(payload, payload1, len1 - 1);
+		payload[len1 - 1] = 0;
+	}
+	if (payload2)
+		memcpy(payload + len1, payload2, len2);
+
+	// the crc covers everything after itself
+	header.crc = crc32(0, record + sizeof(header.crc),
+					   record_len - sizeof(header.crc));
+	memcpy(record, &header.crc, sizeof(header.crc));
+
+	log->buf_len += record_len;
+	log->unsynced++;
+	log->records++;
+
+	wal_maybe_commit(log);
+	return header.lsn;
+}
+
+unsigned long long wal_log_store(wal *log, const void *key, size_t key_len,
+								 const void *value, size_t value_len)
+{
+	// the key is logged with a null terminator, as the tables keep it
+	return wal_append(log, WAL_STORE, key_len + 1, value_len, NULL, key,
+					  value);
+}
+
+unsigned long long wal_log_store_ttl(wal *log, const void *key,
+									 size_t key_len, const void *value,
+									 size_t value_len, unsigned long long now,
+									 unsigned long long expires)
+{
+	unsigned long long clocks[2] = {now, expires};
+
+	return wal_append(log, WAL_STORE_TTL, key_len + 1, value_len, clocks,
+					  key, value);
+}
+
+unsigned long long wal_log_server(wal *log, wal_record_type type,
+								  int server_id)
+{
+	return wal_append(log, type, server_id, 0, NULL, NULL, NULL);
+}
+
+int wal_truncate(wal *log)
+{
+	if (wal_flush(log) || ftruncate(log->fd, 0))
+		return -1;
+
+	return log->policy != WAL_SYNC_NONE ? fsync(log->fd) : 0;
+}
+
+int wal_close(wal *log)
+{
+	if (!log)
+		return 0;
+
+	int ret = wal_flush(log);
+	if (close(log->fd))
+		ret = -1;
+
+	free(log->buf);
+	free(log);
+	return ret;
+}
+
+/* applies one validated record to the load balancer */
+static void wal_apply(load_balancer *main, wal_record_header *header,
+					  char *payload)
+{
+	int server_id = 0;
+
+	switch (header->type) {
+	case WAL_STORE:
+		loader_store_len(main, payload, header->len1 - 1,
+						 payload + header->len1, header->len2, &server_id);
+		break;
+	case WAL_STORE_TTL: {
+		unsigned long long clocks[2];
+		char *key = payload + WAL_TTL_PREFIX;
+
+		// the clock goes on from the one of the store
+		memcpy(clocks, payload, sizeof(clocks));
+		loader_tick(main, clocks[0]);
+
+		if (clocks[1] > main->now)
+			loader_store_ttl_len(main, key, header->len1 - 1,
+								 key + header->len1, header->len2,
+								 clocks[1] - main->now, &server_id);
+		else
+			loader_remove_len(main, key, header->len1 - 1);
+		break;
+	}
+	case WAL_ADD_SERVER:
+		loader_add_server(main, header->len1);
+		break;
+	case WAL_REMOVE_SERVER:
+		loader_remove_server(main, header->len1);
+		break;
+	}
+}
+
+/* checks that a record read from the file is complete and consistent */
+static int wal_record_valid(wal_record_header *header, char *payload)
+{
+	unsigned int crc = crc32(0, (char *)header + sizeof(header->crc),
+							 sizeof(*header) - sizeof(header->crc));
+
+	switch (header->type) {
+	case WAL_STORE:
+	case WAL_STORE_TTL: {
+		char *key = payload + (header->type == WAL_STORE_TTL ?
+							   WAL_TTL_PREFIX : 0);
+
+		// any bytes may follow the terminator of the key
+		if (!header->len1 || key[header->len1 - 1])
+			return 0;
+		crc = crc32(crc, payload, wal_payload_len(header));
+		break;
+	}
+	case WAL_ADD_SERVER:
+	case WAL_REMOVE_SERVER:
+		if (header->len1 >= MAX_SERVERS || header->len2)
+			return 0;
+		break;
+	default:
+		return 0;
+	}
+
+	return crc == header->crc;
+}
+
+long long wal_replay(const char *path, load_balancer *main)
+{
+	FILE *file = fopen(path, "rb");
+	long long applied = 0;
+	long good_offset = 0;
+	char *payload = NULL;
+	size_t payload_cap = 0;
+
+	// a missing log is an empty log
+	if (!file)
+		return errno == ENOENT ? 0 : -1;
+
+	while (1) {
+		wal_record_header header;
+
+		if (fread(&header, sizeof(header), 1, file) != 1)
+			break;
+
+		size_t payload_len = wal_payload_len(&header);
+		if (payload_len > WAL_MAX_PAYLOAD)
+			break;
+		if (payload_len > payload_cap) {
+			payload_cap = payload_len;
+			payload = realloc(payload, payload_cap);
+			DIE(!payload, "realloc() for payload failed\n");
+		}
+
+		if (fread(payload, 1, payload_len, file) != payload_len ||
+			!wal_record_valid(&header, payload))
+			break;
+
+		if (header.lsn > main->wal_lsn) {
+			wal_apply(main, &header, payload);
+			main->wal_lsn = header.lsn;
+			applied++;
+		}
+		good_offset = ftell(file);
+	}
+
+	free(payload);
+	fclose(file);
+
+	// cut off a torn tail, so new records are appended after a valid one
+	struct stat st;
+	if (stat(path, &st))
+		return -1;
+	if (st.st_size != good_offset && truncate(path, good_offset))
+		return -1;
+
+	return applied;
+}
@@ -0,0 +1,160 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#ifndef WAL_H_
+#define WAL_H_
+
+#include <stddef.h>
+
+/*
+ * Append-only write-ahead log of the operations that change the system
+ * (store, add_server, remove_server).
+ *
+ * Records are appended to an in-memory buffer and written with a single
+ * write() per group (group commit); fsync() is issued according to the
+ * sync policy. Every record has a sequence number (LSN), so that a replay
+ * on top of a snapshot skips what the snapshot already contains.
+ *
+ * Record layout (host byte order):
+ *   u32 crc (over everything that follows), u32 type,
+ *   u64 lsn, u32 len1, u32 len2, payload (len1 + len2 bytes)
+ * store: payload = key (with a NUL terminator), value (as stored: the
+ *        string values keep their NUL terminator)
+ * store_ttl: payload = u64 clock of the store, u64 tick it expires at,
+ *            then the key and value of a store
+ * add_server / remove_server: len1 = server ID, no payload
+ */
+
+#define WAL_BUFFER_SIZE (64 * 1024)
+/*
+ * Longest a buffered record waits for its write() under the none and
+ * every:<n> policies (the interval policy commits on its own deadline).
+ */
+#define WAL_WRITE_DELAY_MS 100
+
+typedef enum wal_record_type {
+	WAL_STORE = 1,
+	WAL_ADD_SERVER,
+	WAL_REMOVE_SERVER,
+	WAL_STORE_TTL
+} wal_record_type;
+
+/* bytes of the two clocks that open a store_ttl payload */
+#define WAL_TTL_PREFIX (2 * sizeof(unsigned long long))
+
+typedef enum wal_sync_policy {
+	WAL_SYNC_NONE,  /* never fsync(), the OS writes the pages back */
+	WAL_SYNC_INTERVAL,  /* fsync() at most once every sync_param ms */
+	WAL_SYNC_EVERY_N  /* fsync() after every sync_param records */
+} wal_sync_policy;
+
+struct load_balancer;
+
+typedef struct wal wal;
+struct wal {
+	int fd;
+	char *buf;  /* records not yet written to the file */
+	size_t buf_len;
+	size_t buf_cap;
+
+	wal_sync_policy policy;
+	unsigned long long sync_param;
+	unsigned long long last_sync_ns;
+	unsigned int unsynced;  /* records appended since the last fsync() */
+	unsigned long long buffered_ns;  /* when the buffered group started */
+
+	unsigned long long next_lsn;
+
+	/* statistics */
+	unsigned long long records;
+	unsigned long long writes;
+	unsigned long long syncs;
+};
+
+/**
+ * wal_open() - Opens (or creates) a log for appending.
+ *
+ * @arg1: Path of the log file.
+ * @arg2: fsync() policy.
+ * @arg3: Interval in ms (WAL_SYNC_INTERVAL) or number of records
+ *        (WAL_SYNC_EVERY_N); ignored for WAL_SYNC_NONE.
+ * @arg4: Sequence number of the first appended record.
+ *
+ * Return: the log, or NULL if the file cannot be opened.
+ */
+wal *wal_open(const char *path, wal_sync_policy policy,
+			  unsigned long long sync_param, unsigned long long next_lsn);
+
+/*
+ * wal_log_store(), wal_log_server() - Append a record; the record reaches
+ * the file once its group is committed (buffer full, sync policy due, or
+ * an explicit wal_flush()). They return the LSN given to the record.
+ */
+unsigned long long wal_log_store(wal *log, const void *key, size_t key_len,
+								 const void *value, size_t value_len);
+unsigned long long wal_log_server(wal *log, wal_record_type type,
+								  int server_id);
+
+/*
+ * wal_log_store_ttl() - Appends a store of a key that expires: the clock of
+ * the load balancer and the (absolute) tick of the expiry are logged with
+ * it, so that a replay goes on from that clock and drops the keys that
+ * expired already (see wal_replay()).
+ */
+unsigned long long wal_log_store_ttl(wal *log, const void *key,
+									 size_t key_len, const void *value,
+									 size_t value_len, unsigned long long now,
+									 unsigned long long expires);
+
+/**
+ * wal_flush() - Commits the buffered group: writes it with one write() and
+ *               calls fsync() unless the policy is WAL_SYNC_NONE.
+ *
+ * Return: 0 on success, -1 on I/O errors.
+ */
+int wal_flush(wal *log);
+
+/**
+ * wal_tick() - Commits the buffered group once its deadline passed, even
+ *              if no record was appended since: the interval since the
+ *              last fsync() under WAL_SYNC_INTERVAL, else WAL_WRITE_DELAY_MS
+ *              after its first record (written, and synced by the policy).
+ *
+ * Meant to be called from the request loop and while idle, so that an
+ * acknowledged record does not wait in the buffer for the next one.
+ *
+ * @arg1: Log (NULL: nothing to do).
+ * @arg2: Current time, in ns (lat_now_ns()).
+ *
+ * Return: 0 on success, -1 on I/O errors.
+ */
+int wal_tick(wal *log, unsigned long long now);
+
+/**
+ * wal_truncate() - Empties the log, once a snapshot holds its records.
+ *
+ * Return: 0 on success, -1 on I/O errors.
+ */
+int wal_truncate(wal *log);
+
+/* wal_close() - Commits the buffered records and closes the log. */
+int wal_close(wal *log);
+
+/**
+ * wal_replay() - Applies the records of a log to a load balancer.
+ *
+ * Records whose LSN is not greater than main->wal_lsn (already contained
+ * by the snapshot the load balancer was loaded from) are skipped. A torn or
+ * corrupt tail, left by a crash in the middle of a write, is cut off.
+ *
+ * A store with a TTL moves the clock of the load balancer forward to the
+ * one it was logged at, and keeps its expiry; if the key has expired by
+ * then, the key is removed instead, so that the value it overwrote does
+ * not come back.
+ *
+ * @arg1: Path of the log file (a missing file is an empty log).
+ * @arg2: Load balancer to apply the records to (main->wal must be NULL).
+ *
+ * Return: number of applied records, or -1 on I/O errors.
+ */
+long long wal_replay(const char *path, struct load_balancer *main);
+
+#endif  // WAL_H_
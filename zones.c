@@ -0,0 +1,409 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#include "utils.h"
+#include "zones.h"
+#include "hashtable.h"
+#include "profile.h"
+
+unsigned int zones_key_hash(unsigned int hash)
+{
+	// finalizer of MurmurHash3: the keys of a zone all come from its arcs
+	// of the top-level ring, so they are spread again over the whole circle
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+unsigned int zones_point_hash(int zone_id, int point)
+{
+	unsigned int label = MAX_ZONES * point + zone_id;
+
+	return hash_function_servers(&label);
+}
+
+int loader_enable_zones(load_balancer *main, int default_zones)
+{
+	if (main->no_servers || main->replication > 1 || main->lazy_migration ||
+		default_zones < 1 || default_zones > MAX_ZONES)
+		return -1;
+
+	if (!main->zones) {
+		zone_map *map = calloc(1, sizeof(*map));
+		DIE(!map, "calloc() for *map failed\n");
+
+		hashring_init(&map->ring);
+		map->zones = calloc(MAX_ZONES, sizeof(*map->zones));
+		DIE(!map->zones, "calloc() for map->zones failed\n");
+		map->server_zones = malloc(MAX_SERVERS * sizeof(*map->server_zones));
+		DIE(!map->server_zones, "malloc() for map->server_zones failed\n");
+		// every byte set: -1 for every server
+		memset(map->server_zones, 0xFF,
+			   MAX_SERVERS * sizeof(*map->server_zones));
+
+		main->zones = map;
+	}
+	main->zones->default_zones = default_zones;
+
+	return 0;
+}
+
+static void zone_free(zone *zone)
+{
+	hashring_free(&zone->ring);
+	free(zone);
+}
+
+void zones_free(zone_map *map)
+{
+	if (!map)
+		return;
+
+	for (int i = 0; i < MAX_ZONES; i++)
+		if (map->zones[i])
+			zone_free(map->zones[i]);
+
+	hashring_free(&map->ring);
+	free(map->zones);
+	free(map->server_zones);
+	free(map);
+}
+
+int zones_find_server(const zone_map *map, unsigned int hash)
+{
+	int zone_id = hashring_owner(&map->ring, hash);
+
+	// no zone (so no server) yet
+	if (zone_id < 0)
+		return 0;
+
+	const zone *zone = map->zones[zone_id % MAX_ZONES];
+	return hashring_owner(&zone->ring, zones_key_hash(hash)) % MAX_SERVERS;
+}
+
+/* the entries of a server that the current rings place on another server */
+typedef struct zone_reroute zone_reroute;
+struct zone_reroute {
+	load_balancer *main;
+	int source;
+};
+
+static hashtable_t *zone_reroute_dest(info *entry, void *ctx)
+{
+	zone_reroute *reroute = (zone_reroute *)ctx;
+	load_balancer *main = reroute->main;
+
+	// with no server left, the entries stay (and go with their server)
+	if (!main->zones->ring.no_points)
+		return NULL;
+
+	int owner = zones_find_server(main->zones, entry->hash);
+	if (owner == reroute->source)
+		return NULL;
+	return main->servers[owner]->memory;
+}
+
+static void zone_reroute_server(load_balancer *main, int server_id)
+{
+	PROF_BEGIN(prof_start);
+	zone_reroute reroute = {main, server_id};
+
+	ht_move_entries(main->servers[server_id]->memory, zone_reroute_dest,
+					&reroute);
+	PROF_END(PROF_MIGRATION, prof_start);
+}
+
+/*
+ * The servers of a zone, through the first replica of each of them (label
+ * < MAX_SERVERS) on the zone's ring; returns their number.
+ */
+static int zone_servers(const zone *zone, int *server_ids)
+{
+	int count = 0;
+
+	for (hashring_pos pos = hashring_begin(&zone->ring); pos.leaf;
+		 hashring_step(&pos))
+		if (hashring_pos_label(pos) < MAX_SERVERS)
+			server_ids[count++] = hashring_pos_label(pos);
+
+	return count;
+}
+
+/* moves the keys that the servers of a zone no longer own */
+static void zone_reroute_all(load_balancer *main, const zone *zone)
+{
+	int *server_ids = malloc(zone->no_servers * sizeof(*server_ids));
+	DIE(!server_ids, "malloc() for server_ids failed\n");
+
+	int count = zone_servers(zone, server_ids);
+	for (int i = 0; i < count; i++)
+		zone_reroute_server(main, server_ids[i]);
+
+	free(server_ids);
+}
+
+/* the servers of a zone may be over their memory budget after a move */
+static void zone_fit_budgets(load_balancer *main, const zone *zone)
+{
+	if (!main->server_budget)
+		return;
+
+	for (hashring_pos pos = hashring_begin(&zone->ring); pos.leaf;
+		 hashring_step(&pos))
+		if (hashring_pos_label(pos) < MAX_SERVERS)
+			server_fit_budget(main->servers[hashring_pos_label(pos)]);
+}
+
+/* adds an ID to a small set, if it is not in it yet */
+static int zone_set_add(int *ids, int count, int id)
+{
+	for (int i = 0; i < count; i++)
+		if (ids[i] == id)
+			return count;
+
+	ids[count] = id;
+	return count + 1;
+}
+
+/*
+ * Puts the points of a server on the ring of its zone; fills `neighbors`
+ * with the servers of the zone whose arcs the points take over.
+ */
+static int zone_insert_server(zone_map *map, zone *zone, int zone_id,
+							  int server_id, int *neighbors)
+{
+	int count = 0;
+
+	for (int i = 0; i < REPLICAS; i++) {
+		unsigned int label = MAX_SERVERS * i + server_id;
+		unsigned int hash = hash_function_servers(&label);
+		int owner = hashring_owner(&zone->ring, hash);
+
+		// the arc that ends with the new point belonged to the owner of
+		// its hash so far
+		if (owner >= 0 && owner % MAX_SERVERS != server_id)
+			count = zone_set_add(neighbors, count, owner % MAX_SERVERS);
+		hashring_insert(&zone->ring, label, hash);
+	}
+
+	zone->no_servers++;
+	map->server_zones[server_id] = zone_id;
+
+	return count;
+}
+
+void loader_add_server_to_zone(load_balancer *main, int server_id,
+							   int zone_id)
+{
+	zone_map *map = main->zones;
+	int neighbors[REPLICAS];
+
+	server_id %= MAX_SERVERS;
+	zone_id %= MAX_ZONES;
+
+	// the first server of a zone brings the zone onto the top-level ring
+	if (!map->zones[zone_id]) {
+		loader_add_zone(main, zone_id, &server_id, 1);
+		return;
+	}
+
+	zone *zone = map->zones[zone_id];
+	server_memory *new_server = loader_init_server(main, server_id);
+	int count = zone_insert_server(map, zone, zone_id, server_id, neighbors);
+
+	// only the servers of the zone hand keys over to the new one
+	for (int i = 0; i < count; i++)
+		zone_reroute_server(main, neighbors[i]);
+
+	// the keys taken over from the neighbors may exceed the budget
+	server_fit_budget(new_server);
+}
+
+void loader_add_zone(load_balancer *main, int zone_id, const int *server_ids,
+					 int count)
+{
+	zone_map *map = main->zones;
+	int neighbors[ZONE_POINTS];
+	int no_neighbors = 0;
+
+	zone_id %= MAX_ZONES;
+	if (map->zones[zone_id]) {
+		for (int i = 0; i < count; i++)
+			loader_add_server_to_zone(main, server_ids[i], zone_id);
+		return;
+	}
+	if (count < 1)
+		return;
+
+	zone *new_zone = calloc(1, sizeof(*new_zone));
+	DIE(!new_zone, "calloc() for *new_zone failed\n");
+	hashring_init(&new_zone->ring);
+	map->zones[zone_id] = new_zone;
+	map->no_zones++;
+
+	// the ring of the zone is complete before the zone gets any key
+	for (int i = 0; i < count; i++) {
+		int server_id = server_ids[i] % MAX_SERVERS;
+		int unused[REPLICAS];
+
+		loader_init_server(main, server_id);
+		zone_insert_server(map, new_zone, zone_id, server_id, unused);
+	}
+
+	// each point takes over an arc from the zone that owned its hash
+	for (int i = 0; i < ZONE_POINTS; i++) {
+		unsigned int hash = zones_point_hash(zone_id, i);
+		int owner = hashring_owner(&map->ring, hash);
+
+		if (owner >= 0 && owner % MAX_ZONES != zone_id)
+			no_neighbors = zone_set_add(neighbors, no_neighbors,
+										owner % MAX_ZONES);
+		hashring_insert(&map->ring, MAX_ZONES * i + zone_id, hash);
+	}
+
+	for (int i = 0; i < no_neighbors; i++)
+		zone_reroute_all(main, map->zones[neighbors[i]]);
+
+	zone_fit_budgets(main, new_zone);
+}
+
+/*
+ * Takes a zone off the top-level ring and frees it; fills `heirs` with the
+ * zones that inherit its arcs and returns their number.
+ */
+static int zone_leave(zone_map *map, int zone_id, int *heirs)
+{
+	int count = 0;
+
+	for (int i = 0; i < ZONE_POINTS; i++)
+		hashring_erase(&map->ring, zones_point_hash(zone_id, i));
+
+	for (int i = 0; i < ZONE_POINTS && map->ring.no_points; i++) {
+		int heir = hashring_owner(&map->ring, zones_point_hash(zone_id, i));
+
+		count = zone_set_add(heirs, count, heir % MAX_ZONES);
+	}
+
+	zone_free(map->zones[zone_id]);
+	map->zones[zone_id] = NULL;
+	map->no_zones--;
+
+	return count;
+}
+
+void zones_remove_server(load_balancer *main, int server_id)
+{
+	zone_map *map = main->zones;
+	int zone_id = map->server_zones[server_id];
+	int heirs[ZONE_POINTS];
+	int no_heirs = 0;
+
+	if (zone_id < 0)
+		return;
+
+	zone *zone = map->zones[zone_id];
+	for (int i = 0; i < REPLICAS; i++) {
+		unsigned int label = MAX_SERVERS * i + server_id;
+
+		hashring_erase(&zone->ring, hash_function_servers(&label));
+	}
+	zone->no_servers--;
+	map->server_zones[server_id] = -1;
+
+	// the last server takes the zone off the top-level ring
+	if (!zone->no_servers) {
+		no_heirs = zone_leave(map, zone_id, heirs);
+		zone = NULL;
+	}
+
+	zone_reroute_server(main, server_id);
+
+	// the servers that got the keys may now be over their budget
+	if (zone)
+		zone_fit_budgets(main, zone);
+	for (int i = 0; i < no_heirs; i++)
+		zone_fit_budgets(main, map->zones[heirs[i]]);
+}
+
+void loader_remove_zone(load_balancer *main, int zone_id)
+{
+	zone_map *map = main->zones;
+	int heirs[ZONE_POINTS];
+
+	zone_id %= MAX_ZONES;
+	if (!map->zones[zone_id])
+		return;
+
+	zone *zone = map->zones[zone_id];
+	int *server_ids = malloc(zone->no_servers * sizeof(*server_ids));
+	DIE(!server_ids, "malloc() for server_ids failed\n");
+
+	int count = zone_servers(zone, server_ids);
+	int no_heirs = zone_leave(map, zone_id, heirs);
+
+	// the keys of the zone follow the top-level ring to the heirs
+	for (int i = 0; i < count; i++) {
+		int server_id = server_ids[i];
+
+		map->server_zones[server_id] = -1;
+		zone_reroute_server(main, server_id);
+		free_server_memory(main->servers[server_id]);
+		main->servers[server_id] = NULL;
+		main->no_servers--;
+	}
+
+	for (int i = 0; i < no_heirs; i++)
+		zone_fit_budgets(main, map->zones[heirs[i]]);
+
+	free(server_ids);
+}
+
+void loader_print_zone_stats(load_balancer *main, FILE *out)
+{
+	zone_map *map = main->zones;
+	unsigned long long total_keys = 0;
+
+	if (!map)
+		return;
+
+	for (int i = 0; i < MAX_SERVERS; i++)
+		if (main->servers[i])
+			total_keys += ht_get_size(main->servers[i]->memory);
+
+	fprintf(out, "%6s %8s %10s %12s %8s %9s\n", "zone", "servers", "keys",
+			"bytes", "keys%", "max/mean");
+
+	for (int z = 0; z < MAX_ZONES; z++) {
+		const zone *zone = map->zones[z];
+		unsigned long long keys = 0, bytes = 0, max_keys = 0;
+
+		if (!zone)
+			continue;
+
+		for (hashring_pos pos = hashring_begin(&zone->ring); pos.leaf;
+			 hashring_step(&pos)) {
+			int label = hashring_pos_label(pos);
+
+			if (label >= MAX_SERVERS)
+				continue;
+
+			hashtable_t *memory = main->servers[label]->memory;
+			unsigned long long server_keys = ht_get_size(memory);
+
+			keys += server_keys;
+			bytes += memory->bytes;
+			if (server_keys > max_keys)
+				max_keys = server_keys;
+		}
+
+		double mean = (double)keys / zone->no_servers;
+		fprintf(out, "%6d %8d %10llu %12llu %7.2f%% %9.2f\n", z,
+				zone->no_servers, keys, bytes,
+				total_keys ? 100.0 * keys / total_keys : 0.0,
+				keys ? max_keys / mean : 0.0);
+	}
+
+	fprintf(out, "zones: %d, %d points on the top-level ring\n",
+			map->no_zones, map->ring.no_points);
+}
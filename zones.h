@@ -0,0 +1,122 @@
+/* Copyright 2023 Munteanu Eugen 315CA */
+#ifndef ZONES_H_
+#define ZONES_H_
+
+#include <stdio.h>
+#include "load_balancer.h"
+#include "hashring.h"
+
+/*
+ * Zoned (two-level) hashring, for very large clusters or to keep the keys
+ * inside failure domains. A top-level ring holds ZONE_POINTS points per
+ * zone, and every zone keeps its own small ring with the REPLICAS points of
+ * each of its servers. A key goes to the zone found with its hash, then to
+ * the server found in that zone with a second (mixed) hash, so both lookups
+ * search rings that fit in cache.
+ *
+ * Adding or removing a server only rewrites the ring of its zone, and only
+ * servers of that zone exchange keys; a zone appears on the top-level ring
+ * with its first server and leaves it with its last one.
+ *
+ * The zoned mode is chosen before any server is added; it is not combined
+ * with replication, lazy migration, snapshots or the planner, which work on
+ * the flat hashring. Only loader_add_server() and loader_remove_server()
+ * are logged to the write-ahead log, so a log is replayed correctly when
+ * the servers were placed in their default zones.
+ */
+
+#define MAX_ZONES 1024
+/* points of each zone on the top-level ring */
+#define ZONE_POINTS 128
+
+typedef struct zone zone;
+struct zone {
+	hashring ring;  /* REPLICAS points per server, labels as on the flat ring */
+	int no_servers;
+};
+
+typedef struct zone_map zone_map;
+struct zone_map {
+	hashring ring;  /* zone labels: zone ID + MAX_ZONES * point */
+	zone **zones;  /* indexed by zone ID (NULL: no server in the zone) */
+	int *server_zones;  /* zone of each server (-1: no such server) */
+	int no_zones;
+	/* loader_add_server() puts a server in zone server_id % default_zones */
+	int default_zones;
+};
+
+/**
+ * loader_enable_zones() - Switches an empty load balancer to the zoned mode.
+ *
+ * @arg1: Load balancer, without servers.
+ * @arg2: Number of zones the servers of loader_add_server() are spread over
+ *        (1 to MAX_ZONES).
+ *
+ * Return: 0 on success, -1 if the load balancer has servers, replication
+ *         or lazy migration, or if the number of zones is out of range.
+ */
+int loader_enable_zones(load_balancer *main, int default_zones);
+
+void zones_free(zone_map *map);
+
+/* zones_key_hash() - Second hash of a key, placing it on its zone's ring. */
+unsigned int zones_key_hash(unsigned int hash);
+
+/* zones_point_hash() - Hash of a point of a zone on the top-level ring. */
+unsigned int zones_point_hash(int zone_id, int point);
+
+/* zones_find_server() - ID of the server responsible for a key hash. */
+int zones_find_server(const zone_map *map, unsigned int hash);
+
+/**
+ * loader_add_server_to_zone() - Adds a server to a given zone.
+ *
+ * The new server takes its keys from the servers of its zone; the first
+ * server of a zone brings the zone onto the top-level ring, and takes the
+ * keys of its arcs from the neighbor zones.
+ *
+ * @arg1: Load balancer, in the zoned mode.
+ * @arg2: ID of the new server.
+ * @arg3: Zone of the server (0 to MAX_ZONES - 1).
+ */
+void loader_add_server_to_zone(load_balancer *main, int server_id,
+							   int zone_id);
+
+/**
+ * loader_add_zone() - Adds a zone with all its servers at once.
+ *
+ * The ring of the zone is built before the zone joins the top-level ring,
+ * so the keys of its arcs move once, straight to their servers. A zone that
+ * already exists gets the servers one by one (loader_add_server_to_zone()).
+ *
+ * @arg1: Load balancer, in the zoned mode.
+ * @arg2: Zone ID (0 to MAX_ZONES - 1).
+ * @arg3: IDs of the new servers.
+ * @arg4: Number of IDs.
+ */
+void loader_add_zone(load_balancer *main, int zone_id, const int *server_ids,
+					 int count);
+
+/**
+ * loader_remove_zone() - Removes a zone and all its servers.
+ *
+ * The keys of the zone go to the zones that inherit its arcs of the
+ * top-level ring.
+ */
+void loader_remove_zone(load_balancer *main, int zone_id);
+
+/*
+ * zones_remove_server() - Takes a server out of its zone and hands its keys
+ * over to the servers that replace it (called by loader_remove_server(),
+ * which frees the server).
+ */
+void zones_remove_server(load_balancer *main, int server_id);
+
+/*
+ * loader_print_zone_stats() - Prints, for every zone: its servers, keys and
+ * bytes, its share of the keys, and the balance of its servers (keys of the
+ * most loaded server over the mean).
+ */
+void loader_print_zone_stats(load_balancer *main, FILE *out);
+
+#endif  // ZONES_H_